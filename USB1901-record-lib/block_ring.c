@@ -0,0 +1,125 @@
+/*
+ * Windows command line utility to record analog input samples in differential
+ * mode from a USB-1901 DAQ in double buffered mode.
+ *
+ * Copyright (C) 2014, 2016  Anders Gidenstam, Chalmers University of Technology
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*----------------------------------------------------------------------------*/
+/* Single-producer/single-consumer ring of fixed size sample blocks.          */
+/*----------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+
+#include "block_ring.h"
+
+/* Slot of the n:th block. The block counters are allowed to wrap, since
+ * the depth divides 2^32.
+ */
+#define RING_SLOT(ring, n)  ((DWORD)(n) & (DWORD)((ring)->depth - 1))
+
+int block_ring_init(block_ring_t* ring, int depth, int block_size)
+{
+    if (depth < 1 || (depth & (depth - 1)) != 0) {
+        return -1;
+    }
+    ring->depth = depth;
+    ring->block_size = block_size;
+    ring->head = 0;
+    ring->tail = 0;
+    ring->high_water = 0;
+    /* Keep every block aligned. */
+    ring->stride = (int)((block_size * sizeof(signed short) + BLOCK_ALIGNMENT - 1) /
+                         BLOCK_ALIGNMENT * BLOCK_ALIGNMENT / sizeof(signed short));
+    ring->data = (signed short*)_aligned_malloc(sizeof(signed short) * depth * ring->stride,
+                                                BLOCK_ALIGNMENT);
+    ring->info = (block_info_t*)malloc(sizeof(block_info_t) * depth);
+    ring->not_empty = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (ring->data == NULL || ring->info == NULL || ring->not_empty == NULL) {
+        block_ring_free(ring);
+        return -1;
+    }
+    return 0;
+}
+
+void block_ring_free(block_ring_t* ring)
+{
+    _aligned_free(ring->data);
+    free(ring->info);
+    if (ring->not_empty) CloseHandle(ring->not_empty);
+    ring->data = NULL;
+    ring->info = NULL;
+    ring->not_empty = NULL;
+}
+
+signed short* block_ring_acquire(block_ring_t* ring)
+{
+    LONG head = ring->head;
+    LONG tail = ring->tail;
+
+    /* Observe the consumer's release before reusing the block. */
+    MemoryBarrier();
+    if ((DWORD)(head - tail) >= (DWORD)ring->depth) {
+        return NULL;
+    }
+    return ring->data + (size_t)RING_SLOT(ring, head) * ring->stride;
+}
+
+void block_ring_publish(block_ring_t* ring, const block_info_t* info)
+{
+    LONG head = ring->head;
+    LONG used;
+
+    ring->info[RING_SLOT(ring, head)] = *info;
+    /* InterlockedExchange is a full barrier: the block contents are visible
+     * before the new head is.
+     */
+    InterlockedExchange(&ring->head, (LONG)((DWORD)head + 1));
+    used = (LONG)((DWORD)head + 1 - (DWORD)ring->tail);
+    if (used > ring->high_water) {
+        ring->high_water = used;
+    }
+    SetEvent(ring->not_empty);
+}
+
+signed short* block_ring_peek(block_ring_t* ring, const block_info_t** info)
+{
+    LONG tail = ring->tail;
+    LONG head = ring->head;
+
+    /* Observe the block contents published before head. */
+    MemoryBarrier();
+    if (head == tail) {
+        return NULL;
+    }
+    *info = &ring->info[RING_SLOT(ring, tail)];
+    return ring->data + (size_t)RING_SLOT(ring, tail) * ring->stride;
+}
+
+void block_ring_release(block_ring_t* ring)
+{
+    InterlockedExchange(&ring->tail, (LONG)((DWORD)ring->tail + 1));
+}
+
+void block_ring_wait(block_ring_t* ring, DWORD timeout)
+{
+    WaitForSingleObject(ring->not_empty, timeout);
+}
+
+int block_ring_used(const block_ring_t* ring)
+{
+    return (int)((DWORD)ring->head - (DWORD)ring->tail);
+}
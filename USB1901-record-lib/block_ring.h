@@ -0,0 +1,85 @@
+/*
+ * Windows command line utility to record analog input samples in differential
+ * mode from a USB-1901 DAQ in double buffered mode.
+ *
+ * Copyright (C) 2014, 2016  Anders Gidenstam, Chalmers University of Technology
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*----------------------------------------------------------------------------*/
+/* Single-producer/single-consumer ring of fixed size sample blocks.          */
+/*                                                                            */
+/* The acquisition thread fills blocks straight from the device and the       */
+/* delivery thread drains them. Neither side ever takes a lock; the only      */
+/* shared state is the head and tail block counters.                          */
+/*----------------------------------------------------------------------------*/
+
+#ifndef BLOCK_RING_H
+#define BLOCK_RING_H
+
+#include <windows.h>
+
+/* Alignment in bytes of every block. */
+#define BLOCK_ALIGNMENT     64
+
+/* Description of the samples in a block. */
+typedef struct {
+    int length;             /* Number of valid samples. */
+    DWORD lost_scans;       /* Scans known or estimated to be lost right before
+                               the first sample. */
+    __int64 qpc;            /* QueryPerformanceCounter() when the block was
+                               transferred from the card. */
+    signed short* mapped;   /* If not NULL the samples were transferred to
+                               here instead of into the block. */
+} block_info_t;
+
+typedef struct {
+    int depth;              /* Number of blocks in the ring. */
+    int block_size;         /* Capacity of each block in samples. */
+    int stride;             /* Samples from one block to the next. */
+    signed short* data;     /* depth * stride samples. */
+    block_info_t* info;     /* Description of each block. */
+    volatile LONG head;     /* Blocks published. Only written by the producer. */
+    volatile LONG tail;     /* Blocks released. Only written by the consumer. */
+    LONG high_water;        /* Max number of blocks in use at any time. */
+    HANDLE not_empty;       /* Signalled when a block is published. */
+} block_ring_t;
+
+/* Allocate a ring of depth blocks of block_size samples each. depth must be
+ * a power of two. Returns 0 on success and -1 on failure.
+ */
+int block_ring_init(block_ring_t* ring, int depth, int block_size);
+void block_ring_free(block_ring_t* ring);
+
+/* Producer side. block_ring_acquire() returns the next free block or NULL if
+ * the ring is full. block_ring_publish() hands that block and a copy of its
+ * description to the consumer.
+ */
+signed short* block_ring_acquire(block_ring_t* ring);
+void block_ring_publish(block_ring_t* ring, const block_info_t* info);
+
+/* Consumer side. block_ring_peek() returns the oldest published block and
+ * its description or NULL if the ring is empty. block_ring_release() returns
+ * it to the producer. block_ring_wait() blocks for at most timeout ms or
+ * until a block is published.
+ */
+signed short* block_ring_peek(block_ring_t* ring, const block_info_t** info);
+void block_ring_release(block_ring_t* ring);
+void block_ring_wait(block_ring_t* ring, DWORD timeout);
+
+/* Number of blocks published and not yet released. */
+int block_ring_used(const block_ring_t* ring);
+
+#endif
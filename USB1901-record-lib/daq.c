@@ -0,0 +1,136 @@
+/*
+ * Windows command line utility to record analog input samples in differential
+ * mode from a USB-1901 DAQ in double buffered mode.
+ *
+ * Copyright (C) 2014, 2016  Anders Gidenstam, Chalmers University of Technology
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*----------------------------------------------------------------------------*/
+/* The USB-1901 through UD-DASK.                                              */
+/*----------------------------------------------------------------------------*/
+
+#include "daq.h"
+
+/* Internal functions. The driver's calls are wrapped so that the table
+ * does not depend on their exact declarations and calling convention.
+ */
+static I16 usb1901_device_scan(U16* count, USBDAQ_DEVICE* modules);
+static I16 usb1901_register_card(U16 card_num);
+static I16 usb1901_release_card(U16 card);
+static I16 usb1901_ai_config(U16 card, U16 config_ctrl, U16 trig_ctrl, U32 trigger_level,
+                             U32 retrigger_count, U32 delay_count);
+static I16 usb1901_ai_dbl_buffer_mode(U16 card, BOOLEAN enable);
+static I16 usb1901_ai_counter_interval(U16 card, U32 scan_intrv, U32 samp_intrv);
+static I16 usb1901_ai_cont_read(U16 card, U16 no_channels, U16* channels, U16* ad_ranges,
+                                U32 read_count);
+static I16 usb1901_ai_half_ready(U16 card, BOOLEAN* half_ready, BOOLEAN* stopped);
+static I16 usb1901_ai_overrun(U16 card, U16 op, U16* overrun);
+static I16 usb1901_ai_transfer(U16 card, U16* buffer);
+static I16 usb1901_ai_event_callback(U16 card, U16 mode, void (*callback)(void));
+static I16 usb1901_ai_clear(U16 card, U32* access_count);
+
+const daq_t daq_usb1901 = {
+    "USB-1901",
+    usb1901_device_scan,
+    usb1901_register_card,
+    usb1901_release_card,
+    usb1901_ai_config,
+    usb1901_ai_dbl_buffer_mode,
+    usb1901_ai_counter_interval,
+    usb1901_ai_cont_read,
+    usb1901_ai_half_ready,
+    usb1901_ai_overrun,
+    usb1901_ai_transfer,
+    usb1901_ai_event_callback,
+    usb1901_ai_clear
+};
+
+static I16 usb1901_device_scan(U16* count, USBDAQ_DEVICE* modules)
+{
+    return UD_Device_Scan(count, modules);
+}
+
+static I16 usb1901_register_card(U16 card_num)
+{
+    return UD_Register_Card(USB_1901, card_num);
+}
+
+static I16 usb1901_release_card(U16 card)
+{
+    return UD_Release_Card(card);
+}
+
+static I16 usb1901_ai_config(U16 card, U16 config_ctrl, U16 trig_ctrl, U32 trigger_level,
+                             U32 retrigger_count, U32 delay_count)
+{
+    return UD_AI_1902_Config(card, config_ctrl, trig_ctrl, trigger_level,
+                             retrigger_count, delay_count);
+}
+
+static I16 usb1901_ai_dbl_buffer_mode(U16 card, BOOLEAN enable)
+{
+    return UD_AI_AsyncDblBufferMode(card, enable);
+}
+
+static I16 usb1901_ai_counter_interval(U16 card, U32 scan_intrv, U32 samp_intrv)
+{
+    return UD_AI_1902_CounterInterval(card, scan_intrv, samp_intrv);
+}
+
+/* Start a double buffered acquisition of read_count samples per buffer. */
+static I16 usb1901_ai_cont_read(U16 card, U16 no_channels, U16* channels, U16* ad_ranges,
+                                U32 read_count)
+{
+    if (no_channels == 1) {
+        return UD_AI_ContReadChannel(card, channels[0], ad_ranges[0], NULL /* Not used for DB */,
+                                     read_count, 0/*Ignore*/, ASYNCH_OP);
+    }
+    return UD_AI_ContReadMultiChannels(card, no_channels, channels, ad_ranges,
+                                       NULL /* Not used for DB */, read_count, 0/*Ignore*/,
+                                       ASYNCH_OP);
+}
+
+static I16 usb1901_ai_half_ready(U16 card, BOOLEAN* half_ready, BOOLEAN* stopped)
+{
+    return UD_AI_AsyncDblBufferHalfReady(card, half_ready, stopped);
+}
+
+static I16 usb1901_ai_overrun(U16 card, U16 op, U16* overrun)
+{
+    return UD_AI_AsyncDblBufferOverrun(card, op, overrun);
+}
+
+static I16 usb1901_ai_transfer(U16 card, U16* buffer)
+{
+    return UD_AI_AsyncDblBufferTransfer(card, buffer);
+}
+
+/* Add, mode 1, or remove, mode 0, the half buffer ready callback. The 64-bit
+ * library takes the address in a 64-bit argument of its own entry point.
+ */
+static I16 usb1901_ai_event_callback(U16 card, U16 mode, void (*callback)(void))
+{
+#ifdef _WIN64
+    return UD_AI_EventCallBack_x64(card, mode, DBEvent, (unsigned __int64)callback);
+#else
+    return UD_AI_EventCallBack(card, mode, DBEvent, (U32)callback);
+#endif
+}
+
+static I16 usb1901_ai_clear(U16 card, U32* access_count)
+{
+    return UD_AI_AsyncClear(card, access_count);
+}
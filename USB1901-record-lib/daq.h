@@ -0,0 +1,75 @@
+/*
+ * Windows command line utility to record analog input samples in differential
+ * mode from a USB-1901 DAQ in double buffered mode.
+ *
+ * Copyright (C) 2014, 2016  Anders Gidenstam, Chalmers University of Technology
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*----------------------------------------------------------------------------*/
+/* Acquisition devices.                                                       */
+/*                                                                            */
+/* The tool drives its cards through a table of the UD-DASK calls it uses,   */
+/* so that a simulated USB-1901 can stand in for the real one. Each entry    */
+/* takes the same arguments as the UD-DASK call it is named after and        */
+/* returns its error code, < 0 on failure.                                    */
+/*----------------------------------------------------------------------------*/
+
+#ifndef DAQ_H
+#define DAQ_H
+
+#include <windows.h>
+#include "UsbDask.h"
+
+typedef struct {
+    const char* name;
+    I16 (*device_scan)(U16* count, USBDAQ_DEVICE* modules);
+    I16 (*register_card)(U16 card_num);
+    I16 (*release_card)(U16 card);
+    I16 (*ai_config)(U16 card, U16 config_ctrl, U16 trig_ctrl, U32 trigger_level,
+                     U32 retrigger_count, U32 delay_count);
+    I16 (*ai_dbl_buffer_mode)(U16 card, BOOLEAN enable);
+    I16 (*ai_counter_interval)(U16 card, U32 scan_intrv, U32 samp_intrv);
+    I16 (*ai_cont_read)(U16 card, U16 no_channels, U16* channels, U16* ad_ranges,
+                        U32 read_count);
+    I16 (*ai_half_ready)(U16 card, BOOLEAN* half_ready, BOOLEAN* stopped);
+    I16 (*ai_overrun)(U16 card, U16 op, U16* overrun);
+    I16 (*ai_transfer)(U16 card, U16* buffer);
+    I16 (*ai_event_callback)(U16 card, U16 mode, void (*callback)(void));
+    I16 (*ai_clear)(U16 card, U32* access_count);
+} daq_t;
+
+/* The USB-1901 through UD-DASK. */
+extern const daq_t daq_usb1901;
+
+/* A simulated USB-1901 that produces synthetic samples at the programmed
+ * scan rate. It reports MAX_SIM_CARDS cards.
+ */
+#define MAX_SIM_CARDS       4
+extern const daq_t daq_simulated;
+
+/* Build the tables of the simulated card's synthetic data, once. Registering
+ * a simulated card does it; otherwise call it before daq_sim_fill().
+ */
+void daq_sim_init(void);
+
+/* Fill length samples of no_channels channels, starting with scan
+ * first_scan, with the simulated card's synthetic data. noise is the state
+ * of the noise generator, owned by the caller so that threads do not share it.
+ */
+void daq_sim_fill(signed short* buffer, U32 length, U16 no_channels,
+                  unsigned __int64 first_scan, U32* noise);
+
+#endif
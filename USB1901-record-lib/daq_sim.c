@@ -0,0 +1,309 @@
+/*
+ * Windows command line utility to record analog input samples in differential
+ * mode from a USB-1901 DAQ in double buffered mode.
+ *
+ * Copyright (C) 2014, 2016  Anders Gidenstam, Chalmers University of Technology
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*----------------------------------------------------------------------------*/
+/* A simulated USB-1901.                                                      */
+/*                                                                            */
+/* The card fills its double buffer in real time: a half is ready whenever   */
+/* the programmed scan interval says it would be. A half that is not         */
+/* collected before the next one is complete is reported as an overrun, and  */
+/* the data is produced only when it is transferred.                          */
+/*----------------------------------------------------------------------------*/
+
+#include <math.h>
+#include <process.h>
+#include <string.h>
+
+#include "daq.h"
+
+#define SIM_TIMEBASE        80000000    /* The card's 80 MHz clock. */
+#define SIM_WAVE_LENGTH     1024        /* Entries in the sine table. */
+
+typedef struct {
+    int registered;
+    int running;
+    U16 no_channels;
+    U32 scan_intrv;
+    U32 half_count;                     /* Samples per half buffer. */
+    LARGE_INTEGER start;                /* When the acquisition started. */
+    unsigned __int64 halves_done;       /* Halves transferred or overrun. */
+    U32 remaining;                      /* Samples left after ai_clear. */
+    int overrun;
+    void (*callback)(void);
+    HANDLE thread;                      /* Calls callback every half buffer. */
+    volatile LONG stop;
+    U32 noise;                          /* State of the noise generator. */
+} sim_card_t;
+
+/* Internal functions. */
+static I16 sim_device_scan(U16* count, USBDAQ_DEVICE* modules);
+static I16 sim_register_card(U16 card_num);
+static I16 sim_release_card(U16 card);
+static I16 sim_ai_config(U16 card, U16 config_ctrl, U16 trig_ctrl, U32 trigger_level,
+                         U32 retrigger_count, U32 delay_count);
+static I16 sim_ai_dbl_buffer_mode(U16 card, BOOLEAN enable);
+static I16 sim_ai_counter_interval(U16 card, U32 scan_intrv, U32 samp_intrv);
+static I16 sim_ai_cont_read(U16 card, U16 no_channels, U16* channels, U16* ad_ranges,
+                            U32 read_count);
+static I16 sim_ai_half_ready(U16 card, BOOLEAN* half_ready, BOOLEAN* stopped);
+static I16 sim_ai_overrun(U16 card, U16 op, U16* overrun);
+static I16 sim_ai_transfer(U16 card, U16* buffer);
+static I16 sim_ai_event_callback(U16 card, U16 mode, void (*callback)(void));
+static I16 sim_ai_clear(U16 card, U32* access_count);
+static unsigned __int64 sim_scans_now(const sim_card_t* sim);
+static unsigned __stdcall sim_callback_thread(void* arg);
+
+const daq_t daq_simulated = {
+    "simulated USB-1901",
+    sim_device_scan,
+    sim_register_card,
+    sim_release_card,
+    sim_ai_config,
+    sim_ai_dbl_buffer_mode,
+    sim_ai_counter_interval,
+    sim_ai_cont_read,
+    sim_ai_half_ready,
+    sim_ai_overrun,
+    sim_ai_transfer,
+    sim_ai_event_callback,
+    sim_ai_clear
+};
+
+static sim_card_t sim_card[MAX_SIM_CARDS];
+static short wave[SIM_WAVE_LENGTH];
+static int wave_built = 0;              /* Only set by the registering thread. */
+
+void daq_sim_init(void)
+{
+    int i;
+
+    if (wave_built) {
+        return;
+    }
+    wave_built = 1;
+    for (i = 0; i < SIM_WAVE_LENGTH; i++) {
+        wave[i] = (short)(12000.0 * sin(2.0 * 3.14159265358979 * i / SIM_WAVE_LENGTH));
+    }
+}
+
+void daq_sim_fill(signed short* buffer, U32 length, U16 no_channels,
+                  unsigned __int64 first_scan, U32* noise)
+{
+    unsigned __int64 scan = first_scan;
+    U32 i;
+    U16 c = 0;
+
+    /* A slow sine per channel with a few bits of noise, like a real signal. */
+    for (i = 0; i < length; i++) {
+        *noise = *noise * 1103515245 + 12345;
+        buffer[i] = (signed short)(wave[(U32)(scan + 97 * c) % SIM_WAVE_LENGTH] / (c + 1) +
+                                   (short)((*noise >> 16) & 63) - 32);
+        if (++c == no_channels) {
+            c = 0;
+            scan++;
+        }
+    }
+}
+
+static I16 sim_device_scan(U16* count, USBDAQ_DEVICE* modules)
+{
+    int i;
+
+    for (i = 0; i < MAX_SIM_CARDS && i < MAX_USB_DEVICE; i++) {
+        modules[i].wModuleType = USB_1901;
+        modules[i].wCardID = i;
+    }
+    *count = i;
+    return NoError;
+}
+
+static I16 sim_register_card(U16 card_num)
+{
+    if (card_num >= MAX_SIM_CARDS || sim_card[card_num].registered) {
+        return ErrorInvalidCardNumber;
+    }
+    /* Before any acquisition thread reads the table. */
+    daq_sim_init();
+    memset(&sim_card[card_num], 0, sizeof(sim_card_t));
+    sim_card[card_num].registered = 1;
+    sim_card[card_num].noise = 12345 + card_num;
+    return card_num;
+}
+
+static I16 sim_release_card(U16 card)
+{
+    U32 count;
+
+    if (card >= MAX_SIM_CARDS || !sim_card[card].registered) {
+        return ErrorInvalidCardNumber;
+    }
+    sim_ai_clear(card, &count);
+    sim_card[card].registered = 0;
+    return NoError;
+}
+
+static I16 sim_ai_config(U16 card, U16 config_ctrl, U16 trig_ctrl, U32 trigger_level,
+                         U32 retrigger_count, U32 delay_count)
+{
+    /* The simulation always starts at once. */
+    return NoError;
+}
+
+static I16 sim_ai_dbl_buffer_mode(U16 card, BOOLEAN enable)
+{
+    return NoError;
+}
+
+static I16 sim_ai_counter_interval(U16 card, U32 scan_intrv, U32 samp_intrv)
+{
+    sim_card[card].scan_intrv = scan_intrv;
+    return NoError;
+}
+
+static I16 sim_ai_cont_read(U16 card, U16 no_channels, U16* channels, U16* ad_ranges,
+                            U32 read_count)
+{
+    sim_card_t* sim = &sim_card[card];
+
+    if (sim->scan_intrv == 0 || read_count < 2*no_channels) {
+        return ErrorInvalidSampleRate;
+    }
+    sim->no_channels = no_channels;
+    sim->half_count = read_count/2;
+    sim->halves_done = 0;
+    sim->overrun = 0;
+    QueryPerformanceCounter(&sim->start);
+    sim->running = 1;
+    if (sim->callback != NULL) {
+        sim->stop = 0;
+        sim->thread = (HANDLE)_beginthreadex(NULL, 0, sim_callback_thread, sim, 0, NULL);
+    }
+    return NoError;
+}
+
+static I16 sim_ai_half_ready(U16 card, BOOLEAN* half_ready, BOOLEAN* stopped)
+{
+    sim_card_t* sim = &sim_card[card];
+    unsigned __int64 halves = sim_scans_now(sim) / (sim->half_count / sim->no_channels);
+
+    /* The card overwrites the oldest half once both are full. */
+    if (halves >= sim->halves_done + 2) {
+        sim->overrun = 1;
+        sim->halves_done = halves - 1;
+    }
+    *half_ready = halves > sim->halves_done;
+    *stopped = 0;
+    return NoError;
+}
+
+static I16 sim_ai_overrun(U16 card, U16 op, U16* overrun)
+{
+    if (op == 0) {
+        *overrun = (U16)sim_card[card].overrun;
+    } else {
+        sim_card[card].overrun = 0;
+    }
+    return NoError;
+}
+
+static I16 sim_ai_transfer(U16 card, U16* buffer)
+{
+    sim_card_t* sim = &sim_card[card];
+    U32 half_scans = sim->half_count / sim->no_channels;
+
+    if (!sim->running) {
+        /* The partial half buffer left by ai_clear. */
+        daq_sim_fill((signed short*)buffer, sim->remaining, sim->no_channels,
+                     sim->halves_done * half_scans, &sim->noise);
+        return NoError;
+    }
+    daq_sim_fill((signed short*)buffer, sim->half_count, sim->no_channels,
+                 sim->halves_done * half_scans, &sim->noise);
+    sim->halves_done++;
+    return NoError;
+}
+
+static I16 sim_ai_event_callback(U16 card, U16 mode, void (*callback)(void))
+{
+    sim_card[card].callback = mode ? callback : NULL;
+    return NoError;
+}
+
+static I16 sim_ai_clear(U16 card, U32* access_count)
+{
+    sim_card_t* sim = &sim_card[card];
+    unsigned __int64 scans;
+    unsigned __int64 done;
+
+    *access_count = 0;
+    if (!sim->running) {
+        return NoError;
+    }
+    if (sim->thread != NULL) {
+        InterlockedExchange(&sim->stop, 1);
+        WaitForSingleObject(sim->thread, INFINITE);
+        CloseHandle(sim->thread);
+        sim->thread = NULL;
+    }
+    scans = sim_scans_now(sim);
+    done = sim->halves_done * (sim->half_count / sim->no_channels);
+    sim->remaining = scans > done ? (U32)(scans - done) * sim->no_channels : 0;
+    if (sim->remaining > sim->half_count) {
+        sim->remaining = sim->half_count;
+    }
+    sim->running = 0;
+    *access_count = sim->remaining;
+    return NoError;
+}
+
+/* Scans the card has acquired since the start. */
+static unsigned __int64 sim_scans_now(const sim_card_t* sim)
+{
+    LARGE_INTEGER now, frequency;
+
+    QueryPerformanceCounter(&now);
+    QueryPerformanceFrequency(&frequency);
+    return (unsigned __int64)((double)(now.QuadPart - sim->start.QuadPart) *
+                              SIM_TIMEBASE / (double)frequency.QuadPart / sim->scan_intrv);
+}
+
+/* Call the half buffer ready callback whenever a half would be complete. */
+static unsigned __stdcall sim_callback_thread(void* arg)
+{
+    sim_card_t* sim = (sim_card_t*)arg;
+    double half_ms = 1000.0 * (sim->half_count / sim->no_channels) * sim->scan_intrv / SIM_TIMEBASE;
+    unsigned __int64 halves = 0;
+    unsigned __int64 due;
+    double wait;
+
+    while (!sim->stop) {
+        due = sim_scans_now(sim) / (sim->half_count / sim->no_channels);
+        if (due > halves) {
+            halves = due;
+            sim->callback();
+            continue;
+        }
+        /* Sleep until about when the next half is complete. */
+        wait = half_ms * (double)(halves + 1) -
+               1000.0 * (double)sim_scans_now(sim) * sim->scan_intrv / SIM_TIMEBASE;
+        Sleep(wait > 1.0 ? (DWORD)wait : 1);
+    }
+    return 0;
+}
@@ -0,0 +1,103 @@
+/*
+ * Windows command line utility to record analog input samples in differential
+ * mode from a USB-1901 DAQ in double buffered mode.
+ *
+ * Copyright (C) 2014, 2016  Anders Gidenstam, Chalmers University of Technology
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*----------------------------------------------------------------------------*/
+/* Always-on instrumentation of the path of a half buffer.                    */
+/*----------------------------------------------------------------------------*/
+
+#include <string.h>
+
+#include "instrument.h"
+
+static const char* stage_name[NO_STAGES] = { "ready", "transfer", "convert", "write" };
+
+void instrument_init(instrument_t* in, __int64 frequency)
+{
+    memset(in, 0, sizeof(instrument_t));
+    in->frequency = frequency;
+}
+
+void instrument_stage(instrument_t* in, int stage, __int64 start, __int64 end)
+{
+    histogram_t* h = &in->stage[stage];
+    __int64 ticks = end - start;
+    unsigned __int64 us;
+    int b = 0;
+
+    if (ticks < 0) {
+        ticks = 0;
+    }
+    if (h->count == 0 || ticks < h->min) {
+        h->min = ticks;
+    }
+    if (ticks > h->max) {
+        h->max = ticks;
+    }
+    h->count++;
+    h->sum += ticks;
+    us = (unsigned __int64)ticks * 1000000 / (unsigned __int64)in->frequency;
+    while (us > 0 && b < HISTOGRAM_BUCKETS - 1) {
+        us >>= 1;
+        b++;
+    }
+    h->bucket[b]++;
+}
+
+void instrument_block(instrument_t* in, int used)
+{
+    in->blocks++;
+    in->occupancy[used < MAX_OCCUPANCY ? used : MAX_OCCUPANCY]++;
+}
+
+void instrument_print_json(FILE* f, const instrument_t* in, const char* indent)
+{
+    const histogram_t* h;
+    double ms = 1000.0 / (double)in->frequency;
+    int last;
+    int s;
+    int b;
+
+    fprintf(f, "%s\"blocks\": %lu,\n", indent, (unsigned long)in->blocks);
+    fprintf(f, "%s\"bytes\": %.0f,\n", indent, (double)in->bytes);
+
+    /* Leave out the counts of occupancies that never happened at the top. */
+    for (last = MAX_OCCUPANCY; last > 0 && in->occupancy[last] == 0; last--)
+        ;
+    fprintf(f, "%s\"ring_occupancy\": [", indent);
+    for (b = 0; b <= last; b++) {
+        fprintf(f, b == 0 ? "%lu" : ", %lu", (unsigned long)in->occupancy[b]);
+    }
+    fprintf(f, "],\n");
+
+    fprintf(f, "%s\"stages\": {\n", indent);
+    for (s = 0; s < NO_STAGES; s++) {
+        h = &in->stage[s];
+        fprintf(f, "%s  \"%s\": {\"count\": %lu, \"min_ms\": %.4f, \"mean_ms\": %.4f, "
+                "\"max_ms\": %.4f,\n",
+                indent, stage_name[s], (unsigned long)h->count, h->min * ms,
+                h->count > 0 ? (double)h->sum / h->count * ms : 0.0, h->max * ms);
+        fprintf(f, "%s    \"us_below_pow2\": [", indent);
+        for (b = 0; b < HISTOGRAM_BUCKETS; b++) {
+            fprintf(f, b == 0 ? "%lu" : ", %lu", (unsigned long)h->bucket[b]);
+        }
+        fprintf(f, "]}%s\n", s + 1 < NO_STAGES ? "," : "");
+    }
+    fprintf(f, "%s}\n", indent);
+}
@@ -0,0 +1,90 @@
+/*
+ * Windows command line utility to record analog input samples in differential
+ * mode from a USB-1901 DAQ in double buffered mode.
+ *
+ * Copyright (C) 2014, 2016  Anders Gidenstam, Chalmers University of Technology
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*----------------------------------------------------------------------------*/
+/* Always-on instrumentation of the path of a half buffer.                    */
+/*                                                                            */
+/* Each stage a half buffer passes through is timed with the                  */
+/* QueryPerformanceCounter() and added to a histogram with power of two       */
+/* buckets. Adding a time is a handful of instructions, so it is done for    */
+/* every half buffer. The acquisition thread owns the ready and transfer      */
+/* stages, the writer thread everything else; readers on other threads may   */
+/* see a snapshot that is one half buffer out of date.                        */
+/*----------------------------------------------------------------------------*/
+
+#ifndef INSTRUMENT_H
+#define INSTRUMENT_H
+
+#include <stdio.h>
+#include <windows.h>
+
+/* Stages of a half buffer. */
+#define STAGE_READY         0   /* The driver's callback, or the previous
+                                   poll, until the acquisition thread saw it
+                                   ready. */
+#define STAGE_TRANSFER      1   /* Copying it from the driver. */
+#define STAGE_CONVERT       2   /* Formatting, power and aggregates. */
+#define STAGE_WRITE         3   /* Handing it to the file or compressor. */
+#define NO_STAGES           4
+
+/* Bucket i counts the times below 2^i microseconds but not below 2^(i-1);
+ * the last bucket also counts everything longer.
+ */
+#define HISTOGRAM_BUCKETS   24
+
+/* Ring occupancy is counted per number of blocks; the last entry also counts
+ * all higher numbers.
+ */
+#define MAX_OCCUPANCY       64
+
+typedef struct {
+    DWORD count;
+    __int64 sum;                        /* QPC ticks. */
+    __int64 min;
+    __int64 max;
+    DWORD bucket[HISTOGRAM_BUCKETS];
+} histogram_t;
+
+typedef struct {
+    __int64 frequency;                  /* QPC ticks per second. */
+    histogram_t stage[NO_STAGES];
+    DWORD blocks;                       /* Half buffers processed. */
+    unsigned __int64 bytes;             /* Bytes handed to the output, before
+                                           compression. */
+    DWORD occupancy[MAX_OCCUPANCY + 1]; /* Blocks in the ring each time the
+                                           writer took one. */
+} instrument_t;
+
+/* Start from nothing with QPC frequency ticks per second. */
+void instrument_init(instrument_t* in, __int64 frequency);
+
+/* Add the time from start to end, in QPC ticks, to stage. */
+void instrument_stage(instrument_t* in, int stage, __int64 start, __int64 end);
+
+/* Count a half buffer taken from the ring with used blocks in it. */
+void instrument_block(instrument_t* in, int used);
+
+/* Print the counters and histograms as the members of a JSON object,
+ * each line starting with indent.
+ */
+void instrument_print_json(FILE* f, const instrument_t* in, const char* indent);
+
+
+#endif
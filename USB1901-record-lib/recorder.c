@@ -0,0 +1,940 @@
+/*
+ * Windows command line utility to record analog input samples in differential
+ * mode from a USB-1901 DAQ in double buffered mode.
+ *
+ * Copyright (C) 2014, 2016  Anders Gidenstam, Chalmers University of Technology
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*----------------------------------------------------------------------------*/
+/* Recording from USB-1901 cards.                                             */
+/*----------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <process.h>
+#include <avrt.h>
+
+#include "recorder.h"
+
+/* Internal functions. */
+static int setup_cards(recorder_t* recorder);
+static void reset_card(recorder_card_t* dev);
+static int choose_buffer_size(recorder_card_t* dev);
+static int choose_intervals(recorder_card_t* dev);
+static int open_cards(recorder_t* recorder);
+static int open_USB1901(recorder_card_t* dev, U16 card_num);
+static U32 trigger_level_code(recorder_card_t* dev);
+static int start_USB1901(recorder_card_t* dev);
+static void register_half_ready_event(recorder_card_t* dev);
+static void half_ready(int slot);
+static void half_ready_callback_0(void);
+static void half_ready_callback_1(void);
+static void half_ready_callback_2(void);
+static void half_ready_callback_3(void);
+static unsigned __stdcall acquisition_thread(void* arg);
+static unsigned __stdcall delivery_thread(void* arg);
+static HANDLE setup_thread(recorder_card_t* dev, int acquisition);
+static unsigned __int64 estimate_lost_scans(recorder_card_t* dev, double elapsed);
+static U32 add_lost_scans(U32 pending, unsigned __int64 scans);
+
+/* The driver's callbacks take no arguments, so each card registered by any
+ * recorder takes one of these and the slot of half_ready_card that goes
+ * with it.
+ */
+static void (* const half_ready_callback[MAX_DEVICES])(void) = {
+    half_ready_callback_0,
+    half_ready_callback_1,
+    half_ready_callback_2,
+    half_ready_callback_3
+};
+static recorder_card_t* volatile half_ready_card[MAX_DEVICES];
+
+void recorder_init(recorder_t* recorder)
+{
+    recorder_card_t* dev;
+    int d;
+
+    memset(recorder, 0, sizeof(recorder_t));
+    recorder->config.sample_rate = 200;
+    recorder->config.input_config = P1902_AI_Differential;
+    recorder->config.trigger_mode = P1902_AI_TRGMOD_POST;
+    recorder->config.trigger_source = P1902_AI_TRGSRC_SOFT;
+    recorder->config.trigger_polarity = P1902_AI_TrgPositive;
+    recorder->config.ai_count = DEFAULT_AI_COUNT;
+    recorder->config.ring_depth = DEFAULT_RING_DEPTH;
+    recorder->config.priority = PRIORITY_NORMAL;
+    recorder->no_cards = 1;
+    for (d = 0; d < MAX_DEVICES; d++) {
+        dev = &recorder->card[d];
+        dev->recorder = recorder;
+        dev->card_id = INVALID_CARD_ID;
+        dev->card = INVALID_CARD_ID;
+        dev->daq = &daq_usb1901;
+        dev->wait_mode = WAIT_MODE_EVENT;
+        dev->callback_slot = -1;
+        dev->acquisition_core = NO_CORE;
+        dev->delivery_core = NO_CORE;
+    }
+}
+
+int recorder_open(recorder_t* recorder)
+{
+    if (recorder->open) {
+        return 0;
+    }
+    QueryPerformanceFrequency(&recorder->qpc_frequency);
+    recorder->open = 1;
+    if (setup_cards(recorder) < 0 || open_cards(recorder) < 0) {
+        recorder_close(recorder);
+        return -1;
+    }
+    return 0;
+}
+
+int recorder_start(recorder_t* recorder)
+{
+    recorder_card_t* dev;
+    int d;
+
+    if (!recorder->open || recorder->running) {
+        fprintf(stderr, "recorder_start: The recorder is %s.\n",
+                recorder->open ? "already recording" : "not open");
+        return -1;
+    }
+    /* Sleep() and the waits for the card wake up on the next timer tick. */
+    if (recorder->config.priority != PRIORITY_NORMAL &&
+        timeBeginPeriod(TIMER_RESOLUTION) != TIMERR_NOERROR) {
+        fprintf(stderr, "timeBeginPeriod(%d) failed.\n", TIMER_RESOLUTION);
+    }
+    recorder->stop_requested = 0;
+    for (d = 0; d < recorder->no_cards; d++) {
+        dev = &recorder->card[d];
+        reset_card(dev);
+        register_half_ready_event(dev);
+    }
+    recorder->running = 1;
+
+    /* Start all cards as close together as possible. */
+    recorder->t1 = recorder_seconds();
+    GetSystemTimeAsFileTime(&recorder->start_time);
+    for (d = 0; d < recorder->no_cards; d++) {
+        if (start_USB1901(&recorder->card[d]) < 0) {
+            recorder_stop(recorder);
+            return -1;
+        }
+    }
+
+    for (d = 0; d < recorder->no_cards; d++) {
+        dev = &recorder->card[d];
+        if (recorder->callbacks.start != NULL && recorder->callbacks.start(dev) < 0) {
+            recorder_stop(recorder);
+            return -1;
+        }
+
+        /* Acquire and deliver the samples. */
+        dev->delivery = (HANDLE)_beginthreadex(NULL, 0, delivery_thread, dev, 0, NULL);
+        dev->acquisition = dev->delivery == NULL ? NULL :
+                            (HANDLE)_beginthreadex(NULL, 0, acquisition_thread, dev, 0, NULL);
+        if (dev->delivery == NULL || dev->acquisition == NULL) {
+            fprintf(stderr, "_beginthreadex Error: %d\n", errno);
+            recorder_stop(recorder);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int recorder_stop(recorder_t* recorder)
+{
+    recorder_card_t* dev;
+    U32 count;
+    int result = 0;
+    int d;
+
+    if (!recorder->running) {
+        return 0;
+    }
+    InterlockedExchange(&recorder->stop_requested, 1);
+    for (d = 0; d < recorder->no_cards; d++) {
+        dev = &recorder->card[d];
+        if (dev->acquisition != NULL) {
+            WaitForSingleObject(dev->acquisition, INFINITE);
+            CloseHandle(dev->acquisition);
+            dev->acquisition = NULL;
+        } else {
+            /* The recording failed to start; the card may be running. */
+            if (dev->waiting == WAIT_MODE_EVENT) {
+                dev->daq->ai_event_callback(dev->card, 0 /* Remove */, NULL);
+            }
+            dev->daq->ai_clear(dev->card, &count);
+            dev->t2 = recorder_seconds();
+            InterlockedExchange(&dev->acquisition_done, 1);
+        }
+        if (dev->delivery != NULL) {
+            WaitForSingleObject(dev->delivery, INFINITE);
+            CloseHandle(dev->delivery);
+            dev->delivery = NULL;
+        }
+        if (dev->failed) {
+            result = -1;
+        }
+    }
+    if (recorder->config.priority != PRIORITY_NORMAL) {
+        timeEndPeriod(TIMER_RESOLUTION);
+    }
+    recorder->running = 0;
+    return result;
+}
+
+void recorder_close(recorder_t* recorder)
+{
+    recorder_card_t* dev;
+    int d;
+
+    recorder_stop(recorder);
+    for (d = 0; d < recorder->no_cards; d++) {
+        dev = &recorder->card[d];
+        if (dev->card != INVALID_CARD_ID) {
+            dev->daq->release_card(dev->card);
+            dev->card = INVALID_CARD_ID;
+        }
+        if (dev->callback_slot >= 0) {
+            half_ready_card[dev->callback_slot] = NULL;
+            dev->callback_slot = -1;
+        }
+        if (dev->half_ready_event) {
+            CloseHandle(dev->half_ready_event);
+            dev->half_ready_event = NULL;
+        }
+        block_ring_free(&dev->ring);
+    }
+    recorder->open = 0;
+}
+
+int recorder_failed(const recorder_t* recorder)
+{
+    int d;
+
+    for (d = 0; d < recorder->no_cards; d++) {
+        if (recorder->card[d].failed) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+double recorder_seconds(void)
+{
+    LARGE_INTEGER now, frequency;
+
+    QueryPerformanceCounter(&now);
+    QueryPerformanceFrequency(&frequency);
+    return (double)now.QuadPart / (double)frequency.QuadPart;
+}
+
+double ad_range_to_volt(U16 range)
+{
+    switch (range) {
+    case AD_B_0_2_V:
+        return 0.200;
+    case AD_B_1_V:
+        return 1.00;
+    case AD_B_2_V:
+        return 2.00;
+    case AD_B_10_V:
+        return 10.00;
+    default:
+        fprintf(stderr, "ad_range_to_volt: Unknown AD range.");
+        return 0.00;
+    }
+}
+
+/* The intervals and the ring of each card. */
+static int setup_cards(recorder_t* recorder)
+{
+    recorder_card_t* dev;
+    int d;
+
+    for (d = 0; d < recorder->no_cards; d++) {
+        dev = &recorder->card[d];
+        if (choose_intervals(dev) < 0 || choose_buffer_size(dev) < 0) {
+            return -1;
+        }
+        if (block_ring_init(&dev->ring, recorder->config.ring_depth, dev->half_count) < 0) {
+            fprintf(stderr, "Failed to allocate a ring of %d buffers; the depth must be a power of two.\n",
+                    recorder->config.ring_depth);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Clear what the card's last recording left behind. */
+static void reset_card(recorder_card_t* dev)
+{
+    dev->acquisition_done = 0;
+    dev->failed = 0;
+    dev->samples = 0;
+    dev->last_samples = 0;
+    dev->dropped_blocks = 0;
+    dev->dropped_scans = 0;
+    dev->overruns = 0;
+    dev->overrun_scans = 0;
+    dev->ring.high_water = 0;
+    instrument_init(&dev->stats, dev->recorder->qpc_frequency.QuadPart);
+}
+
+/* Size the double buffer. Each half holds whole scans, so every buffer
+ * handed to process_samples() starts with the first channel.
+ */
+static int choose_buffer_size(recorder_card_t* dev)
+{
+    const recorder_config_t* config = &dev->recorder->config;
+    int sample_rate = config->sample_rate;
+    U32 ai_count = config->ai_count;
+    int half_period = config->half_period;
+    double half;
+    int no_channels = dev->no_channels;
+
+    if (half_period > 0) {
+        half = (double)sample_rate * no_channels * half_period / 1000.0;
+        if (half < MIN_HALF_COUNT) {
+            half = MIN_HALF_COUNT;
+        }
+        if (half > MAX_AI_COUNT/2) {
+            half = MAX_AI_COUNT/2;
+        }
+        dev->half_count = (U32)half;
+    } else {
+        dev->half_count = ai_count/2;
+    }
+    /* Round up to whole scans. */
+    dev->half_count = (dev->half_count + no_channels - 1) / no_channels * no_channels;
+    if (2*dev->half_count > MAX_AI_COUNT) {
+        dev->half_count -= no_channels;
+    }
+    if (ai_count != 2*dev->half_count && half_period == 0) {
+        printf("Rounded the buffer size to %d samples; %d scans per half buffer.\n",
+               2*dev->half_count, dev->half_count/no_channels);
+    }
+    dev->ai_count = 2*dev->half_count;
+    printf("Each half buffer holds %d samples and fills in %.1f ms.\n",
+           dev->half_count, 1000.0 * dev->half_count / no_channels / sample_rate);
+    return 0;
+}
+
+/* Choose the scan and sample intervals of the card, and check that the
+ * conversions of a scan fit in the scan interval.
+ */
+static int choose_intervals(recorder_card_t* dev)
+{
+    const recorder_config_t* config = &dev->recorder->config;
+    U32 samp_intrv = config->samp_intrv;
+    U32 scan = U1902_TIMEBASE/config->sample_rate;
+    U32 samp = samp_intrv;
+    U32 max_samp;
+    U32 fastest = samp_intrv > 0 && dev->no_channels > 1 ? samp_intrv : MIN_SAMP_INTRV;
+    int c;
+
+    if (dev->no_channels < 1) {
+        fprintf(stderr, "No channels selected.\n");
+        return -1;
+    }
+    max_samp = scan / dev->no_channels;
+
+    if (config->input_config == P1902_AI_Differential) {
+        for (c = 0; c < dev->no_channels; c++) {
+            if (dev->channel[c].id > 7) {
+                fprintf(stderr, "Channel %d does not exist with differential inputs.\n",
+                        dev->channel[c].id);
+                return -1;
+            }
+        }
+    }
+    if (dev->no_channels == 1) {
+        samp = MIN_SAMP_INTRV; /* With just one channel the minimum value should be safe. */
+    } else if (samp == 0) {
+        samp = DEFAULT_SAMP_INTRV < max_samp ? DEFAULT_SAMP_INTRV : max_samp;
+    }
+    if (samp < MIN_SAMP_INTRV || (unsigned __int64)samp * dev->no_channels > scan) {
+        fprintf(stderr, "A scan rate of %d Hz is too high for %d channels. The maximum is "
+                "%.1f Hz with a sample interval of %d.\n",
+                config->sample_rate, dev->no_channels,
+                (double)U1902_TIMEBASE / ((double)dev->no_channels * fastest), fastest);
+        return -1;
+    }
+    dev->scan_intrv = scan;
+    dev->samp_intrv = samp;
+    printf("Scanning %d channels at %.3f Hz (%.0f samples/s), %.2f us per conversion.\n",
+           dev->no_channels, (double)U1902_TIMEBASE / scan,
+           (double)U1902_TIMEBASE / scan * dev->no_channels,
+           1e6 * samp / U1902_TIMEBASE);
+    return 0;
+}
+
+/* Find, register and configure all cards of the recorder. */
+static int open_cards(recorder_t* recorder)
+{
+    recorder_card_t* device = recorder->card;
+    int no_devices = recorder->no_cards;
+    I16 err;
+    U16 wModuleNum;
+    USBDAQ_DEVICE AvailModules[MAX_USB_DEVICE];
+    U16 card_num;
+    int d, e;
+    U32 i;
+
+    /* Find all devices. */
+    err = device[0].daq->device_scan(&wModuleNum, AvailModules);
+    if (err < 0) {
+        fprintf(stderr, "UD_Device_Scan Error: %d\n", err);
+        return -1;
+    }
+
+    for (d = 0; d < no_devices; d++) {
+        card_num = INVALID_CARD_ID;
+
+        for (i = 0; i < wModuleNum; i++) {
+            if (AvailModules[i].wModuleType != USB_1901) {
+                continue;
+            }
+            if (device[d].card_id == AvailModules[i].wCardID) {
+                card_num = AvailModules[i].wCardID;
+                break;
+            }
+            /* Pick the first available device of the right type. */
+            if (device[d].card_id == INVALID_CARD_ID) {
+                for (e = 0; e < no_devices; e++) {
+                    if (device[e].card_id == AvailModules[i].wCardID) {
+                        break;
+                    }
+                }
+                if (e == no_devices) {
+                    card_num = AvailModules[i].wCardID;
+                    break;
+                }
+            }
+        }
+
+        if (card_num == INVALID_CARD_ID) {
+            if (device[d].card_id == INVALID_CARD_ID) {
+                fprintf(stderr, "No active USB_1901 USB device\n");
+            } else {
+                fprintf(stderr, "No active USB_1901 USB device with card id %d\n",
+                        device[d].card_id);
+            }
+            return -1;
+        }
+        device[d].card_id = card_num;
+        if (open_USB1901(&device[d], card_num) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* The analog trigger level as an ADC code of the trigger channel's range,
+ * or of +/-10 V if it is not sampled.
+ */
+static U32 trigger_level_code(recorder_card_t* dev)
+{
+    const recorder_config_t* config = &dev->recorder->config;
+    U16 trigger_source = config->trigger_source;
+    U16 id = trigger_source == P1902_AI_TRGSRC_AI1 ? 1 : 0;
+    double scale = ad_range_to_volt(AD_B_10_V)/(double)(1<<15);
+    double code;
+    int c;
+
+    if (trigger_source != P1902_AI_TRGSRC_AI0 && trigger_source != P1902_AI_TRGSRC_AI1) {
+        return 0;
+    }
+    for (c = 0; c < dev->no_channels; c++) {
+        if (dev->channel[c].id == id) {
+            scale = ad_range_to_volt(dev->channel[c].AdRange)/(double)(1<<15);
+        }
+    }
+    code = floor(config->trigger_level / scale + 0.5);
+    if (code < -32768.0) code = -32768.0;
+    if (code > 32767.0) code = 32767.0;
+    return (U32)(U16)(short)code;
+}
+
+/* Register and configure the card. The acquisition is started separately
+ * by start_USB1901().
+ */
+static int open_USB1901(recorder_card_t* dev, U16 card_num)
+{
+    const recorder_config_t* config = &dev->recorder->config;
+    I16 card, err;
+
+    /* Card configuration. */
+    /* P1902_AI_Differential gives reasonable numbers for diff channels 0 and 1 but not 2 and 3?
+     * P1902_AI_NonRef_SingEnded gives very strange numbers.
+     * P1902_AI_SingEnded works. Note: each end of the shunt is a channel. Leads to poor accuracy.
+     */
+    U16 ConfigCtrl = config->input_config|P1902_AI_CONVSRC_INT;
+    U16 TrigCtrl = config->trigger_mode|config->trigger_source|config->trigger_polarity;
+    U32 TriggerLvel = trigger_level_code(dev);  /* Ignore for P1902_AI_TRGSRC_SOFT */
+    U32 ReTriggerCount = 0; /*Ignore in Double Buffer Mode*/
+    U32 DelayCount = config->trigger_delay; /* Ignore for P1902_AI_TRGSRC_SOFT */
+    U32 ScanIntrv = dev->scan_intrv; /* Interval in clock cycles between scans of the channels. 80Mhz/scan freq. */
+    U32 SampIntrv = dev->samp_intrv; /* Interval in clock cycles between each A/D conversion. The UD-DASK manual claims that 320 is the only valid value for USB-1901. The USB-1901 manual says it is the _minimum_ value. */
+
+    printf("Configuring USB-1901 card %d to perform analog data acquisition from %d channels\n",
+           card_num, dev->no_channels);
+    printf("at %6.3lf Hz scan rate in double buffer mode.\n\n", (double)U1902_TIMEBASE/(double)ScanIntrv);
+
+    /* Register/open the device. */
+    card = dev->daq->register_card(card_num);
+    if (card < 0) {
+        fprintf(stderr, "UD_Register_Card Error: %d\n", card);
+        return -1;
+    }
+    dev->card = card;
+
+    /* Configure Analog Input */
+    err = dev->daq->ai_config(card, ConfigCtrl, TrigCtrl, TriggerLvel, ReTriggerCount, DelayCount);
+    if(err < 0) {
+        fprintf(stderr, "UD_AI_1902_Config Error: %d\n", err);
+        return -1;
+    }
+
+    /* Enable Double Buffer Mode */
+    err = dev->daq->ai_dbl_buffer_mode(card, 1); // double-buffer mode
+    if (err < 0) {
+        fprintf(stderr, "UD_AI_AsyncDblBufferMode Error: %d\n", err);
+        return -1;
+    }
+
+    /* Set Scan and Sampling Rate, as checked by choose_intervals(). */
+    err = dev->daq->ai_counter_interval(card, ScanIntrv, SampIntrv);
+    if (err < 0) {
+        fprintf(stderr, "UD_AI_1902_CounterInterval Error: %d\n", err);
+        return -1;
+    }
+    return 0;
+}
+
+/* Start the acquisition on a configured card. */
+static int start_USB1901(recorder_card_t* dev)
+{
+    I16 card = dev->card;
+    I16 err;
+    U32 AI_ReadCount = dev->ai_count; /*AI read count per one buffer*/
+    U16 NumChans = dev->no_channels; /*AI Channel Counts to be read*/
+    U16 Chans[MAX_CHANNELS]; /*AI Channels array*/
+    U16 AdRanges[MAX_CHANNELS]; /*AI Ranges array*/
+    U32 i;
+
+    /* Configure the channel order and per-channel range. */
+    for (i=0; i < NumChans; i++) {
+        Chans[i] = dev->channel[i].id;
+        AdRanges[i] = dev->channel[i].AdRange;
+    }
+
+    /* AI Acquisition Start */
+    err = dev->daq->ai_cont_read(card, NumChans, Chans, AdRanges, AI_ReadCount);
+    if (err < 0) {
+        DWORD dwError = GetLastError();
+
+        fprintf(stderr, "%s Error: %d, GetLastError = %d\n",
+                NumChans == 1 ? "UD_AI_ContReadChannel" : "UD_AI_ContReadMultiChannels",
+                err, dwError );
+        return -1;
+    }
+    QueryPerformanceCounter(&dev->start_qpc);
+    return 0;
+}
+
+/* Set up the driver to signal the card's half_ready_event whenever a half
+ * buffer is ready. The acquisition thread removes the callback when it ends,
+ * so this is done for every recording. Falls back to polling for this
+ * recording if the driver does not support the event or all callbacks are
+ * taken.
+ */
+static void register_half_ready_event(recorder_card_t* dev)
+{
+    I16 err;
+    int slot;
+
+    dev->waiting = dev->wait_mode;
+    if (dev->wait_mode != WAIT_MODE_EVENT) {
+        return;
+    }
+    for (slot = 0; dev->callback_slot < 0 && slot < MAX_DEVICES; slot++) {
+        if (InterlockedCompareExchangePointer((PVOID volatile*)&half_ready_card[slot],
+                                              dev, NULL) == NULL) {
+            dev->callback_slot = slot;
+        }
+    }
+    if (dev->callback_slot < 0) {
+        fprintf(stderr, "All %d callbacks are in use. Falling back to polling.\n", MAX_DEVICES);
+        dev->waiting = WAIT_MODE_POLL;
+        return;
+    }
+    if (dev->half_ready_event == NULL) {
+        dev->half_ready_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+        if (dev->half_ready_event == NULL) {
+            fprintf(stderr, "CreateEvent Error: %d. Falling back to polling.\n", GetLastError());
+            dev->waiting = WAIT_MODE_POLL;
+            return;
+        }
+    }
+    err = dev->daq->ai_event_callback(dev->card, 1 /* Add */,
+                                      half_ready_callback[dev->callback_slot]);
+    if (err < 0) {
+        fprintf(stderr, "UD_AI_EventCallBack Error: %d. Falling back to polling.\n", err);
+        dev->waiting = WAIT_MODE_POLL;
+    }
+}
+
+/* Called by the driver when a half buffer of the card in slot is ready. */
+static void half_ready(int slot)
+{
+    recorder_card_t* dev = half_ready_card[slot];
+    LARGE_INTEGER now;
+
+    QueryPerformanceCounter(&now);
+    if (dev != NULL) {
+        dev->ready_qpc = now.QuadPart;
+        SetEvent(dev->half_ready_event);
+    }
+}
+
+static void half_ready_callback_0(void)
+{
+    half_ready(0);
+}
+
+static void half_ready_callback_1(void)
+{
+    half_ready(1);
+}
+
+static void half_ready_callback_2(void)
+{
+    half_ready(2);
+}
+
+static void half_ready_callback_3(void)
+{
+    half_ready(3);
+}
+
+/* Services one card: moves each half buffer into the ring as soon as it is
+ * ready and does nothing else, so that it is never held up by the output.
+ */
+static unsigned __stdcall acquisition_thread(void* arg)
+{
+    recorder_card_t* dev = (recorder_card_t*)arg;
+    I16 card = dev->card;
+    I16 err;
+    BOOLEAN Stopped;
+    BOOLEAN HalfReady;
+    U32 AccessCnt = 0;
+    U16 Overrun;
+    int check_overrun = 1;
+    unsigned __int64 lost;
+    U32 pending_lost = 0;   /* Lost scans not yet reported to the delivery thread. */
+    double last_transfer = recorder_seconds();
+    LARGE_INTEGER checked;
+    LARGE_INTEGER last_checked;
+    LARGE_INTEGER transferring;
+    LARGE_INTEGER transferred;
+    block_info_t info;
+    signed short* block;
+    signed short* target;
+    signed short* overflow_buffer;
+    const recorder_callbacks_t* callbacks = &dev->recorder->callbacks;
+    int mapped = callbacks->target != NULL;
+    char* qpc_slot = NULL;
+    HANDLE mmcss = setup_thread(dev, 1);
+
+    overflow_buffer = (signed short*)_aligned_malloc(sizeof(signed short) * dev->half_count,
+                                                     BLOCK_ALIGNMENT);
+    if (overflow_buffer == NULL) {
+        fprintf(stderr, "Failed to allocate the overflow buffer.\n");
+        InterlockedExchange(&dev->failed, 1);
+    }
+
+    QueryPerformanceCounter(&last_checked);
+    while (!dev->recorder->stop_requested && !dev->failed) {
+        /* Wait for the next half buffer. */
+        if (dev->waiting == WAIT_MODE_EVENT) {
+            WaitForSingleObject(dev->half_ready_event, EVENT_WAIT_TIMEOUT);
+        } else {
+            Sleep(POLL_INTERVAL);
+        }
+
+        /* Check Buffer Ready */
+        err = dev->daq->ai_half_ready(card, &HalfReady, &Stopped);
+        if (err < 0) {
+            fprintf(stderr, "AI_AsyncDblBufferHalfReady Error: %d\n", err);
+            InterlockedExchange(&dev->failed, 1);
+            break;
+        }
+        QueryPerformanceCounter(&checked);
+        if (HalfReady) {
+            /* The half became ready after the previous check said it was not,
+             * and no earlier than the callback for it if there was one.
+             */
+            instrument_stage(&dev->stats, STAGE_READY,
+                             dev->ready_qpc > last_checked.QuadPart ?
+                             dev->ready_qpc : last_checked.QuadPart,
+                             checked.QuadPart);
+        }
+        last_checked = checked;
+
+        /* Check whether the card has overwritten a half buffer. */
+        if (check_overrun) {
+            err = dev->daq->ai_overrun(card, 0 /* Check */, &Overrun);
+            if (err < 0) {
+                fprintf(stderr, "UD_AI_AsyncDblBufferOverrun Error: %d. Overruns will not be detected.\n", err);
+                check_overrun = 0;
+            } else if (Overrun) {
+                dev->daq->ai_overrun(card, 1 /* Clear */, &Overrun);
+                lost = estimate_lost_scans(dev, recorder_seconds() - last_transfer);
+                dev->overruns++;
+                dev->overrun_scans += lost;
+                pending_lost = add_lost_scans(pending_lost, lost);
+            }
+        }
+
+        if (HalfReady) {
+            /* If the program has fallen behind the half buffer still has to
+             * be collected to keep the card going, but it is thrown away.
+             * Memory of the program's own takes the samples directly; then
+             * the block is only needed to pass them on, and without one the
+             * half buffer is dropped all the same.
+             */
+            block = block_ring_acquire(&dev->ring);
+            info.lost_scans = pending_lost;
+            target = block;
+            if (mapped && block != NULL) {
+                target = callbacks->target(dev, pending_lost, dev->half_count, &qpc_slot);
+                if (target != NULL) {
+                    pending_lost = 0;
+                }
+            }
+            if (target == NULL) {
+                target = overflow_buffer;
+                dev->dropped_blocks++;
+                dev->dropped_scans += dev->half_count/dev->no_channels;
+                pending_lost = add_lost_scans(pending_lost, dev->half_count/dev->no_channels);
+            }
+            QueryPerformanceCounter(&transferring);
+            err = dev->daq->ai_transfer(card, (U16*)target);
+            if (err < 0) {
+                fprintf(stderr, "AI_AsyncDblBufferTransfer Error: %d\n", err);
+                InterlockedExchange(&dev->failed, 1);
+                break;
+            }
+            QueryPerformanceCounter(&transferred);
+            instrument_stage(&dev->stats, STAGE_TRANSFER,
+                             transferring.QuadPart, transferred.QuadPart);
+            last_transfer = (double)transferred.QuadPart /
+                            (double)dev->recorder->qpc_frequency.QuadPart;
+            dev->samples += dev->half_count;
+            if (target != overflow_buffer && mapped) {
+                memcpy(qpc_slot, &transferred.QuadPart, sizeof(__int64));
+            }
+            if (target != overflow_buffer && block != NULL) {
+                info.length = dev->half_count;
+                info.qpc = transferred.QuadPart;
+                info.mapped = mapped ? target : NULL;
+                pending_lost = 0;
+                block_ring_publish(&dev->ring, &info);
+            }
+        }
+    }
+
+    /* Clear AI Setting and Get Remaining data */
+    if (dev->waiting == WAIT_MODE_EVENT) {
+        dev->daq->ai_event_callback(card, 0 /* Remove */, NULL);
+    }
+    err = dev->daq->ai_clear(card, &AccessCnt);
+    if (err < 0) {
+        fprintf(stderr, "AI_AsyncClear Error: %d\n", err);
+        InterlockedExchange(&dev->failed, 1);
+    }
+    dev->t2 = recorder_seconds();
+    _aligned_free(overflow_buffer);
+
+    /* Read the last data. The card is stopped so waiting for room is fine. */
+    if (!dev->failed) {
+        while ((block = block_ring_acquire(&dev->ring)) == NULL) {
+            Sleep(1);
+        }
+        err = dev->daq->ai_transfer(card, (U16*)block);
+        if (err < 0) {
+            fprintf(stderr, "AI_AsyncDblBufferTransfer Error: %d\n", err);
+            InterlockedExchange(&dev->failed, 1);
+        } else {
+            QueryPerformanceCounter(&transferred);
+            /* Only whole scans are kept. */
+            AccessCnt -= AccessCnt % dev->no_channels;
+            dev->samples += AccessCnt;
+            dev->last_samples = AccessCnt;
+            info.length = AccessCnt;
+            info.lost_scans = pending_lost;
+            info.qpc = transferred.QuadPart;
+            info.mapped = NULL;
+            if (mapped) {
+                info.mapped = callbacks->target(dev, pending_lost, AccessCnt, &qpc_slot);
+                if (info.mapped != NULL) {
+                    memcpy(info.mapped, block, sizeof(signed short) * AccessCnt);
+                    memcpy(qpc_slot, &transferred.QuadPart, sizeof(__int64));
+                }
+            }
+            if (mapped && info.mapped == NULL) {
+                /* No room in the file; nothing follows to carry a gap. */
+                dev->dropped_blocks++;
+                dev->dropped_scans += AccessCnt/dev->no_channels;
+            } else {
+                block_ring_publish(&dev->ring, &info);
+            }
+        }
+    }
+
+    /* After an error what was published is still delivered. */
+    InterlockedExchange(&dev->acquisition_done, 1);
+    if (mmcss != NULL) {
+        AvRevertMmThreadCharacteristics(mmcss);
+    }
+    return dev->failed ? 1 : 0;
+}
+
+/* Drains one card's ring: hands each half buffer to the block callback. */
+static unsigned __stdcall delivery_thread(void* arg)
+{
+    recorder_card_t* dev = (recorder_card_t*)arg;
+    const recorder_callbacks_t* callbacks = &dev->recorder->callbacks;
+    const block_info_t* info;
+    signed short* block;
+    int delivering = 1;     /* Cleared when the callback fails. */
+
+    setup_thread(dev, 0);
+    for (;;) {
+        block = block_ring_peek(&dev->ring, &info);
+        if (block == NULL) {
+            if (!dev->acquisition_done) {
+                block_ring_wait(&dev->ring, DELIVERY_WAIT_TIMEOUT);
+                continue;
+            }
+            /* Everything was published before acquisition_done was set. */
+            block = block_ring_peek(&dev->ring, &info);
+            if (block == NULL) {
+                break;
+            }
+        }
+
+        if (info->mapped != NULL) {
+            block = info->mapped;
+        }
+        instrument_block(&dev->stats, block_ring_used(&dev->ring));
+        if (delivering && callbacks->block(dev, block, info) < 0) {
+            /* The rest is drained to let the acquisition stop. */
+            delivering = 0;
+            InterlockedExchange(&dev->failed, 1);
+        }
+        block_ring_release(&dev->ring);
+    }
+    if (callbacks->finish != NULL) {
+        callbacks->finish(dev);
+    }
+    return 0;
+}
+
+/* Apply the recorder's priority and the card's cores to the calling
+ * thread, an acquisition thread or a delivery thread. The delivery thread
+ * keeps the normal priority and, if it has no core of its own, keeps off
+ * the cores of the acquisition threads. Returns the MMCSS handle to revert
+ * when the thread ends, or NULL.
+ */
+static HANDLE setup_thread(recorder_card_t* dev, int acquisition)
+{
+    recorder_t* recorder = dev->recorder;
+    int priority = recorder->config.priority;
+    HANDLE mmcss = NULL;
+    DWORD task_index = 0;
+    DWORD_PTR process_mask;
+    DWORD_PTR system_mask;
+    DWORD_PTR mask = 0;
+    int d;
+
+    if (acquisition) {
+        if (priority == PRIORITY_MMCSS) {
+            mmcss = AvSetMmThreadCharacteristicsA(MMCSS_TASK, &task_index);
+            if (mmcss == NULL) {
+                fprintf(stderr, "AvSetMmThreadCharacteristics Error: %d. Using "
+                        "THREAD_PRIORITY_TIME_CRITICAL instead.\n", GetLastError());
+            } else if (!AvSetMmThreadPriority(mmcss, AVRT_PRIORITY_CRITICAL)) {
+                fprintf(stderr, "AvSetMmThreadPriority Error: %d.\n", GetLastError());
+            }
+        }
+        if ((priority == PRIORITY_REALTIME || (priority == PRIORITY_MMCSS && mmcss == NULL)) &&
+            !SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL)) {
+            fprintf(stderr, "SetThreadPriority Error: %d.\n", GetLastError());
+        }
+        if (dev->acquisition_core != NO_CORE) {
+            mask = (DWORD_PTR)1 << dev->acquisition_core;
+        }
+    } else if (dev->delivery_core != NO_CORE) {
+        mask = (DWORD_PTR)1 << dev->delivery_core;
+    } else if (GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask)) {
+        mask = process_mask;
+        for (d = 0; d < recorder->no_cards; d++) {
+            if (recorder->card[d].acquisition_core != NO_CORE) {
+                mask &= ~((DWORD_PTR)1 << recorder->card[d].acquisition_core);
+            }
+        }
+        if (mask == process_mask) {
+            mask = 0;
+        }
+    }
+    if (mask != 0 && SetThreadAffinityMask(GetCurrentThread(), mask) == 0) {
+        fprintf(stderr, "SetThreadAffinityMask Error: %d.\n", GetLastError());
+    }
+    return mmcss;
+}
+
+/* Estimate the scans lost in an overrun detected elapsed seconds after the
+ * last transfer. The card overwrites whole half buffers; all but the one
+ * about to be collected were lost, and at least one.
+ */
+static unsigned __int64 estimate_lost_scans(recorder_card_t* dev, double elapsed)
+{
+    U32 half_scans = dev->half_count/dev->no_channels;
+    double half_time = (double)half_scans * dev->scan_intrv / U1902_TIMEBASE;
+    double halves = floor(elapsed / half_time + 0.5) - 1.0;
+
+    if (halves < 1.0) {
+        halves = 1.0;
+    }
+    return (unsigned __int64)halves * half_scans;
+}
+
+/* The lost scans reported with the next block, which stop counting at the
+ * largest gap a block can describe.
+ */
+static U32 add_lost_scans(U32 pending, unsigned __int64 scans)
+{
+    return scans < 0xFFFFFFFF - pending ? pending + (U32)scans : 0xFFFFFFFF;
+}
+
@@ -0,0 +1,235 @@
+/*
+ * Windows command line utility to record analog input samples in differential
+ * mode from a USB-1901 DAQ in double buffered mode.
+ *
+ * Copyright (C) 2014, 2016  Anders Gidenstam, Chalmers University of Technology
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*----------------------------------------------------------------------------*/
+/* Recording from USB-1901 cards.                                             */
+/*                                                                            */
+/* The library finds, registers and configures the cards, and runs an         */
+/* acquisition thread and a delivery thread per card. The acquisition thread  */
+/* moves each half buffer from the driver into a ring of pooled blocks; the   */
+/* delivery thread hands each block, in order, to the block callback as a     */
+/* pointer into the ring. Nothing is copied or formatted on the way.          */
+/*                                                                            */
+/* Programs using it link usb-dask.lib, winmm.lib and avrt.lib as well.       */
+/*----------------------------------------------------------------------------*/
+
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <windows.h>
+#include "UsbDask.h"
+#include "daq.h"
+#include "block_ring.h"
+#include "instrument.h"
+
+/* USB-1901 related constants. */
+#define MAX_CHANNELS        8
+#define DEFAULT_AI_COUNT    20480       // Default buffer size.
+#define MAX_AI_COUNT        (1<<24)     // Largest buffer size accepted.
+#define MIN_HALF_COUNT      32          // Smallest automatic half buffer.
+#define DEFAULT_HALF_PERIOD 100         // ms per half buffer for 'auto'.
+#define U1902_TIMEBASE      80000000    // 80MHz clock.
+#define MIN_SAMP_INTRV      320         // Clock cycles per A/D conversion at 250 kS/s.
+#define DEFAULT_SAMP_INTRV  (128*320)   // Used with several channels if it fits.
+#define INVALID_CARD_ID     0xFFFF
+#define MAX_DEVICES         4           // Cards recorded at the same time.
+
+/* Ways to wait for a half buffer. */
+#define WAIT_MODE_POLL      0   /* Sleep and poll UD_AI_AsyncDblBufferHalfReady. */
+#define WAIT_MODE_EVENT     1   /* Wait for the driver's DBEvent callback. */
+#define POLL_INTERVAL       10  /* ms between polls in WAIT_MODE_POLL. */
+#define EVENT_WAIT_TIMEOUT  100 /* Max ms to block in WAIT_MODE_EVENT before
+                                   checking the exit condition. */
+
+/* Scheduling of the acquisition threads. */
+#define PRIORITY_NORMAL     0   /* Leave it to the system. */
+#define PRIORITY_REALTIME   1   /* THREAD_PRIORITY_TIME_CRITICAL. */
+#define PRIORITY_MMCSS      2   /* The MMCSS_TASK at critical priority. */
+#define MMCSS_TASK          "Pro Audio"
+#define TIMER_RESOLUTION    1   /* ms while recording with a raised priority. */
+#define NO_CORE             -1
+
+/* Acquisition to delivery thread hand-over. */
+#define DEFAULT_RING_DEPTH  16  /* Half buffers the ring can hold. */
+#define DELIVERY_WAIT_TIMEOUT 100 /* Max ms the delivery thread sleeps on an
+                                     empty ring. */
+
+/* Channels descriptor. */
+/* Note: Single-ended or differential mode applies to all channels.
+ *       Voltage range can be selected per channel.
+ */
+typedef struct {
+    U16 id;
+    U16 AdRange;
+} channel_t;
+
+typedef struct recorder_s recorder_t;
+typedef struct recorder_card_s recorder_card_t;
+
+/* How the cards of a recorder acquire. */
+typedef struct {
+    int sample_rate;
+    U32 samp_intrv;                     /* Clock cycles between conversions, 0 for
+                                           automatic. */
+    U16 input_config;
+    U16 trigger_mode;
+    U16 trigger_source;
+    U16 trigger_polarity;
+    double trigger_level;               /* V, for the analog trigger sources. */
+    U32 trigger_delay;                  /* DelayCount for P1902_AI_TRGMOD_DELAY. */
+    U32 ai_count;                       /* Requested samples in both halves. */
+    int half_period;                    /* If > 0 size the buffer for this many ms
+                                           per half buffer. */
+    int ring_depth;                     /* Half buffers in the ring; a power
+                                           of two. */
+    int priority;                       /* Of the acquisition threads. */
+} recorder_config_t;
+
+/* What the program does with the half buffers. Each is called with the card
+ * it concerns; card->user is the program's own. Only block is required.
+ */
+typedef struct {
+    /* Called by recorder_start() once the cards are running and before the
+     * first block of the card. Returns 0 on success and -1 to fail the start.
+     */
+    int (*start)(recorder_card_t* card);
+
+    /* Called by the card's delivery thread for each half buffer, in order.
+     * samples points to info->length samples of whole scans, in the ring or
+     * in the memory given by target; they may be modified and are valid
+     * until it returns. Returns 0 to go on and -1 to stop the card.
+     */
+    int (*block)(recorder_card_t* card, signed short* samples, const block_info_t* info);
+
+    /* Called by the card's delivery thread after its last block. */
+    void (*finish)(recorder_card_t* card);
+
+    /* Called by the card's acquisition thread for memory of its own to
+     * transfer the next length samples to, lost_scans after the previous
+     * ones. Returns it and sets *qpc to where the QueryPerformanceCounter()
+     * of the transfer is stored, or returns NULL if there is no room and
+     * the half buffer is dropped. If NULL the ring's blocks are used.
+     */
+    signed short* (*target)(recorder_card_t* card, U32 lost_scans, U32 length, char** qpc);
+} recorder_callbacks_t;
+
+/* One card. The fields before the derived layout are set up by the program
+ * before recorder_open(); the rest are the library's and may be read.
+ */
+struct recorder_card_s {
+    recorder_t* recorder;               /* The recorder the card belongs to. */
+    void* user;                         /* For the callbacks. */
+    U16 card_id;                        /* Requested card id, or INVALID_CARD_ID
+                                           for the first free USB-1901. Set to the
+                                           card found by recorder_open(). */
+    const daq_t* daq;                   /* The driver of the card. */
+    int no_channels;
+    channel_t channel[MAX_CHANNELS];
+    int wait_mode;
+    int acquisition_core;               /* Cores the threads are pinned to, */
+    int delivery_core;                  /* or NO_CORE. */
+
+    /* Derived layout, from recorder_open(). */
+    U32 ai_count;                       /* Samples in both halves of the buffer. */
+    U32 half_count;                     /* Samples per half buffer. */
+    U32 scan_intrv;
+    U32 samp_intrv;
+
+    I16 card;                           /* Registered card or INVALID_CARD_ID. */
+    HANDLE half_ready_event;
+    int callback_slot;                  /* Index in half_ready_card, or -1. */
+    __int64 ready_qpc;                  /* QPC of the last half ready callback.
+                                           Read after half_ready_event. */
+    block_ring_t ring;
+    LARGE_INTEGER start_qpc;            /* QueryPerformanceCounter() right after
+                                           the acquisition was started. */
+    HANDLE acquisition;
+    HANDLE delivery;
+
+    /* Acquisition thread state. */
+    int waiting;                        /* The wait_mode of this recording; polling
+                                           if the event could not be set up. */
+    volatile LONG acquisition_done;     /* Set when the last block is published. */
+    volatile LONG failed;               /* Set if the card stopped on an error. */
+    unsigned __int64 samples;           /* Samples acquired. */
+    U32 last_samples;                   /* Samples in the final partial buffer. */
+    U32 dropped_blocks;                 /* Half buffers lost to a full ring or file. */
+    unsigned __int64 dropped_scans;     /* Scans in them. */
+    U32 overruns;                       /* Half buffers overwritten by the card. */
+    unsigned __int64 overrun_scans;     /* Estimated scans lost to overruns. */
+    double t2;                          /* recorder_seconds() when stopped. */
+    instrument_t stats;                 /* Times of every half buffer. */
+};
+
+/* Cards recorded together. recorder_open() registers and configures them
+ * and they stay that way until recorder_close(), so that recorder_start()
+ * and recorder_stop() can record again and again without the seconds it
+ * takes to find and register them.
+ */
+struct recorder_s {
+    recorder_config_t config;
+    recorder_callbacks_t callbacks;
+    int no_cards;
+    recorder_card_t card[MAX_DEVICES];
+    LARGE_INTEGER qpc_frequency;        /* The common timebase of all cards. */
+    int open;                           /* Set from recorder_open() to recorder_close(). */
+    int running;                        /* Set from recorder_start() to recorder_stop(). */
+    volatile LONG stop_requested;       /* Set by recorder_stop() to end the
+                                           acquisition. */
+    double t1;                          /* recorder_seconds() at the start. */
+    FILETIME start_time;                /* The same as a FILETIME (UTC). */
+};
+
+/* Set up a recorder of one card with the default configuration and no
+ * channels.
+ */
+void recorder_init(recorder_t* recorder);
+
+/* Check the configuration of the recorder's cards, choose their intervals
+ * and buffers, and find, register and configure them. Returns 0 on success
+ * and -1 on failure, after printing the reason and releasing what was set up.
+ */
+int recorder_open(recorder_t* recorder);
+
+/* Start all cards of the open recorder as close together as possible and
+ * deliver their half buffers to the callbacks until recorder_stop().
+ * Returns 0 on success and -1 on failure, after printing the reason.
+ */
+int recorder_start(recorder_t* recorder);
+
+/* Stop the cards and wait until everything they acquired is delivered. The
+ * cards stay registered. Returns 0 on success and -1 if a card stopped on
+ * an error.
+ */
+int recorder_stop(recorder_t* recorder);
+
+/* Stop any recording and release the cards and buffers of the recorder. */
+void recorder_close(recorder_t* recorder);
+
+/* Non-zero if a card of the running recorder stopped on an error. */
+int recorder_failed(const recorder_t* recorder);
+
+/* Seconds since some fixed point in time, the timebase of t1 and t2. */
+double recorder_seconds(void);
+
+/* Full scale of an AD range in volts. */
+double ad_range_to_volt(U16 range);
+
+#endif
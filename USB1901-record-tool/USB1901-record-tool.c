@@ -31,142 +31,873 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <limits.h>
+#include <math.h>
+#include <errno.h>
 #include <time.h>
+#include <process.h>
+#include <avrt.h>
 
-#include "UsbDask.h"
+#include "recorder.h"
+#include "raw_format.h"
+#include "csv_format.h"
+#include "sample_lut.h"
+#include "sample_kernel.h"
+#include "out_file.h"
+#include "compressor.h"
+#include "aggregate.h"
+#include "power.h"
+#include "telemetry.h"
+#include "pretrigger.h"
+#include "raw_index.h"
+#include "convert_pool.h"
+#include "stream_stats.h"
+#include "marker.h"
+#include "service.h"
 
-/* Channels descriptor. */
-/* Note: Single-ended or differential mode applies to all channels.
- *       Voltage range can be selected per channel.
+#define EXIT_CHECK_INTERVAL 10  /* ms between exit checks in main(). */
+
+/* '-bench'. */
+#define BENCH_FILE_NAME     "bench.tmp" /* Written and removed by each measurement. */
+#define BENCH_TIME          1.0 /* Seconds per output format. */
+#define BENCH_SAMPLES       (4*1024*1024) /* Distinct synthetic samples, more than
+                                           the compressors' windows. */
+#define BENCH_DURATION      5   /* Default seconds of recording for the latency. */
+#define CONSOLE_INTERVAL    1.0 /* Min seconds between status prints per card. */
+
+/* Largest '-x' history in samples. The history's offsets are unsigned int. */
+#ifdef _WIN64
+#define MAX_PRETRIGGER_SAMPLES  2147483647.0        /* 4 GB. */
+#else
+#define MAX_PRETRIGGER_SAMPLES  (MAX_AI_COUNT * 16.0) /* 512 MB of the 2 GB. */
+#endif
+
+/* Output formats. */
+#define FORMAT_CSV          0   /* One line of comma separated volts per scan. */
+#define FORMAT_RAW          1   /* raw_header_t followed by the ADC codes. */
+
+typedef struct session_s session_t;
+
+/* Output of one card. The recorder runs an acquisition thread and a
+ * delivery thread per card; the delivery thread converts and writes out
+ * the half buffers through write_block().
  */
 typedef struct {
-    U16 id;
-    U16 AdRange;
-} channel_t;
+    session_t* session;                 /* The session the card belongs to. */
+    recorder_card_t* card;              /* The card in the session's recorder. */
+
+    /* The layout of the samples, from the card or from a raw file. */
+    U16 card_id;
+    int no_channels;
+    channel_t channel[MAX_CHANNELS];
+    U32 half_count;                     /* Samples per half buffer. */
+    U32 scan_intrv;
+    LARGE_INTEGER start_qpc;            /* QueryPerformanceCounter() right after
+                                           the acquisition was started. */
+
+    const sample_lut_t* channel_lut[MAX_CHANNELS];
+    int no_pairs;
+    power_pair_t pair[POWER_MAX_PAIRS]; /* Power computed from the channels. */
+    char* file_name;
+    out_file_t file;
+    compressor_t compressor;            /* Used if compress_codec is set. */
+    aggregate_t aggregate;              /* Used if aggregate_period is set. */
+    out_file_t aggregate_file;          /* Used if aggregate_file_name is set. */
+    char* csv_buffer;                   /* Text of one half buffer. */
+    char* base_name;                    /* '-R': file_name without the chunk. */
+    U32 chunk;                          /* '-R': number of the current file, */
+    unsigned __int64 chunk_first_scan;  /* scans_written at its start */
+    out_file_t next_file;               /* and the next one, opened ahead. */
+    char* next_name;
+    int next_open;                      /* Set if next_file is open. */
+
+    /* Shared with the delivery thread. */
+    marker_queue_t markers;             /* '-service': markers to place. */
 
-/* USB-1901 related constants. */
-#define MAX_CHANNELS        8
-#define AI_COUNT            20480       // Buffer size.
-#define U1902_TIMEBASE      80000000    // 80MHz clock.
-#define INVALID_CARD_ID     0xFFFF
+    /* Acquisition thread state. */
+    U32 mapped_blocks;                  /* Blocks and scans stored by map_block(). */
+    unsigned __int64 mapped_scans;
+
+    /* Delivery thread state. */
+    unsigned __int64 scans_written;     /* Scans stored in the file, including
+                                           those lost in gaps. */
+    U32 gaps_written;                   /* Gap markers stored in the file. */
+    U32 markers_written;                /* '-service' markers stored in the file. */
+    double last_status;                 /* recorder_seconds() of the last status
+                                           print. */
+    float* latency;                     /* '-bench': ms from half ready to written. */
+    U32 no_latencies;
+    U32 latency_capacity;
+    U32 blocks_written;                 /* Blocks in the current file. */
+    int raw_open;                       /* Set while a raw file needs its index. */
+    raw_index_t index;                  /* Its blocks so far; kept by map_block()
+                                           or the compressor thread instead if
+                                           they write the blocks. */
+    pretrigger_t pretrigger;            /* Used if pretrigger_seconds is set. */
+    __int64 history_qpc;                /* QPC of the newest half buffer kept
+                                           in the history. */
+    unsigned __int64 skipped_scans;     /* Scans not kept before the trigger. */
+    __int64 write_qpc;                  /* QPC when process_samples() started
+                                           writing. */
+    stream_stats_t totals;              /* Of every sample written. */
+    double last_quantiles;              /* recorder_seconds() when the quantiles
+                                           were last published. */
+} device_t;
+
+/* The cards of the command line and their output. session_open() opens the
+ * recorder, so that session_start() and session_stop() can record again and
+ * again without the seconds it takes to find and register the cards. The
+ * output options are those of the command line.
+ */
+struct session_s {
+    recorder_t recorder;
+    device_t device[MAX_DEVICES];       /* The output of recorder.card[d]. */
+    int running;                        /* Set from session_start() to session_stop(). */
+};
+
+/* One thread of the parallel '-convert' and '-stats'. */
+typedef struct {
+    device_t dev;                       /* Copy of the card with its own scan
+                                           count, gaps and energy. */
+    char* text;                         /* csv text of the current piece. */
+    size_t text_size;
+    signed short* unpacked;             /* Samples of a compressed record. */
+    U32 unpacked_size;
+    stream_stats_t totals;              /* '-stats': of all its pieces. */
+    marker_t* marker;                   /* '-stats': markers of its pieces. */
+    U32 no_markers;
+    U32 marker_capacity;
+} convert_worker_t;
 
 /* Internal functions. */
 static void print_usage(int argc, char** argv);
 static void process_arguments(int argc, char** argv);
-static int process_samples(signed short* buffer, int length, int offset);
-static double ad_range_to_volt(U16 range);
-static I16 open_USB1901();
-static void clean_exit(U16 card, int code);
+static void session_init(session_t* session);
+static int session_open(session_t* session);
+static int session_start(session_t* session, const char* file_name);
+static int session_stop(session_t* session);
+static void session_close(session_t* session);
+static int setup_devices(session_t* session);
+static void reset_device(device_t* dev);
+static int run_service(session_t* session);
+static int end_recording(session_t* session);
+static void print_recording(session_t* session);
+static void process_samples(device_t* dev, signed short* buffer, int length);
+static void process_gap(device_t* dev, U32 lost_scans);
+static void process_block(device_t* dev, __int64 qpc);
+static void place_markers(device_t* dev, U32 lost_scans, const block_info_t* info);
+static void process_marker(device_t* dev, const marker_t* marker);
+static int format_marker(const marker_t* marker, char* text);
+static int read_marker(const char* data, U32 count, marker_t* marker);
+static char* format_scans(device_t* dev, const signed short* buffer, int length, char* text);
+static void process_skip(device_t* dev, unsigned __int64 scans);
+static void report_block(device_t* dev, const signed short* buffer, const block_info_t* info,
+                         const double* energy_before);
+static void write_time_header(device_t* dev);
+static int format_time_header(device_t* dev, char* text);
+static void output_write(device_t* dev, const void* data, size_t length);
+static void output_record(device_t* dev, U16 type, U32 count);
+static size_t csv_buffer_size(device_t* dev, size_t samples);
+static int start_compressor(device_t* dev, size_t chunk_size);
+static int start_aggregate(device_t* dev);
+static void write_window(void* arg, const aggregate_t* aggregate);
+static char* card_file_name(const char* name, U16 card_id);
+static char* chunk_file_name(const char* name, U32 chunk);
+static char* name_with_part(const char* name, const char* part);
+static int build_luts(device_t* dev);
+static int setup_power(device_t* dev);
+static void print_energy(device_t* dev);
+static int setup_pretrigger(device_t* dev);
+static int pretrigger_block(device_t* dev, const signed short* buffer, const block_info_t* info);
+static void process_history(device_t* dev, const signed short* first, unsigned int first_scans,
+                            const signed short* second, unsigned int second_scans);
+static int open_output(device_t* dev);
+static int write_file_header(device_t* dev);
+static void open_next_chunk(device_t* dev);
+static int rotation_due(device_t* dev);
+static int rotate_output(device_t* dev);
+static void discard_next_chunk(device_t* dev);
+static void index_output(device_t* dev);
+static unsigned __int64 expected_file_size(device_t* dev);
+static int card_started(recorder_card_t* card);
+static int write_block(recorder_card_t* card, signed short* block, const block_info_t* info);
+static void card_finished(recorder_card_t* card);
+static signed short* map_block(recorder_card_t* card, U32 lost_scans, U32 length, char** qpc);
+static int write_raw_header(device_t* dev, DWORD start_time_low, DWORD start_time_high);
+static void convert_raw_file(char* raw_name);
+static void convert_samples(device_t* dev, signed short* buffer, int length);
+static int range_clip(device_t* dev, int* length);
+static FILE* open_raw_file(char* raw_name, raw_header_t* header);
+static int load_index(FILE* raw, char* raw_name, const raw_header_t* header, raw_index_t* index);
+static void process_raw_parallel(FILE* raw, char* raw_name, const raw_header_t* header);
+static int convert_piece(void* arg, int number, const convert_piece_t* piece,
+                         const char* data, size_t size, const char** text, size_t* length);
+static int convert_piece_samples(convert_worker_t* worker, const signed short* buffer,
+                                 int length, size_t* used);
+static int reserve_text(convert_worker_t* worker, size_t size);
+static int keep_marker(convert_worker_t* worker, const marker_t* marker);
+static void summarize_raw_file(char* raw_name);
+static void print_summary(char* raw_name, const raw_header_t* header,
+                          const marker_t* marker, U32 no_markers);
+static void print_totals(device_t* dev);
+static void recover_raw_file(char* raw_name);
+static void run_kernel_benchmark(void);
+static void run_benchmark(device_t* dev);
+static void record_latency(device_t* dev);
+static void print_latency(device_t* dev);
+static int compare_floats(const void* a, const void* b);
+static void write_stats(void);
+static void clean_exit(int code);
 
 /* Global state. Use with care. */
 char default_file_name[] = "data.csv";
-char* file_name = default_file_name;
-FILE* file = NULL;
-I16 card = INVALID_CARD_ID;
-int sample_rate = 200;
+char default_raw_file_name[] = "data.bin";
+char default_lz4_file_name[] = "data.csv.lz4";
+char default_zstd_file_name[] = "data.csv.zst";
+char* file_name = NULL;
+char* convert_file_name = NULL;
+char* recover_file_name = NULL;
+char* summary_file_name = NULL;     /* '-stats'. */
+int no_workers = 0;                 /* Threads of '-convert' and '-stats', 0
+                                       for one per processor. */
+double range_start = -1.0;          /* '-range': seconds into the recording */
+double range_length;                /* and seconds to convert. */
+unsigned __int64 range_first = 0;   /* The same as scans. */
+unsigned __int64 range_end = (unsigned __int64)-1;
+int kernel_benchmark = 0;
+int benchmark = 0;                  /* '-bench'. */
+int simulate = 0;                   /* If set use simulated cards. */
+char* service_name = NULL;          /* '-service': pipe to take commands from. */
+int output_format = FORMAT_CSV;
+int precision = CSV_DEFAULT_PRECISION;
+int print_averages = 1;
+int quiet = 0;                      /* If set print nothing while recording. */
+char* telemetry_name = NULL;        /* Shared memory for live telemetry, if any. */
+char* stats_file_name = NULL;       /* Where to dump the instrumentation, if
+                                       anywhere. */
+telemetry_t telemetry;
+int timestamps = 0;                 /* If set csv lines start with the time. */
+int file_backend = OUT_FILE_STDIO;
+unsigned __int64 rotate_bytes = 0;  /* If > 0 start a new file after this many */
+U32 rotate_seconds = 0;             /* bytes or seconds of scans. */
+int compress_codec = COMPRESS_NONE;
+int compress_level;
+int aggregate_period = 0;           /* If > 0 write aggregates over windows of
+                                       this many ms. */
+char* aggregate_file_name = NULL;   /* Where to write them; NULL for instead of
+                                       the samples. */
+double pretrigger_seconds = 0.0;    /* If > 0 keep this much history in memory
+                                       and record from the software trigger. */
+int pretrigger_channel;             /* Channel id, level and direction of */
+double pretrigger_level;            /* the software trigger. */
+int pretrigger_falling;
 int duration = -1;
-int no_channels = 0;
-channel_t channel[MAX_CHANNELS];
+int wait_mode = WAIT_MODE_EVENT;
+session_t session;                  /* The cards of the command line. */
+LARGE_INTEGER qpc_frequency;        /* The common timebase of all cards. */
 
 int main(int argc, char **argv)
 {
-    I16 err;
-    BOOLEAN Stopped;
-    BOOLEAN HalfReady;
-    U32 AccessCnt = 0;
-    int offset = 0;
-    int samples = 0;
-    signed short buffer[AI_COUNT];
-    DWORD t1, t2; /* milliseconds */
+    int key;
+    int err;
     /*--------------------------------*/
 
+    session_init(&session);
     process_arguments(argc, argv);
-    card = open_USB1901();
 
-    t1 = GetTickCount();
+    if (convert_file_name != NULL) {
+        convert_raw_file(convert_file_name);
+        exit(0);
+    }
+    if (summary_file_name != NULL) {
+        summarize_raw_file(summary_file_name);
+        exit(0);
+    }
+    if (recover_file_name != NULL) {
+        recover_raw_file(recover_file_name);
+        exit(0);
+    }
+    if (kernel_benchmark) {
+        run_kernel_benchmark();
+        exit(0);
+    }
+
+    if (session_open(&session) < 0) {
+        clean_exit(1);
+    }
+    if (benchmark) {
+        run_benchmark(&session.device[0]);
+    }
+    if (telemetry_name != NULL &&
+        telemetry_open(&telemetry, telemetry_name, session.recorder.no_cards) < 0) {
+        clean_exit(1);
+    }
+    if (service_name != NULL) {
+        clean_exit(run_service(&session) < 0 ? 1 : 0);
+    }
+    if (session_start(&session, file_name) < 0) {
+        clean_exit(1);
+    }
 
-    /* Open the data file */
-    file = fopen(file_name, "w");
-    if (file == NULL) {
-        perror("fopen error: ");
+    if (pretrigger_seconds > 0.0) {
+        printf("Recording from when channel %d %s through %g V, with %g s before.\n",
+               pretrigger_channel, pretrigger_falling ? "falls" : "rises",
+               pretrigger_level, pretrigger_seconds);
     }
-    
-    /* Acquire and store the samples. */
     if (duration < 1) {
         printf("                            Press any key to stop...\n");
     }
-    for (;;) {
-        /* Wait some milliseconds. */
-        Sleep(10);
-
-        /* Check Buffer Ready */
-        err = UD_AI_AsyncDblBufferHalfReady(card, &HalfReady, &Stopped);
-        if (err < 0) {
-            fprintf(stderr, "AI_AsyncDblBufferHalfReady Error: %d\n", err);
-            UD_AI_AsyncClear(card, &AccessCnt);
-            clean_exit(card, 1);
-        }
-        
-        if(HalfReady) {
-            printf("\nBuffer Half Ready...\n");
-            printf("Writing %d samples to the file '%s'...\n", AI_COUNT/2, file_name);
-            if (duration < 1) {
-                printf("                            Press any key to stop...\n");
-            }
-            err = UD_AI_AsyncDblBufferTransfer(card, (U16*)buffer);
-            if (err < 0) {
-                fprintf(stderr, "AI_AsyncDblBufferTransfer Error: %d\n", err);
-                UD_AI_AsyncClear(card, &AccessCnt);
-                clean_exit(card, 1);
-            }
-            samples += AI_COUNT/2;
-            offset = process_samples(buffer, AI_COUNT/2, offset);
-        }
+    if (stats_file_name != NULL) {
+        printf("                            Press 's' to write the statistics...\n");
+    }
+    while (!recorder_failed(&session.recorder)) {
+        Sleep(EXIT_CHECK_INTERVAL);
 
         /* Exit check. */
-        if (duration < 1) {
+        if (duration < 1 || stats_file_name != NULL) {
             if (kbhit()) {
-                getch();
-                break;
+                key = getch();
+                if (stats_file_name != NULL && (key == 's' || key == 'S')) {
+                    write_stats();
+                } else if (duration < 1) {
+                    break;
+                }
             }
+        }
+        if (duration >= 1 && recorder_seconds() - session.recorder.t1 > duration) {
+            break;
+        }
+    }
+    err = end_recording(&session);
+
+    if (duration < 1 && err == 0) {
+        printf("                            Press any key to exit...\n");
+        getch();
+    }
+
+    clean_exit(err < 0 ? 1 : 0);
+    return 0;
+}
+
+/* Store the markers given before the block info was transferred, that is
+ * while lost_scans and then the block's scans were acquired. Only then is
+ * it known which scan each came with. Without a block all markers waiting
+ * are stored at the end of the recording.
+ */
+static void place_markers(device_t* dev, U32 lost_scans, const block_info_t* info)
+{
+    double scans_per_tick = (double)U1902_TIMEBASE / dev->scan_intrv /
+                            (double)qpc_frequency.QuadPart;
+    marker_t* marker;
+
+    while ((marker = marker_peek(&dev->markers)) != NULL &&
+           (info == NULL || marker->qpc <= info->qpc)) {
+        marker->scan = dev->scans_written;
+        if (info != NULL) {
+            marker->scan = marker_place(marker->qpc, dev->scans_written,
+                                        lost_scans + info->length / dev->no_channels,
+                                        info->qpc, scans_per_tick);
+        }
+        process_marker(dev, marker);
+        marker_pop(&dev->markers);
+    }
+}
+
+/* Store a marker of a raw file, or the '-service' one, in the output. */
+static void process_marker(device_t* dev, const marker_t* marker)
+{
+    raw_mark_t mark;
+    char text[MARKER_MAX_LABEL + 64];
+    U32 length = (U32)strlen(marker->label);
+
+    if (output_format == FORMAT_RAW) {
+        mark.scan = marker->scan;
+        mark.qpc = marker->qpc;
+        output_record(dev, RAW_RECORD_MARK, sizeof(mark) + length);
+        output_write(dev, &mark, sizeof(mark));
+        output_write(dev, marker->label, length);
+    } else {
+        output_write(dev, text, format_marker(marker, text));
+    }
+    if (aggregate_period > 0 && aggregate_file_name != NULL) {
+        out_file_write(&dev->aggregate_file, text, format_marker(marker, text));
+    }
+    dev->markers_written++;
+}
+
+/* The csv comment line of a marker. text needs MARKER_MAX_LABEL + 64 bytes.
+ * Returns its length.
+ */
+static int format_marker(const marker_t* marker, char* text)
+{
+    return sprintf(text, "# mark: scan %.0f %s\n", (double)marker->scan, marker->label);
+}
+
+/* Decode the count bytes at data of a RAW_RECORD_MARK. Returns 0 on
+ * success and -1 if the record is too short.
+ */
+static int read_marker(const char* data, U32 count, marker_t* marker)
+{
+    raw_mark_t mark;
+    U32 length;
+
+    if (count < sizeof(mark)) {
+        return -1;
+    }
+    memcpy(&mark, data, sizeof(mark));
+    length = count - sizeof(mark);
+    if (length > MARKER_MAX_LABEL - 1) {
+        length = MARKER_MAX_LABEL - 1;
+    }
+    marker->scan = mark.scan;
+    marker->qpc = (__int64)mark.qpc;
+    memcpy(marker->label, data + sizeof(mark), length);
+    marker->label[length] = '\0';
+    return 0;
+}
+
+/* Start a session of one card with the default configuration. */
+static void session_init(session_t* session)
+{
+    device_t* dev;
+    int d;
+
+    memset(session, 0, sizeof(session_t));
+    recorder_init(&session->recorder);
+    session->recorder.callbacks.start = card_started;
+    session->recorder.callbacks.block = write_block;
+    session->recorder.callbacks.finish = card_finished;
+    for (d = 0; d < MAX_DEVICES; d++) {
+        dev = &session->device[d];
+        dev->session = session;
+        dev->card = &session->recorder.card[d];
+        dev->card->user = dev;
+    }
+}
+
+/* Check the configuration of the session's cards, find, register and
+ * configure them, and allocate the buffers of their output. Returns 0 on
+ * success and -1 on failure, after printing the reason and releasing what
+ * was set up.
+ */
+static int session_open(session_t* session)
+{
+    recorder_t* recorder = &session->recorder;
+    int d;
+
+    if (recorder->open) {
+        return 0;
+    }
+    for (d = 0; d < recorder->no_cards; d++) {
+        if (recorder->card[d].no_channels < 1) {
+            fprintf(stderr, "No channels selected. Use '-c' to add channels.\n");
+            return -1;
+        }
+    }
+    /* A mapped file takes the samples straight from the card. */
+    recorder->callbacks.target = file_backend == OUT_FILE_MAPPED ? map_block : NULL;
+    if (recorder_open(recorder) < 0) {
+        return -1;
+    }
+    qpc_frequency = recorder->qpc_frequency;
+    if (setup_devices(session) < 0) {
+        session_close(session);
+        return -1;
+    }
+    return 0;
+}
+
+/* The layout, buffers and conversion tables of each card of the session. */
+static int setup_devices(session_t* session)
+{
+    device_t* dev;
+    recorder_card_t* card;
+    int d;
+
+    for (d = 0; d < session->recorder.no_cards; d++) {
+        dev = &session->device[d];
+        card = dev->card;
+        dev->card_id = card->card_id;
+        dev->no_channels = card->no_channels;
+        memcpy(dev->channel, card->channel, sizeof(dev->channel));
+        dev->half_count = card->half_count;
+        dev->scan_intrv = card->scan_intrv;
+        dev->csv_buffer = (char*)malloc(csv_buffer_size(dev, dev->half_count));
+        if (dev->csv_buffer == NULL) {
+            fprintf(stderr, "Failed to allocate the csv buffer.\n");
+            return -1;
+        }
+        if (build_luts(dev) < 0 || setup_power(dev) < 0 || setup_pretrigger(dev) < 0 ||
+            stream_stats_init(&dev->totals, dev->no_channels) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Record from all cards of the open session to file_name, or to a file per
+ * card named after it. The cards are started as close together as possible.
+ * Returns 0 on success and -1 on failure, after printing the reason.
+ */
+static int session_start(session_t* session, const char* file_name)
+{
+    recorder_t* recorder = &session->recorder;
+    device_t* dev;
+    int d;
+
+    if (!recorder->open || session->running) {
+        fprintf(stderr, "session_start: The session is %s.\n",
+                recorder->open ? "already recording" : "not open");
+        return -1;
+    }
+    for (d = 0; d < recorder->no_cards; d++) {
+        dev = &session->device[d];
+        reset_device(dev);
+
+        /* With several cards each gets its own file, or connection. */
+        if (recorder->no_cards > 1 && file_backend != OUT_FILE_NET) {
+            dev->file_name = card_file_name(file_name, dev->card_id);
         } else {
-            t2 = GetTickCount();
-            if ((t2 - t1) > 1000*duration) {
+            dev->file_name = name_with_part(file_name, "");
+        }
+        if (dev->file_name == NULL || open_output(dev) < 0 ||
+            start_compressor(dev, output_format == FORMAT_CSV ?
+                                  csv_buffer_size(dev, dev->half_count) :
+                                  sizeof(signed short) * dev->half_count) < 0) {
+            break;
+        }
+    }
+    session->running = 1;
+    if (d < recorder->no_cards || recorder_start(recorder) < 0) {
+        session_stop(session);
+        return -1;
+    }
+    return 0;
+}
+
+/* End the recording: stop the cards, write out what they acquired and
+ * close the files. The cards stay registered. Returns 0 on success and -1
+ * if a card stopped on an error.
+ */
+static int session_stop(session_t* session)
+{
+    device_t* dev;
+    int result;
+    int d;
+
+    if (!session->running) {
+        return 0;
+    }
+    result = recorder_stop(&session->recorder);
+    for (d = 0; d < session->recorder.no_cards; d++) {
+        dev = &session->device[d];
+        if (compress_codec != COMPRESS_NONE) {
+            compressor_finish(&dev->compressor);
+        }
+        discard_next_chunk(dev);
+        index_output(dev);
+        out_file_close(&dev->file);
+        out_file_close(&dev->aggregate_file);
+    }
+    session->running = 0;
+    return result;
+}
+
+/* Stop any recording and release the cards and buffers of the session. */
+static void session_close(session_t* session)
+{
+    device_t* dev;
+    int d;
+
+    session_stop(session);
+    recorder_close(&session->recorder);
+    for (d = 0; d < session->recorder.no_cards; d++) {
+        dev = &session->device[d];
+        free(dev->csv_buffer);
+        dev->csv_buffer = NULL;
+        pretrigger_free(&dev->pretrigger);
+        stream_stats_free(&dev->totals);
+        raw_index_free(&dev->index);
+        free(dev->file_name);
+        free(dev->base_name);
+        dev->file_name = NULL;
+        dev->base_name = NULL;
+    }
+}
+
+/* Clear what the card's last recording left behind. */
+static void reset_device(device_t* dev)
+{
+    int p;
+
+    dev->mapped_blocks = 0;
+    dev->mapped_scans = 0;
+    dev->scans_written = 0;
+    dev->gaps_written = 0;
+    dev->markers_written = 0;
+    marker_queue_reset(&dev->markers);
+    dev->last_status = 0.0;
+    dev->last_quantiles = 0.0;
+    dev->no_latencies = 0;
+    dev->blocks_written = 0;
+    dev->skipped_scans = 0;
+    dev->chunk = 0;
+    dev->chunk_first_scan = 0;
+    free(dev->file_name);
+    free(dev->base_name);
+    dev->file_name = NULL;
+    dev->base_name = NULL;
+    for (p = 0; p < dev->no_pairs; p++) {
+        dev->pair[p].energy = 0.0;
+    }
+    /* Wait for the trigger again; the history is kept until session_close(). */
+    pretrigger_reset(&dev->pretrigger);
+    dev->pretrigger.fired = 0;
+    stream_stats_reset(&dev->totals);
+}
+
+/* '-service': keep the cards open and record whenever the client of the
+ * pipe says so, until it says 'quit' or a key is pressed. The commands:
+ *   start <file name>  Record to the file, named like '-o'.
+ *   mark <label>       Place a marker at the scan being acquired.
+ *   stop               End the recording.
+ *   quit               End the recording, if any, and exit.
+ * Each is answered with 'ok', or 'error' and the reason. Returns 0 on
+ * success and -1 if the pipe failed.
+ */
+static int run_service(session_t* session)
+{
+    service_t service;
+    char* command;
+    char* argument;
+    int failed = 0;                 /* Set if the last recording failed. */
+    int result = 0;
+    int key;
+    int err;
+    int d;
+
+    if (service_open(&service, service_name) < 0) {
+        return -1;
+    }
+    printf("Taking commands on '%s%s'.\n", SERVICE_PIPE_PREFIX, service_name);
+    printf("                            Press any key to exit...\n");
+    for (;;) {
+        if (kbhit()) {
+            key = getch();
+            if (stats_file_name == NULL || (key != 's' && key != 'S')) {
                 break;
             }
+            write_stats();
         }
+        if (session->running && recorder_failed(&session->recorder)) {
+            /* Stop now; the client hears of it at its next command. */
+            end_recording(session);
+            failed = 1;
+        }
+        err = service_next(&service, EXIT_CHECK_INTERVAL, &command);
+        if (err < 0) {
+            result = -1;
+            break;
+        }
+        if (err == 0) {
+            continue;
+        }
+        argument = strchr(command, ' ');
+        if (argument != NULL) {
+            *argument++ = '\0';
+        }
+        if (strcmp(command, "start") == 0) {
+            if (argument == NULL || *argument == '\0') {
+                service_reply(&service, "error No file name given to 'start'.");
+            } else if (session->running) {
+                service_reply(&service, "error Already recording.");
+            } else if (session_start(session, argument) < 0) {
+                service_reply(&service, "error The recording could not be started.");
+            } else {
+                printf("Recording to '%s'.\n", argument);
+                failed = 0;
+                service_reply(&service, "ok");
+            }
+        } else if (strcmp(command, "mark") == 0) {
+            /* Every card's file gets the marker, or none does. */
+            for (d = 0; session->running && d < session->recorder.no_cards; d++) {
+                if (!marker_room(&session->device[d].markers)) {
+                    break;
+                }
+            }
+            if (!session->running) {
+                service_reply(&service, "error Not recording.");
+            } else if (d < session->recorder.no_cards) {
+                service_reply(&service, "error Too many markers waiting for their scan.");
+            } else {
+                /* Only this thread adds markers, so the room is still there. */
+                for (d = 0; d < session->recorder.no_cards; d++) {
+                    marker_push(&session->device[d].markers, service.qpc,
+                                argument != NULL ? argument : "");
+                }
+                service_reply(&service, "ok");
+            }
+        } else if (strcmp(command, "stop") == 0) {
+            if (!session->running) {
+                service_reply(&service, failed ? "error The recording failed." :
+                                                 "error Not recording.");
+            } else if (end_recording(session) < 0) {
+                service_reply(&service, "error The recording failed.");
+            } else {
+                service_reply(&service, "ok");
+            }
+            failed = 0;
+        } else if (strcmp(command, "quit") == 0) {
+            service_reply(&service, "ok");
+            break;
+        } else {
+            service_reply(&service, "error Unknown command '%s'.", command);
+        }
+    }
+    if (session->running) {
+        end_recording(session);
     }
+    service_close(&service);
+    return result;
+}
 
-    /* Clear AI Setting and Get Remaining data */
-    err = UD_AI_AsyncClear(card, &AccessCnt);
-    if (err < 0) {
-        fprintf(stderr, "AI_AsyncClear Error: %d\n", err);
-        clean_exit(card, 1);
+/* Stop the recording and report on it. Returns the result of
+ * session_stop().
+ */
+static int end_recording(session_t* session)
+{
+    int err = session_stop(session);
+
+    print_recording(session);
+    if (stats_file_name != NULL) {
+        write_stats();
     }
-    t2 = GetTickCount();
+    return err;
+}
 
-    /* Read the last data. */
-    err = UD_AI_AsyncDblBufferTransfer(card, (U16*)buffer);
-    if (err < 0) {
-        fprintf(stderr, "AI_AsyncDblBufferTransfer Error: %d\n", err);
-        clean_exit(card, 1);
+/* Print what each card of the session recorded. */
+static void print_recording(session_t* session)
+{
+    device_t* dev;
+    recorder_card_t* card;
+    int d;
+
+    for (d = 0; d < session->recorder.no_cards; d++) {
+        dev = &session->device[d];
+        card = dev->card;
+        printf("\nCard %d: Wrote the last %d samples out of %.0f to '%s'. Total duration %f sec.\n",
+               dev->card_id,
+               card->last_samples,
+               (double)card->samples,
+               dev->file_name,
+               card->t2 - session->recorder.t1);
+        if (dev->chunk > 0) {
+            printf("The recording is split into %d files from '%s'.\n",
+                   dev->chunk + 1, dev->base_name);
+        }
+        printf("Ring buffer high-water mark: %d of %d half buffers.\n",
+               (int)card->ring.high_water, session->recorder.config.ring_depth);
+        if (card->overruns > 0) {
+            printf("WARNING: The card overran %u times; about %.0f scans were lost.\n",
+                   card->overruns, (double)card->overrun_scans);
+        }
+        if (card->dropped_blocks > 0) {
+            printf("WARNING: %u half buffers (%.0f scans) were dropped because the ring or the file was full.\n",
+                   card->dropped_blocks, (double)card->dropped_scans);
+        }
+        if (dev->gaps_written > 0) {
+            printf("The file contains %u gap markers.\n", dev->gaps_written);
+        }
+        if (dev->markers_written > 0) {
+            printf("The file contains %u markers.\n", dev->markers_written);
+        }
+        if (compress_codec != COMPRESS_NONE && dev->compressor.bytes_out > 0) {
+            printf("Compressed %.1f MB to %.1f MB with %s (ratio %.2f).\n",
+                   dev->compressor.bytes_in / 1048576.0,
+                   dev->compressor.bytes_out / 1048576.0,
+                   compressor_name(compress_codec),
+                   (double)dev->compressor.bytes_in / (double)dev->compressor.bytes_out);
+        }
+        if (dev->file.backend == OUT_FILE_NET) {
+            printf("Sent %.1f MB to '%s'", dev->file.net_bytes_sent / 1048576.0,
+                   dev->file_name);
+            if (dev->file.net_dropped > 0) {
+                printf("; WARNING: %u packets were dropped", dev->file.net_dropped);
+            }
+            printf(".\n");
+        }
+        print_totals(dev);
+        print_energy(dev);
+        if (benchmark) {
+            print_latency(dev);
+        }
     }
+}
+
+/* The start callback: begins the card's file once the card is running. */
+static int card_started(recorder_card_t* card)
+{
+    device_t* dev = (device_t*)card->user;
 
-    printf("\nWriting the last %d samples out of %d to '%s'. Total duration %f sec.\n",
-           AccessCnt,
-           samples + AccessCnt,
-           file_name,
-           (double)(t2 - t1) / 1000.0);
-    offset = process_samples(buffer, AccessCnt, offset);
+    dev->start_qpc = card->start_qpc;
+    if (write_file_header(dev) < 0 || start_aggregate(dev) < 0) {
+        return -1;
+    }
+    return 0;
+}
 
-    UD_Release_Card(card);
+/* The block callback: converts and writes out a half buffer of the card. */
+static int write_block(recorder_card_t* card, signed short* block, const block_info_t* info)
+{
+    device_t* dev = (device_t*)card->user;
+    double energy[POWER_MAX_PAIRS];
+    LARGE_INTEGER converting;
+    LARGE_INTEGER done;
+    U32 lost_scans = info->lost_scans;
+    int p;
 
-    if (duration < 1) {
-        printf("                            Press any key to exit...\n");
-        getch();
+    if (pretrigger_seconds > 0.0 && !dev->pretrigger.fired) {
+        if (!pretrigger_block(dev, block, info)) {
+            return 0;
+        }
+        /* The history was written; any scans lost were skipped with it. */
+        lost_scans = 0;
     }
+    if (rotation_due(dev) && rotate_output(dev) < 0) {
+        return -1;
+    }
+    place_markers(dev, lost_scans, info);
+    if (lost_scans > 0) {
+        process_gap(dev, lost_scans);
+    }
+    process_block(dev, info->qpc);
+    for (p = 0; p < dev->no_pairs; p++) {
+        energy[p] = dev->pair[p].energy;
+    }
+    QueryPerformanceCounter(&converting);
+    process_samples(dev, block, info->length);
+    QueryPerformanceCounter(&done);
+    instrument_stage(&card->stats, STAGE_CONVERT, converting.QuadPart, dev->write_qpc);
+    instrument_stage(&card->stats, STAGE_WRITE, dev->write_qpc, done.QuadPart);
+    if (benchmark) {
+        record_latency(dev);
+    }
+    report_block(dev, block, info, energy);
+    return 0;
+}
+
+/* The finish callback: writes out the markers given after the last scan
+ * and the last aggregates of the card.
+ */
+static void card_finished(recorder_card_t* card)
+{
+    device_t* dev = (device_t*)card->user;
 
-    clean_exit(card, 0);
+    place_markers(dev, 0, NULL);
+    if (aggregate_period > 0) {
+        aggregate_flush(&dev->aggregate, write_window, dev);
+    }
 }
 
 static void print_usage(int argc, char** argv)
@@ -174,19 +905,172 @@ static void print_usage(int argc, char** argv)
     printf("Usage: %s [OPTIONS]\n\n", argv[0]);
     printf("  -h                       Print this message and exit.\n");
     printf("  -o <file name>           Save the result in the named file.\n");
-    printf("                           The default is 'data.csv'.\n");
+    printf("                           The default is 'data.csv' or 'data.bin'.\n");
+    printf("                           With several cards '.card<id>' is inserted\n");
+    printf("                           before the extension.\n");
+    printf("  -f <format>              Output format; 'csv' writes one line of volts per\n");
+    printf("                           scan, 'raw' writes a header followed by a block of\n");
+    printf("                           binary 16-bit ADC codes per half buffer and an\n");
+    printf("                           index of the blocks. The default is 'csv'.\n");
+    printf("  -p <digits>              Digits after the decimal point in csv values.\n");
+    printf("                           The default is %d.\n", CSV_DEFAULT_PRECISION);
+    printf("  -t                       Start each csv line with the time of the scan in\n");
+    printf("                           seconds since the start of the recording. The\n");
+    printf("                           start is given as a QueryPerformanceCounter()\n");
+    printf("                           value on the first line.\n");
+    printf("  -convert <raw file>      Convert a file recorded with '-f raw' to csv and\n");
+    printf("                           exit. The csv is written to the '-o' file. The\n");
+    printf("                           blocks are converted by several threads unless\n");
+    printf("                           '-z' or '-a' is given.\n");
+    printf("  -stats <raw file>        Print the mean, standard deviation, min, max and\n");
+    printf("                           quantiles of each channel of a file recorded with\n");
+    printf("                           '-f raw', and the energy of the '-P' pairs, and\n");
+    printf("                           exit. Uses several threads.\n");
+    printf("  -j <threads>             Threads of '-convert' and '-stats', at most %d.\n",
+           CONVERT_MAX_WORKERS);
+    printf("                           The default is one per processor.\n");
+    printf("  -range <s>:<seconds>     With '-convert' or '-stats', only <seconds> from\n");
+    printf("                           <s> seconds into the recording. The block index\n");
+    printf("                           at the end of the file is used to go straight\n");
+    printf("                           there.\n");
+    printf("  -recover <raw file>      Rebuild the block index of a raw file whose\n");
+    printf("                           recording ended without writing it and exit.\n");
+    printf("  -u                       Write the output with unbuffered overlapped I/O\n");
+    printf("                           through %d MB buffers. Avoids stalls when the\n", OUT_FILE_BUFFER_SIZE >> 20);
+    printf("                           system file cache is flushed. csv lines end in\n");
+    printf("                           LF only.\n");
+    printf("  -m                       Map the output file into memory and transfer the\n");
+    printf("                           samples straight into it. Requires '-f raw' and\n");
+    printf("                           '-d'; the file is sized from the duration.\n");
+    printf("  -R <n>KB|MB|GB|s|m|h     Start a new file whenever the current one reaches\n");
+    printf("                           <n> KB, MB or GB, or holds <n> seconds, minutes\n");
+    printf("                           or hours of scans, at the end of a half buffer.\n");
+    printf("                           The files are numbered before the extension,\n");
+    printf("                           e.g. 'data.000123.bin'. Each starts with the\n");
+    printf("                           header, or time line, and the index of its\n");
+    printf("                           first scan.\n");
+    printf("  -n tcp|udp:<host>:<port> Send the output to a collector instead of a file.\n");
+    printf("                           Requires '-f raw'. The stream is sent in packets\n");
+    printf("                           of up to %d KB (TCP) or %d bytes (UDP), each\n",
+           NET_TCP_PACKET_SIZE >> 10, NET_UDP_PACKET_SIZE);
+    printf("                           with a sequence number and stream offset; see\n");
+    printf("                           net_sink.h. Each card gets its own connection.\n");
+    printf("  -z lz4|zstd[:<level>]    Compress the output in a separate thread. csv\n");
+    printf("                           output becomes a standard .lz4 or .zst file, raw\n");
+    printf("                           output stores delta encoded, compressed half\n");
+    printf("                           buffers that '-convert' reads. The default levels\n");
+    printf("                           are %d for lz4 and %d for zstd.\n",
+           COMPRESS_DEFAULT_LZ4_LEVEL, COMPRESS_DEFAULT_ZSTD_LEVEL);
+    printf("  -a <ms>                  Write the mean, min, max and rms of each channel\n");
+    printf("                           over windows of <ms> milliseconds as csv instead\n");
+    printf("                           of the samples.\n");
+    printf("  -A <file name>           With '-a', write the aggregates to this file and\n");
+    printf("                           the samples to the output as usual.\n");
+    printf("  -P <v id>:<i id>:<ohms>  Compute the power of the voltage on channel <v id>\n");
+    printf("                           and the current through a shunt of <ohms> whose\n");
+    printf("                           voltage is on channel <i id>. Each pair adds a\n");
+    printf("                           column in W to the csv, or to the aggregates, and\n");
+    printf("                           the energy is printed at exit. Repeat for up to\n");
+    printf("                           %d pairs per card; applies to the card like '-c'.\n",
+           POWER_MAX_PAIRS);
+    printf("  -q                       Print nothing while recording. Otherwise the\n");
+    printf("                           status of each card is printed once a second.\n");
+    printf("  -L <name>                Publish the latest averages, power and samples\n");
+    printf("                           of each card and the statistics of the whole\n");
+    printf("                           recording in the shared memory <name>, e.g.\n");
+    printf("                           'Local\\usb1901', after every half buffer. See\n");
+    printf("                           telemetry.h for the layout.\n");
+    printf("  -I <file name>           Write the instrumentation of each card as JSON to\n");
+    printf("                           the named file at exit and whenever 's' is\n");
+    printf("                           pressed: histograms of the time from half buffer\n");
+    printf("                           ready to seen, of its transfer, conversion and\n");
+    printf("                           write, the ring occupancy and the bytes written.\n");
+    printf("  -sim                     Record from simulated cards that produce synthetic\n");
+    printf("                           samples at the selected scan rate.\n");
+    printf("  -bench                   Measure the samples/s each output format can be\n");
+    printf("                           written at, then record from simulated cards for\n");
+    printf("                           '-d' seconds, %d if omitted, with the given options\n",
+           BENCH_DURATION);
+    printf("                           and print the latency from half buffer ready to\n");
+    printf("                           written.\n");
+    printf("  -service <pipe name>     Keep the cards configured and record on commands\n");
+    printf("                           read from the named pipe '%s<pipe name>',\n",
+           SERVICE_PIPE_PREFIX);
+    printf("                           one per line: 'start <file name>' records to the\n");
+    printf("                           file, named like '-o'; 'mark <label>' stores a\n");
+    printf("                           marker at the scan being acquired; 'stop' ends\n");
+    printf("                           the recording and 'quit' exits. Each command is\n");
+    printf("                           answered with 'ok' or 'error <reason>'.\n");
+    printf("  -kbench                  Measure the speed of the sample kernels and exit.\n");
     printf("  -s <sample rate in Hz>   Set the sample rate in Hz. The default is 200 Hz.\n");
+    printf("  -S <clock cycles>        Interval between the A/D conversions of a scan in\n");
+    printf("                           cycles of the %d MHz clock, at least %d. The\n",
+           U1902_TIMEBASE / 1000000, MIN_SAMP_INTRV);
+    printf("                           default is %d, or less if the scan rate needs it.\n",
+           DEFAULT_SAMP_INTRV);
+    printf("  -i diff|se|nrse          Differential, referenced single-ended or\n");
+    printf("                           non-referenced single-ended inputs for all\n");
+    printf("                           channels. The default is 'diff', which allows\n");
+    printf("                           channel ids 0 to 7.\n");
+    printf("  -D <card id>             Record from the USB-1901 with <card id>. Repeat to\n");
+    printf("                           record from up to %d cards at once. The following\n", MAX_DEVICES);
+    printf("                           '-c' options apply to that card. The default is\n");
+    printf("                           the first USB-1901 found.\n");
     printf("  -c <channel id>:<range>  Add <channel id> to the set of sampled channels with\n");
     printf("                           the selected range. Ranges: 0 - +/-200mV;\n");
     printf("                           1 - +/-1.00V; 2 - +/-2.00V; 3 - +/-10.0V.\n");
+    printf("  -g <source>              Start the acquisition on a hardware trigger:\n");
+    printf("                           'soft' starts at once, the default; 'ext[:neg]'\n");
+    printf("                           on the external digital trigger; 'ai0:<V>[:neg]'\n");
+    printf("                           or 'ai1:<V>[:neg]' when that analog input crosses\n");
+    printf("                           <V>, given to the driver as an ADC code of the\n");
+    printf("                           channel's range. ':neg' triggers on the falling\n");
+    printf("                           edge. Applies to all cards. '-d' counts from the\n");
+    printf("                           start, not from the trigger.\n");
+    printf("  -G post|gated|delay:<n>  The trigger mode; 'delay' waits <n> counts of the\n");
+    printf("                           driver's DelayCount after the trigger. The\n");
+    printf("                           default is 'post'.\n");
+    printf("  -x <s>:<id>:<V>[:fall]   Keep the last <s> seconds in memory and store\n");
+    printf("                           nothing until channel <id> rises, or falls,\n");
+    printf("                           through <V>. Then the history and everything\n");
+    printf("                           after it is recorded; the scans before are\n");
+    printf("                           marked as skipped. Each card triggers itself.\n");
     printf("  -d <duration>            Sample for <duration> seconds.\n");
     printf("                           The default is until a key is pressed. \n");
+    printf("  -w <wait mode>           How to wait for a half buffer; 'event' waits for\n");
+    printf("                           the driver's buffer ready event, 'poll' polls\n");
+    printf("                           every %d ms. The default is 'event', which falls\n", POLL_INTERVAL);
+    printf("                           back to 'poll' if the driver lacks the event.\n");
+    printf("  -b <samples>|auto[:<ms>] Size of the card's double buffer in samples, both\n");
+    printf("                           halves. 'auto' sizes it from the scan rate so that\n");
+    printf("                           each half fills in <ms> milliseconds, %d ms if\n", DEFAULT_HALF_PERIOD);
+    printf("                           omitted. Rounded up to whole scans per half.\n");
+    printf("                           The default is %d samples.\n", DEFAULT_AI_COUNT);
+    printf("  -r <half buffers>        Size of the ring between the acquisition and the\n");
+    printf("                           writer thread, rounded up to a power of two.\n");
+    printf("                           The default is %d.\n", DEFAULT_RING_DEPTH);
+    printf("  -rt                      Run the acquisition threads at time critical\n");
+    printf("                           priority and the system timer at %d ms while\n",
+           TIMER_RESOLUTION);
+    printf("                           recording. The writers keep the normal priority.\n");
+    printf("  -mmcss                   Like '-rt', but register the acquisition threads\n");
+    printf("                           with the multimedia class scheduler as '%s'.\n",
+           MMCSS_TASK);
+    printf("  -C <core>[:<core>]       Pin the card's acquisition thread to the first\n");
+    printf("                           core and its writer thread to the second. Without\n");
+    printf("                           a second core the writers avoid the cores of all\n");
+    printf("                           acquisition threads. Applies to the card like '-c'.\n");
 }
 
 static void process_arguments(int argc, char** argv)
 {
+    recorder_config_t* config = &session.recorder.config;
+    recorder_card_t* card = session.recorder.card;
+    device_t* dev = &session.device[0];
+    DWORD_PTR process_mask;
+    DWORD_PTR system_mask;
     int i = 1;
-    no_channels = 0;
+    int d;
 
     while (i < argc) {
         if (strcmp(argv[i], "-h") == 0) {
@@ -199,6 +1083,132 @@ static void process_arguments(int argc, char** argv)
                 exit(-1);
             }
             file_name = argv[i];
+        } else if (strcmp(argv[i], "-f") == 0) {
+            i++;
+            if (i < argc && strcmp(argv[i], "csv") == 0) {
+                output_format = FORMAT_CSV;
+            } else if (i < argc &&
+                       (strcmp(argv[i], "raw") == 0 || strcmp(argv[i], "bin") == 0)) {
+                output_format = FORMAT_RAW;
+            } else {
+                fprintf(stderr, "%s: Bad format given to '-f'.\n", argv[0]);
+                exit(-1);
+            }
+        } else if (strcmp(argv[i], "-p") == 0) {
+            int p;
+            i++;
+            if (i >= argc || 1 != sscanf(argv[i], "%d", &p) ||
+                p < 0 || p > CSV_MAX_PRECISION) {
+                fprintf(stderr, "%s: Bad precision given to '-p'.\n", argv[0]);
+                exit(-1);
+            }
+            precision = p;
+        } else if (strcmp(argv[i], "-t") == 0) {
+            timestamps = 1;
+        } else if (strcmp(argv[i], "-convert") == 0) {
+            i++;
+            if (i >= argc) {
+                fprintf(stderr, "%s: No file name given to '-convert'.\n", argv[0]);
+                exit(-1);
+            }
+            convert_file_name = argv[i];
+        } else if (strcmp(argv[i], "-range") == 0) {
+            i++;
+            if (i >= argc || 2 != sscanf(argv[i], "%lf:%lf", &range_start, &range_length) ||
+                range_start < 0.0 || range_length <= 0.0) {
+                fprintf(stderr, "%s: Bad range given to '-range'.\n", argv[0]);
+                exit(-1);
+            }
+        } else if (strcmp(argv[i], "-recover") == 0) {
+            i++;
+            if (i >= argc) {
+                fprintf(stderr, "%s: No file name given to '-recover'.\n", argv[0]);
+                exit(-1);
+            }
+            recover_file_name = argv[i];
+        } else if (strcmp(argv[i], "-stats") == 0) {
+            i++;
+            if (i >= argc) {
+                fprintf(stderr, "%s: No file name given to '-stats'.\n", argv[0]);
+                exit(-1);
+            }
+            summary_file_name = argv[i];
+        } else if (strcmp(argv[i], "-j") == 0) {
+            i++;
+            if (i >= argc || 1 != sscanf(argv[i], "%d", &no_workers) ||
+                no_workers < 1 || no_workers > CONVERT_MAX_WORKERS) {
+                fprintf(stderr, "%s: Bad number of threads given to '-j'.\n", argv[0]);
+                exit(-1);
+            }
+        } else if (strcmp(argv[i], "-u") == 0) {
+            file_backend = OUT_FILE_DIRECT;
+        } else if (strcmp(argv[i], "-m") == 0) {
+            file_backend = OUT_FILE_MAPPED;
+        } else if (strcmp(argv[i], "-n") == 0) {
+            i++;
+            if (i >= argc || !net_sink_address(argv[i])) {
+                fprintf(stderr, "%s: Bad address given to '-n'.\n", argv[0]);
+                exit(-1);
+            }
+            file_backend = OUT_FILE_NET;
+            file_name = argv[i];
+        } else if (strcmp(argv[i], "-z") == 0) {
+            int level;
+            i++;
+            if (i < argc && strncmp(argv[i], "lz4", 3) == 0) {
+                compress_codec = COMPRESS_LZ4;
+                compress_level = COMPRESS_DEFAULT_LZ4_LEVEL;
+            } else if (i < argc && strncmp(argv[i], "zstd", 4) == 0) {
+                compress_codec = COMPRESS_ZSTD;
+                compress_level = COMPRESS_DEFAULT_ZSTD_LEVEL;
+            } else {
+                fprintf(stderr, "%s: Bad codec given to '-z'.\n", argv[0]);
+                exit(-1);
+            }
+            if (strchr(argv[i], ':') != NULL) {
+                if (1 != sscanf(strchr(argv[i], ':') + 1, "%d", &level) || level < 1) {
+                    fprintf(stderr, "%s: Bad level given to '-z'.\n", argv[0]);
+                    exit(-1);
+                }
+                compress_level = level;
+            } else if (argv[i][compress_codec == COMPRESS_LZ4 ? 3 : 4] != '\0') {
+                fprintf(stderr, "%s: Bad codec given to '-z'.\n", argv[0]);
+                exit(-1);
+            }
+            if (compressor_name(compress_codec) == NULL) {
+                fprintf(stderr, "%s: This build has no %s support.\n", argv[0],
+                        compress_codec == COMPRESS_LZ4 ? "lz4" : "zstd");
+                exit(-1);
+            }
+        } else if (strcmp(argv[i], "-a") == 0) {
+            int a;
+            i++;
+            if (i >= argc || 1 != sscanf(argv[i], "%d", &a) || a < 1) {
+                fprintf(stderr, "%s: Bad window given to '-a'.\n", argv[0]);
+                exit(-1);
+            }
+            aggregate_period = a;
+        } else if (strcmp(argv[i], "-A") == 0) {
+            i++;
+            if (i >= argc) {
+                fprintf(stderr, "%s: No file name given to '-A'.\n", argv[0]);
+                exit(-1);
+            }
+            aggregate_file_name = argv[i];
+        } else if (strcmp(argv[i], "-kbench") == 0) {
+            kernel_benchmark = 1;
+        } else if (strcmp(argv[i], "-sim") == 0) {
+            simulate = 1;
+        } else if (strcmp(argv[i], "-bench") == 0) {
+            benchmark = 1;
+            simulate = 1;
+        } else if (strcmp(argv[i], "-service") == 0) {
+            i++;
+            if (i >= argc) {
+                fprintf(stderr, "%s: No pipe name given to '-service'.\n", argv[0]);
+                exit(-1);
+            }
+            service_name = argv[i];
         } else if (strcmp(argv[i], "-s") == 0) {
             int s;
             i++;
@@ -206,9 +1216,54 @@ static void process_arguments(int argc, char** argv)
                 fprintf(stderr, "%s: Bad sample frequency given to '-s'.\n", argv[0]);
                 exit(-1);
             }
-            sample_rate = s;
+            config->sample_rate = s;
+        } else if (strcmp(argv[i], "-S") == 0) {
+            int s;
+            i++;
+            if (i >= argc || 1 != sscanf(argv[i], "%d", &s) || s < MIN_SAMP_INTRV) {
+                fprintf(stderr, "%s: Bad sample interval given to '-S'; the minimum is %d.\n",
+                        argv[0], MIN_SAMP_INTRV);
+                exit(-1);
+            }
+            config->samp_intrv = s;
+        } else if (strcmp(argv[i], "-i") == 0) {
+            i++;
+            if (i < argc && strcmp(argv[i], "diff") == 0) {
+                config->input_config = P1902_AI_Differential;
+            } else if (i < argc && strcmp(argv[i], "se") == 0) {
+                config->input_config = P1902_AI_SingEnded;
+            } else if (i < argc && strcmp(argv[i], "nrse") == 0) {
+                config->input_config = P1902_AI_NonRef_SingEnded;
+            } else {
+                fprintf(stderr, "%s: Bad input configuration given to '-i'.\n", argv[0]);
+                exit(-1);
+            }
+        } else if (strcmp(argv[i], "-D") == 0) {
+            int id;
+            i++;
+            if (i >= argc || 1 != sscanf(argv[i], "%d", &id) ||
+                id < 0 || id >= INVALID_CARD_ID) {
+                fprintf(stderr, "%s: Bad card id given to '-D'.\n", argv[0]);
+                exit(-1);
+            }
+            for (d = 0; d < session.recorder.no_cards; d++) {
+                if (card[d].card_id == id) {
+                    fprintf(stderr, "%s: Card %d given twice.\n", argv[0], id);
+                    exit(-1);
+                }
+            }
+            /* The first '-D' names the card any earlier '-c' applied to. */
+            if (card[0].card_id != INVALID_CARD_ID) {
+                if (session.recorder.no_cards == MAX_DEVICES) {
+                    fprintf(stderr, "%s: Too many cards.\n", argv[0]);
+                    exit(-1);
+                }
+                session.recorder.no_cards++;
+            }
+            dev = &session.device[session.recorder.no_cards - 1];
+            dev->card->card_id = id;
         } else if (strcmp(argv[i], "-c") == 0) {
-            if (no_channels < MAX_CHANNELS) {
+            if (dev->card->no_channels < MAX_CHANNELS) {
                 int id, range;
                 i++;
                 if (i >= argc || 2 != sscanf(argv[i], "%d:%d", &id, &range) ||
@@ -216,202 +1271,2178 @@ static void process_arguments(int argc, char** argv)
                     fprintf(stderr, "%s: Bad parameter '%s' given to '-c'.\n", argv[0], argv[i]);
                     exit(-1);
                 }
-                channel[no_channels].id = id;
+                dev->card->channel[dev->card->no_channels].id = id;
                 switch (range) {
                 case 0:
-                    channel[no_channels].AdRange = AD_B_0_2_V;
+                    dev->card->channel[dev->card->no_channels].AdRange = AD_B_0_2_V;
                     break;
                 case 1:
-                    channel[no_channels].AdRange = AD_B_1_V;
+                    dev->card->channel[dev->card->no_channels].AdRange = AD_B_1_V;
                     break;
                 case 2:
-                    channel[no_channels].AdRange = AD_B_2_V;
+                    dev->card->channel[dev->card->no_channels].AdRange = AD_B_2_V;
                     break;
                 case 3:
-                    channel[no_channels].AdRange = AD_B_10_V;
+                    dev->card->channel[dev->card->no_channels].AdRange = AD_B_10_V;
                     break;
                 }
-                no_channels++;
+                dev->card->no_channels++;
             } else {
                 fprintf(stderr, "%s: Too many channels.\n", argv[0]);
                 exit(-1);
             }
-        } else if (strcmp(argv[i], "-d") == 0) {
-            int d;
+        } else if (strcmp(argv[i], "-q") == 0) {
+            quiet = 1;
+        } else if (strcmp(argv[i], "-L") == 0) {
             i++;
-            if (i >= argc || 1 != sscanf(argv[i], "%d", &d) || d < 1) {
-                fprintf(stderr, "%s: Bad duration given to '-d'.\n", argv[0]);
+            if (i >= argc) {
+                fprintf(stderr, "%s: No name given to '-L'.\n", argv[0]);
+                exit(-1);
+            }
+            telemetry_name = argv[i];
+        } else if (strcmp(argv[i], "-I") == 0) {
+            i++;
+            if (i >= argc) {
+                fprintf(stderr, "%s: No file name given to '-I'.\n", argv[0]);
+                exit(-1);
+            }
+            stats_file_name = argv[i];
+        } else if (strcmp(argv[i], "-P") == 0) {
+            int v, c;
+            double ohms;
+            i++;
+            if (i >= argc || 3 != sscanf(argv[i], "%d:%d:%lf", &v, &c, &ohms) ||
+                v < 0 || v > 15 || c < 0 || c > 15 || !(ohms > 0.0)) {
+                fprintf(stderr, "%s: Bad parameter '%s' given to '-P'.\n", argv[0], argv[i]);
+                exit(-1);
+            }
+            if (dev->no_pairs == POWER_MAX_PAIRS) {
+                fprintf(stderr, "%s: Too many power pairs.\n", argv[0]);
+                exit(-1);
+            }
+            dev->pair[dev->no_pairs].v_channel = v;
+            dev->pair[dev->no_pairs].i_channel = c;
+            dev->pair[dev->no_pairs].shunt = ohms;
+            dev->no_pairs++;
+        } else if (strcmp(argv[i], "-g") == 0) {
+            char polarity[8] = "";
+            int n = 0;
+            i++;
+            if (i < argc && strcmp(argv[i], "soft") == 0) {
+                config->trigger_source = P1902_AI_TRGSRC_SOFT;
+                config->trigger_polarity = P1902_AI_TrgPositive;
+            } else if (i < argc && strncmp(argv[i], "ext", 3) == 0 &&
+                       (argv[i][3] == 0 || strcmp(argv[i] + 3, ":neg") == 0)) {
+                config->trigger_source = P1902_AI_TRGSRC_DTRIG;
+                config->trigger_polarity = argv[i][3] ? P1902_AI_TrgNegative : P1902_AI_TrgPositive;
+            } else if (i < argc && (strncmp(argv[i], "ai0:", 4) == 0 ||
+                                    strncmp(argv[i], "ai1:", 4) == 0) &&
+                       1 <= (n = sscanf(argv[i] + 4, "%lf:%7s", &config->trigger_level, polarity)) &&
+                       (n == 1 || strcmp(polarity, "neg") == 0)) {
+                config->trigger_source = argv[i][2] == '0' ? P1902_AI_TRGSRC_AI0 : P1902_AI_TRGSRC_AI1;
+                config->trigger_polarity = n == 2 ? P1902_AI_TrgNegative : P1902_AI_TrgPositive;
+            } else {
+                fprintf(stderr, "%s: Bad trigger source given to '-g'.\n", argv[0]);
+                exit(-1);
+            }
+        } else if (strcmp(argv[i], "-G") == 0) {
+            int delay;
+            i++;
+            if (i < argc && strcmp(argv[i], "post") == 0) {
+                config->trigger_mode = P1902_AI_TRGMOD_POST;
+            } else if (i < argc && strcmp(argv[i], "gated") == 0) {
+                config->trigger_mode = P1902_AI_TRGMOD_GATED;
+            } else if (i < argc && strncmp(argv[i], "delay:", 6) == 0 &&
+                       1 == sscanf(argv[i] + 6, "%d", &delay) && delay > 0) {
+                config->trigger_mode = P1902_AI_TRGMOD_DELAY;
+                config->trigger_delay = delay;
+            } else {
+                fprintf(stderr, "%s: Bad trigger mode given to '-G'.\n", argv[0]);
+                exit(-1);
+            }
+        } else if (strcmp(argv[i], "-x") == 0) {
+            char direction[8] = "";
+            int n = 0;
+            i++;
+            if (i >= argc ||
+                (n = sscanf(argv[i], "%lf:%d:%lf:%7s", &pretrigger_seconds, &pretrigger_channel,
+                            &pretrigger_level, direction)) < 3 ||
+                (n == 4 && strcmp(direction, "rise") != 0 && strcmp(direction, "fall") != 0) ||
+                !(pretrigger_seconds > 0.0) || pretrigger_channel < 0 || pretrigger_channel > 15) {
+                fprintf(stderr, "%s: Bad parameter given to '-x'.\n", argv[0]);
+                exit(-1);
+            }
+            pretrigger_falling = n == 4 && strcmp(direction, "fall") == 0;
+        } else if (strcmp(argv[i], "-d") == 0) {
+            int d;
+            i++;
+            if (i >= argc || 1 != sscanf(argv[i], "%d", &d) || d < 1) {
+                fprintf(stderr, "%s: Bad duration given to '-d'.\n", argv[0]);
                 exit(-1);
             }
             duration = d;
+        } else if (strcmp(argv[i], "-w") == 0) {
+            i++;
+            if (i < argc && strcmp(argv[i], "event") == 0) {
+                wait_mode = WAIT_MODE_EVENT;
+            } else if (i < argc && strcmp(argv[i], "poll") == 0) {
+                wait_mode = WAIT_MODE_POLL;
+            } else {
+                fprintf(stderr, "%s: Bad wait mode given to '-w'.\n", argv[0]);
+                exit(-1);
+            }
+        } else if (strcmp(argv[i], "-R") == 0) {
+            double v;
+            char unit[4] = "";
+            i++;
+            if (i >= argc || sscanf(argv[i], "%lf%3s", &v, unit) != 2 || v <= 0.0) {
+                unit[0] = 0;
+            }
+            rotate_bytes = 0;
+            rotate_seconds = 0;
+            if (strcmp(unit, "KB") == 0) {
+                rotate_bytes = (unsigned __int64)(v * 1024.0);
+            } else if (strcmp(unit, "MB") == 0) {
+                rotate_bytes = (unsigned __int64)(v * 1024.0 * 1024.0);
+            } else if (strcmp(unit, "GB") == 0) {
+                rotate_bytes = (unsigned __int64)(v * 1024.0 * 1024.0 * 1024.0);
+            } else if (strcmp(unit, "s") == 0) {
+                rotate_seconds = (U32)v;
+            } else if (strcmp(unit, "m") == 0) {
+                rotate_seconds = (U32)(v * 60.0);
+            } else if (strcmp(unit, "h") == 0) {
+                rotate_seconds = (U32)(v * 3600.0);
+            }
+            if (rotate_bytes == 0 && rotate_seconds == 0) {
+                fprintf(stderr, "%s: Bad size or time given to '-R'.\n", argv[0]);
+                exit(-1);
+            }
+        } else if (strcmp(argv[i], "-rt") == 0) {
+            config->priority = PRIORITY_REALTIME;
+        } else if (strcmp(argv[i], "-mmcss") == 0) {
+            config->priority = PRIORITY_MMCSS;
+        } else if (strcmp(argv[i], "-C") == 0) {
+            int a, w;
+            int n;
+            i++;
+            n = i < argc ? sscanf(argv[i], "%d:%d", &a, &w) : 0;
+            if (n < 1 || a < 0 || a >= (int)(8 * sizeof(DWORD_PTR)) ||
+                (n == 2 && (w < 0 || w >= (int)(8 * sizeof(DWORD_PTR))))) {
+                fprintf(stderr, "%s: Bad cores given to '-C'.\n", argv[0]);
+                exit(-1);
+            }
+            dev->card->acquisition_core = a;
+            dev->card->delivery_core = n == 2 ? w : NO_CORE;
+        } else if (strcmp(argv[i], "-b") == 0) {
+            int b;
+            i++;
+            if (i < argc && strcmp(argv[i], "auto") == 0) {
+                config->half_period = DEFAULT_HALF_PERIOD;
+            } else if (i < argc && strncmp(argv[i], "auto:", 5) == 0 &&
+                       1 == sscanf(argv[i] + 5, "%d", &b) && b > 0) {
+                config->half_period = b;
+            } else if (i < argc && 1 == sscanf(argv[i], "%d", &b) &&
+                       b > 1 && b <= MAX_AI_COUNT) {
+                config->half_period = 0;
+                config->ai_count = b;
+            } else {
+                fprintf(stderr, "%s: Bad buffer size given to '-b'.\n", argv[0]);
+                exit(-1);
+            }
+        } else if (strcmp(argv[i], "-r") == 0) {
+            int r;
+            i++;
+            if (i >= argc || 1 != sscanf(argv[i], "%d", &r) || r < 2 || r > (1 << 20)) {
+                fprintf(stderr, "%s: Bad ring depth given to '-r'.\n", argv[0]);
+                exit(-1);
+            }
+            /* The ring indexes its slots with a mask. */
+            config->ring_depth = 2;
+            while (config->ring_depth < r) {
+                config->ring_depth *= 2;
+            }
+            if (config->ring_depth != r) {
+                printf("Rounded the ring depth up to %d half buffers.\n", config->ring_depth);
+            }
         } else {
             fprintf(stderr, "%s: Unknown commandline argument '%s'.\n", argv[0], argv[i]);
             exit(-1);
         }
         i++;
     }
+    if (file_backend == OUT_FILE_MAPPED && convert_file_name == NULL &&
+        (output_format != FORMAT_RAW || duration < 1)) {
+        fprintf(stderr, "%s: '-m' requires '-f raw' and '-d'.\n", argv[0]);
+        exit(-1);
+    }
+    if (file_backend == OUT_FILE_NET && !net_sink_address(file_name)) {
+        fprintf(stderr, "%s: '-n' and '-o' cannot be combined.\n", argv[0]);
+        exit(-1);
+    }
+    if (file_backend == OUT_FILE_NET &&
+        (output_format != FORMAT_RAW || convert_file_name != NULL)) {
+        fprintf(stderr, "%s: '-n' requires '-f raw' and cannot be used with '-convert'.\n",
+                argv[0]);
+        exit(-1);
+    }
+    if (pretrigger_seconds > 0.0 && (file_backend == OUT_FILE_MAPPED || convert_file_name != NULL)) {
+        fprintf(stderr, "%s: '-x' cannot be used with '-m' or '-convert'.\n", argv[0]);
+        exit(-1);
+    }
+    if (range_start >= 0.0 && convert_file_name == NULL && summary_file_name == NULL) {
+        fprintf(stderr, "%s: '-range' requires '-convert' or '-stats'.\n", argv[0]);
+        exit(-1);
+    }
+    if (convert_file_name != NULL && summary_file_name != NULL) {
+        fprintf(stderr, "%s: '-convert' and '-stats' cannot be combined.\n", argv[0]);
+        exit(-1);
+    }
+    if (aggregate_file_name != NULL && aggregate_period == 0) {
+        fprintf(stderr, "%s: '-A' requires '-a'.\n", argv[0]);
+        exit(-1);
+    }
+    if (aggregate_period > 0 && aggregate_file_name == NULL &&
+        output_format == FORMAT_RAW && convert_file_name == NULL) {
+        fprintf(stderr, "%s: Aggregates are csv; use '-A' to record raw samples as well.\n",
+                argv[0]);
+        exit(-1);
+    }
+    if ((rotate_bytes > 0 || rotate_seconds > 0) &&
+        (file_backend == OUT_FILE_MAPPED || file_backend == OUT_FILE_NET ||
+         convert_file_name != NULL)) {
+        fprintf(stderr, "%s: '-R' cannot be used with '-m', '-n' or '-convert'.\n", argv[0]);
+        exit(-1);
+    }
+    if (file_backend == OUT_FILE_MAPPED && compress_codec != COMPRESS_NONE) {
+        fprintf(stderr, "%s: '-m' and '-z' cannot be combined.\n", argv[0]);
+        exit(-1);
+    }
+    if (file_name == NULL) {
+        if (output_format == FORMAT_RAW && convert_file_name == NULL) {
+            file_name = default_raw_file_name;
+        } else if (compress_codec == COMPRESS_LZ4) {
+            file_name = default_lz4_file_name;
+        } else if (compress_codec == COMPRESS_ZSTD) {
+            file_name = default_zstd_file_name;
+        } else {
+            file_name = default_file_name;
+        }
+    }
+    if (service_name != NULL &&
+        (duration >= 1 || file_backend == OUT_FILE_MAPPED || benchmark ||
+         convert_file_name != NULL || summary_file_name != NULL || recover_file_name != NULL)) {
+        fprintf(stderr, "%s: '-service' cannot be used with '-d', '-m', '-bench', '-convert', "
+                "'-stats' or '-recover'.\n", argv[0]);
+        exit(-1);
+    }
+    if (benchmark && duration < 1) {
+        duration = BENCH_DURATION;
+    }
+    if (GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask)) {
+        for (d = 0; d < session.recorder.no_cards; d++) {
+            if ((card[d].acquisition_core != NO_CORE &&
+                 !(process_mask & ((DWORD_PTR)1 << card[d].acquisition_core))) ||
+                (card[d].delivery_core != NO_CORE &&
+                 !(process_mask & ((DWORD_PTR)1 << card[d].delivery_core)))) {
+                fprintf(stderr, "%s: A core given to '-C' is not available to the process.\n",
+                        argv[0]);
+                exit(-1);
+            }
+        }
+    }
+    for (d = 0; d < session.recorder.no_cards; d++) {
+        card[d].wait_mode = wait_mode;
+        card[d].daq = simulate ? &daq_simulated : &daq_usb1901;
+    }
+}
+
+/* Convert and store length samples. The buffer must hold whole scans. */
+void process_samples(device_t* dev, signed short* buffer, int length)
+{
+    char* text;
+    char* chunk;
+    double scan_time = (double)dev->scan_intrv / U1902_TIMEBASE;
+    LARGE_INTEGER now;
+
+    stream_stats_add(&dev->totals, buffer, length);
+    if (aggregate_period > 0) {
+        aggregate_add(&dev->aggregate, buffer, length, dev->scans_written,
+                      write_window, dev);
+        if (aggregate_file_name == NULL) {
+            /* The aggregates replace the samples. */
+            power_block(dev->pair, dev->no_pairs, buffer, length / dev->no_channels,
+                        dev->no_channels, scan_time);
+            dev->scans_written += length / dev->no_channels;
+            QueryPerformanceCounter(&now);
+            dev->write_qpc = now.QuadPart;
+            return;
+        }
+    }
+    if (output_format == FORMAT_RAW) {
+        power_block(dev->pair, dev->no_pairs, buffer, length / dev->no_channels,
+                    dev->no_channels, scan_time);
+        QueryPerformanceCounter(&now);
+        dev->write_qpc = now.QuadPart;
+        dev->card->stats.bytes += sizeof(signed short) * length;
+    }
+    /* The acquisition thread stores the blocks of a mapped file itself. */
+    if (output_format == FORMAT_RAW && dev->file.backend != OUT_FILE_MAPPED) {
+        if (compress_codec != COMPRESS_NONE) {
+            /* The compressor thread delta encodes and compresses the copy. */
+            chunk = compressor_acquire(&dev->compressor);
+            memcpy(chunk, buffer, sizeof(signed short) * length);
+            compressor_submit(&dev->compressor, COMPRESS_CHUNK_SAMPLES,
+                              sizeof(signed short) * length);
+        } else {
+            /* Write the ADC codes into the file as they are. */
+            if (raw_write_record(&dev->file, RAW_RECORD_SAMPLES, length) < 0) {
+                return;
+            }
+            out_file_write(&dev->file, buffer, sizeof(signed short) * length);
+        }
+    }
+    if (output_format == FORMAT_CSV) {
+        /* Format the data for the file, or straight into the compressor. */
+        chunk = dev->csv_buffer;
+        if (compress_codec != COMPRESS_NONE) {
+            chunk = compressor_acquire(&dev->compressor);
+        }
+        text = format_scans(dev, buffer, length, chunk);
+        QueryPerformanceCounter(&now);
+        dev->write_qpc = now.QuadPart;
+        dev->card->stats.bytes += text - chunk;
+        /* Write data into the file. */
+        if (compress_codec != COMPRESS_NONE) {
+            compressor_submit(&dev->compressor, COMPRESS_CHUNK_DATA, text - chunk);
+        } else {
+            out_file_write(&dev->file, chunk, text - chunk);
+        }
+    }
+    dev->scans_written += length / dev->no_channels;
 }
 
-int process_samples(signed short* buffer, int length, int offset)
+/* Format length samples, whole scans from scan dev->scans_written, as csv
+ * lines at text and add their energy to the power pairs. Returns the end of
+ * the text, which needs csv_buffer_size(dev, length) bytes.
+ */
+static char* format_scans(device_t* dev, const signed short* buffer, int length, char* text)
 {
     int i;
-    double toVolts[MAX_CHANNELS];
-    double samplesPerChannel = (double)(length/no_channels);
-    double sum[MAX_CHANNELS];
+    int c = 0;
+    unsigned __int64 ticks = dev->scans_written * dev->scan_intrv;
+    double scan_time = (double)dev->scan_intrv / U1902_TIMEBASE;
+    double power_sum[POWER_MAX_PAIRS];
+    double power;
+    int p;
 
-    for (i = 0; i < no_channels; i++) {
-        sum[i] = 0.0;
-        toVolts[i] = ad_range_to_volt(channel[i].AdRange)/(double)(1<<15);
+    for (p = 0; p < dev->no_pairs; p++) {
+        power_sum[p] = 0.0;
     }
     for (i = 0; i < length; i++) {
-        int c = (i + offset) % no_channels;
-        double volts = (double)buffer[i] * toVolts[c];
+        if (timestamps && c == 0) {
+            text += format_seconds(text,
+                                   ticks / U1902_TIMEBASE * 1000000000 +
+                                   ticks % U1902_TIMEBASE * 1000000000 / U1902_TIMEBASE);
+            *text++ = ',';
+            *text++ = '\t';
+            ticks += dev->scan_intrv;
+        }
+        LUT_COPY_TEXT(dev->channel_lut[c], buffer[i], text);
+        if (++c < dev->no_channels) {
+            *text++ = ',';
+            *text++ = '\t';
+        } else {
+            /* The power of the scan just completed follows its samples. */
+            for (p = 0; p < dev->no_pairs; p++) {
+                power = POWER_AT(&dev->pair[p], buffer + i + 1 - c);
+                power_sum[p] += power;
+                *text++ = ',';
+                *text++ = '\t';
+                text += format_exp(text, power, precision);
+            }
+            *text++ = '\n';
+            c = 0;
+        }
+    }
+    for (p = 0; p < dev->no_pairs; p++) {
+        dev->pair[p].energy += power_sum[p] * scan_time;
+    }
+    return text;
+}
+
+/* Mark that about lost_scans scans are missing at this point of the file. */
+void process_gap(device_t* dev, U32 lost_scans)
+{
+    fprintf(stderr, "Gap of about %u scans at %.3f s into the recording in '%s'.\n",
+            lost_scans, (double)dev->scans_written * dev->scan_intrv / U1902_TIMEBASE,
+            dev->file_name);
+    if (aggregate_period > 0) {
+        /* A window never spans a gap. */
+        aggregate_flush(&dev->aggregate, write_window, dev);
+        if (aggregate_file_name != NULL) {
+            char text[64];
+            out_file_write(&dev->aggregate_file, text,
+                           sprintf(text, "# gap: about %u scans lost\n", lost_scans));
+        }
+    }
+    if (output_format == FORMAT_RAW) {
+        if (dev->file.backend != OUT_FILE_MAPPED) {
+            output_record(dev, RAW_RECORD_GAP, lost_scans);
+        }
+    } else {
+        char text[64];
+        output_write(dev, text, sprintf(text, "# gap: about %u scans lost\n", lost_scans));
+    }
+    dev->scans_written += lost_scans;
+    dev->gaps_written++;
+}
 
-        sum[c] += volts;
+/* Mark that the scans scans before this point were deliberately not stored. */
+void process_skip(device_t* dev, unsigned __int64 scans)
+{
+    unsigned __int64 left;
+    U32 count;
 
-        /* Write data into the file. */
-        if ((c + 1) % no_channels) {
-            fprintf(file, "%e,\t", volts);
-        } else {
-            fprintf(file, "%e\n", volts);
+    if (output_format == FORMAT_RAW) {
+        /* A gap record counts at most 2^32 - 1 scans. */
+        for (left = scans; left > 0; left -= count) {
+            count = left > 0xFFFFFFFF ? 0xFFFFFFFF : (U32)left;
+            output_record(dev, RAW_RECORD_GAP, count);
         }
+    } else {
+        char text[64];
+        output_write(dev, text, sprintf(text, "# skipped: %.0f scans before the trigger\n",
+                                        (double)scans));
     }
-    for (i = 0; i < no_channels; i++) {
-        //printf("  Channel %d first value %e V.\n", i, (double)buffer[i] * toVolts[i]);
-        printf("  Channel %d average %e V.\n", channel[i].id, sum[i]/samplesPerChannel);
+    if (aggregate_period > 0 && aggregate_file_name != NULL) {
+        char text[64];
+        out_file_write(&dev->aggregate_file, text,
+                       sprintf(text, "# skipped: %.0f scans before the trigger\n",
+                               (double)scans));
     }
-    return (length + offset) % no_channels;
+    dev->scans_written += scans;
 }
 
-static double ad_range_to_volt(U16 range)
+/* Start a block of the samples of one half buffer, transferred from the
+ * card at qpc.
+ */
+void process_block(device_t* dev, __int64 qpc)
 {
-    switch (range) {
-    case AD_B_0_2_V:
-        return 0.200;
-    case AD_B_1_V:
-        return 1.00;
-    case AD_B_2_V:
-        return 2.00;
-    case AD_B_10_V:
-        return 10.00;
-    default:
-        fprintf(stderr, "ad_range_to_volt: Unknown AD range.");
-        return 0.00;
+    raw_block_t block;
+
+    if (output_format == FORMAT_RAW && dev->file.backend != OUT_FILE_MAPPED) {
+        memset(&block, 0, sizeof(block));
+        block.sequence = dev->blocks_written++;
+        block.first_scan = dev->scans_written;
+        block.qpc = qpc;
+        if (compress_codec != COMPRESS_NONE) {
+            /* The compressor knows where the block lands in the file. */
+            dev->card->stats.bytes += sizeof(raw_record_t) + sizeof(block);
+            compressor_write_block(&dev->compressor, &block);
+            return;
+        }
+        if (dev->raw_open) {
+            raw_index_add(&dev->index, out_file_tell(&dev->file), &block);
+        }
+        output_record(dev, RAW_RECORD_BLOCK, sizeof(block));
+        output_write(dev, &block, sizeof(block));
     }
 }
 
-static I16 open_USB1901()
+/* Until the software trigger fires keep the block in the history and
+ * return 0. When it fires write the history and return 1; the caller then
+ * writes the block as usual.
+ */
+static int pretrigger_block(device_t* dev, const signed short* buffer, const block_info_t* info)
 {
-    I16 card, err;
-    U16 card_num;
-    U16 wModuleNum;
-    USBDAQ_DEVICE AvailModules[MAX_USB_DEVICE];
+    pretrigger_t* t = &dev->pretrigger;
+    U32 scans = info->length / dev->no_channels;
+    const signed short* first;
+    const signed short* second;
+    unsigned int first_scans, second_scans;
+    unsigned int needed;
+    int s;
+
+    if (info->lost_scans > 0) {
+        /* The history must be contiguous with the block. */
+        dev->skipped_scans += pretrigger_reset(t) + info->lost_scans;
+    }
+    s = pretrigger_find(t, buffer, scans);
+    if (s < 0) {
+        dev->skipped_scans += pretrigger_keep(t, buffer, scans);
+        dev->history_qpc = info->qpc;
+        return 0;
+    }
 
-    /* Card configuration. */
-    U16 ConfigCtrl =
-        P1902_AI_Differential|P1902_AI_CONVSRC_INT;         /* Gives reasonable numbers for diff channels 0 and 1 but not 2 and 3? */
-        //P1902_AI_NonRef_SingEnded|P1902_AI_CONVSRC_INT;   /* Gives very strange numbers. */
-        //P1902_AI_SingEnded|P1902_AI_CONVSRC_INT;          /* Works. Note: each end of the shunt is a channel. Leads to poor accuracy. */
-    U16 TrigCtrl = P1902_AI_TRGMOD_POST|P1902_AI_TRGSRC_SOFT;
-    U32 TriggerLvel = 0;  /* Ignore for P1902_AI_TRGSRC_SOFT */
-    U32 ReTriggerCount = 0; /*Ignore in Double Buffer Mode*/
-    U32 DelayCount = 0; /* Ignore for P1902_AI_TRGSRC_SOFT */
-    U32 ScanIntrv = U1902_TIMEBASE/sample_rate; /* Interval in clock cycles between scans of the channels. 80Mhz/scan freq. */
-    U32 SampIntrv = 128*320;  /* Interval in clock cycles between each A/D conversion. The UD-DASK manual claims that 320 is the only valid value for USB-1901. The USB-1901 manual says it is the _minimum_ value. */
-    U32 AI_ReadCount = AI_COUNT; /*AI read count per one buffer*/
+    /* Write pretrigger_seconds before the trigger, all of it if possible. */
+    needed = t->capacity > (unsigned int)s ? t->capacity - s : 0;
+    needed = pretrigger_history(t, needed, &first, &first_scans, &second, &second_scans);
+    dev->skipped_scans += t->fill - needed;
+    if (!quiet) {
+        printf("\nCard %d: Triggered %.3f s into the acquisition.\n", dev->card_id,
+               (double)(dev->skipped_scans + needed + s) * dev->scan_intrv / U1902_TIMEBASE);
+    }
+    if (dev->skipped_scans > 0) {
+        process_skip(dev, dev->skipped_scans);
+    }
+    process_history(dev, first, first_scans, second, second_scans);
+    return 1;
+}
 
-    U16 NumChans = no_channels; /*AI Channel Counts to be read*/
-    U16 Chans[MAX_CHANNELS]; /*AI Channels array*/
-    U16 AdRanges[MAX_CHANNELS]; /*AI Ranges array*/
-    U32 i;
+/* Write the history, first_scans scans at first and then second_scans at
+ * second, as blocks of at most a half buffer. It ends where the trigger block
+ * begins, so the blocks line up with the half buffers kept and each is timed
+ * back from the newest one.
+ */
+static void process_history(device_t* dev, const signed short* first, unsigned int first_scans,
+                            const signed short* second, unsigned int second_scans)
+{
+    unsigned int half_scans = dev->half_count / dev->no_channels;
+    double ticks_per_scan = (double)qpc_frequency.QuadPart * dev->scan_intrv / U1902_TIMEBASE;
+    unsigned int left = first_scans + second_scans;
+    unsigned int piece;
+    unsigned int n;
 
-    /* Configure the channel order and per-channel range. */
-    for (i=0; i < NumChans; i++) {
-        Chans[i] = channel[i].id;
-        AdRanges[i] = channel[i].AdRange;
+    while (left > 0) {
+        piece = left % half_scans == 0 ? half_scans : left % half_scans;
+        left -= piece;
+        process_block(dev, dev->history_qpc - (__int64)(left * ticks_per_scan));
+        while (piece > 0) {
+            if (first_scans == 0) {
+                first = second;
+                first_scans = second_scans;
+                second_scans = 0;
+            }
+            n = piece < first_scans ? piece : first_scans;
+            process_samples(dev, (signed short*)first, n * dev->no_channels);
+            first += n * dev->no_channels;
+            first_scans -= n;
+            piece -= n;
+        }
     }
+}
 
-    printf("Configuring USB-1901 to perform analog data acquisition from %d channels\n", no_channels);
-    printf("at %6.3lf Hz scan rate in double buffer mode.\n\n", (double)U1902_TIMEBASE/(double)ScanIntrv);
+/* Publish the statistics of a half buffer just written to the telemetry,
+ * and print them at most every CONSOLE_INTERVAL seconds unless quiet.
+ */
+static void report_block(device_t* dev, const signed short* buffer, const block_info_t* info,
+                         const double* energy_before)
+{
+    block_stats_t stats;
+    telemetry_card_t* slot;
+    const stream_channel_t* channel;
+    const sample_lut_t* lut;
+    short code[STREAM_QUANTILES];
+    double now = recorder_seconds();
+    int quantiles = now - dev->last_quantiles >= CONSOLE_INTERVAL;
+    double block_time = (double)(info->length / dev->no_channels) * dev->scan_intrv / U1902_TIMEBASE;
+    int print = !quiet && now - dev->last_status >= CONSOLE_INTERVAL;
+    int index = (int)(dev - dev->session->device);
+    U32 n;
+    int i;
+    int q;
 
-    /* Find all devices. */
-    err = UD_Device_Scan(&wModuleNum, AvailModules);
-    if (err < 0) {
-        fprintf(stderr, "UD_Device_Scan Error: %d\n", err);
-        exit(1);
+    if (!print && telemetry_name == NULL) {
+        return;
     }
+    kernel_block_stats(buffer, info->length, dev->no_channels, 0, &stats);
 
-    card_num = INVALID_CARD_ID;
+    if (telemetry_name != NULL) {
+        slot = telemetry_begin(&telemetry, index);
+        slot->card_id = dev->card_id;
+        slot->no_channels = dev->no_channels;
+        slot->scan_rate = (double)U1902_TIMEBASE / dev->scan_intrv;
+        slot->qpc = info->qpc;
+        slot->scans = dev->scans_written;
+        slot->gaps = dev->gaps_written;
+        slot->overruns = dev->card->overruns;
+        slot->dropped_blocks = dev->card->dropped_blocks;
+        for (i = 0; i < dev->no_channels; i++) {
+            slot->channel_id[i] = dev->channel[i].id;
+            slot->scale[i] = dev->channel_lut[i]->scale;
+            slot->mean[i] = stats.count[i] == 0 ? 0.0 :
+                (double)stats.sum[i] * dev->channel_lut[i]->scale / (double)stats.count[i];
+            slot->min[i] = LUT_VOLTS(dev->channel_lut[i], stats.min[i]);
+            slot->max[i] = LUT_VOLTS(dev->channel_lut[i], stats.max[i]);
 
-    /* Pick the first available device of the right type. */
-    for (i = 0; i < wModuleNum; i++) {
-        if (AvailModules[i].wModuleType == USB_1901) {
-            card_num = AvailModules[i].wCardID;
-            break;
+            channel = &dev->totals.channel[i];
+            lut = dev->channel_lut[i];
+            slot->total_mean[i] = channel->mean * lut->scale;
+            slot->total_std[i] = sqrt(stream_stats_variance(channel)) * lut->scale;
+            slot->total_min[i] = LUT_VOLTS(lut, channel->min);
+            slot->total_max[i] = LUT_VOLTS(lut, channel->max);
+            if (quantiles) {
+                stream_stats_quantiles(channel, stream_quantile_level, STREAM_QUANTILES, code);
+                for (q = 0; q < STREAM_QUANTILES; q++) {
+                    slot->quantile[i][q] = LUT_VOLTS(lut, code[q]);
+                }
+            }
+        }
+        if (quantiles) {
+            dev->last_quantiles = now;
+        }
+        slot->no_pairs = dev->no_pairs;
+        for (i = 0; i < dev->no_pairs; i++) {
+            slot->energy[i] = dev->pair[i].energy;
+            slot->power[i] = block_time > 0.0 ?
+                (dev->pair[i].energy - energy_before[i]) / block_time : 0.0;
         }
+        n = TELEMETRY_LATEST - TELEMETRY_LATEST % dev->no_channels;
+        if (n > info->length) {
+            n = info->length;
+        }
+        memcpy(slot->latest, buffer + info->length - n, sizeof(signed short) * n);
+        slot->latest_length = n;
+        telemetry_end(&telemetry, index);
     }
 
-    if (card_num == INVALID_CARD_ID) {
-        fprintf(stderr, "No active USB_1901 USB device\n");
-        exit(2);
+    if (print) {
+        dev->last_status = now;
+        printf("\nCard %d: %.0f scans written to '%s' (%.1f s).\n",
+               dev->card_id, (double)dev->scans_written, dev->file_name,
+               (double)dev->scans_written * dev->scan_intrv / U1902_TIMEBASE);
+        if (print_averages) {
+            for (i = 0; i < dev->no_channels; i++) {
+                if (stats.count[i] == 0) {
+                    continue;
+                }
+                printf("  Channel %d average %e V (min %e V, max %e V).\n",
+                       dev->channel[i].id,
+                       (double)stats.sum[i] * dev->channel_lut[i]->scale / (double)stats.count[i],
+                       LUT_VOLTS(dev->channel_lut[i], stats.min[i]),
+                       LUT_VOLTS(dev->channel_lut[i], stats.max[i]));
+            }
+            for (i = 0; i < dev->no_pairs; i++) {
+                printf("  Power %d:%d %e W, %e J so far.\n",
+                       dev->pair[i].v_channel, dev->pair[i].i_channel,
+                       block_time > 0.0 ? (dev->pair[i].energy - energy_before[i]) / block_time : 0.0,
+                       dev->pair[i].energy);
+            }
+        }
+        if (duration < 1 && service_name == NULL && !dev->card->acquisition_done) {
+            printf("                            Press any key to stop...\n");
+        }
     }
+}
+
+/* Tag a csv stream with the common timebase so it can be merged. */
+static void write_time_header(device_t* dev)
+{
+    char text[128];
+
+    output_write(dev, text, format_time_header(dev, text));
+}
+
+/* The text of write_time_header(). Returns its length. */
+static int format_time_header(device_t* dev, char* text)
+{
+    return sprintf(text, "# card %d start_qpc %lld qpc_frequency %lld\n",
+                   dev->card_id, (__int64)dev->start_qpc.QuadPart,
+                   (__int64)qpc_frequency.QuadPart);
+}
 
-    /* Register/open the device. */
-    card = UD_Register_Card(USB_1901, card_num);
-    if (card < 0) {
-        fprintf(stderr, "UD_Register_Card Error: %d\n", card);
-        exit(3);
+/* Append length bytes to the card's output, through the compressor if
+ * there is one.
+ */
+static void output_write(device_t* dev, const void* data, size_t length)
+{
+    dev->card->stats.bytes += length;
+    if (compress_codec != COMPRESS_NONE) {
+        compressor_write(&dev->compressor, data, length);
+    } else {
+        out_file_write(&dev->file, data, length);
     }
+}
 
-    /* Configure Analog Input */
-    err = UD_AI_1902_Config(card, ConfigCtrl, TrigCtrl, TriggerLvel, ReTriggerCount, DelayCount);
-    if(err < 0) {
-        fprintf(stderr, "UD_AI_1902_Config Error: %d\n", err);
-        exit(1);
+/* Append a raw record header to the card's output. */
+static void output_record(device_t* dev, U16 type, U32 count)
+{
+    raw_record_t record;
+
+    record.type = type;
+    record.reserved = 0;
+    record.count = count;
+    output_write(dev, &record, sizeof(record));
+}
+
+/* Bytes needed for the csv text of samples samples. */
+static size_t csv_buffer_size(device_t* dev, size_t samples)
+{
+    return samples * CSV_MAX_FIELD_LENGTH +
+           samples / dev->no_channels * dev->no_pairs * (CSV_MAX_FIELD_LENGTH + 2) +
+           (timestamps ? samples / dev->no_channels * CSV_MAX_TIME_LENGTH : 0);
+}
+
+/* Set up the card's aggregation if it was requested. */
+static int start_aggregate(device_t* dev)
+{
+    double window;
+    char text[224];
+    int n;
+
+    if (aggregate_period == 0) {
+        return 0;
     }
+    window = aggregate_period * 0.001 * U1902_TIMEBASE / dev->scan_intrv + 0.5;
+    aggregate_init(&dev->aggregate, dev->no_channels, window < 1.0 ? 1 : (unsigned int)window);
+    aggregate_set_pairs(&dev->aggregate, dev->pair, dev->no_pairs);
+    n = sprintf(text, "# Window start time, then the mean, min, max and rms in V of each channel"
+                "%s over %d scans (%.3f ms).\n",
+                dev->no_pairs > 0 ? " and the mean power in W of each pair" : "",
+                dev->aggregate.window,
+                1000.0 * dev->aggregate.window * dev->scan_intrv / U1902_TIMEBASE);
+    if (aggregate_file_name != NULL) {
+        char* name = aggregate_file_name;
+        int err;
 
-    /* Enable Double Buffer Mode */
-    err = UD_AI_AsyncDblBufferMode(card, 1); // double-buffer mode
-    if (err < 0) {
-        fprintf(stderr, "UD_AI_AsyncDblBufferMode Error: %d\n", err);
-        exit(1);
+        if (dev->session->recorder.no_cards > 1) {
+            name = card_file_name(aggregate_file_name, dev->card_id);
+            if (name == NULL) {
+                return -1;
+            }
+        }
+        err = out_file_open(&dev->aggregate_file, name, OUT_FILE_STDIO, 0, 0);
+        if (name != aggregate_file_name) {
+            free(name);
+        }
+        if (err < 0) {
+            return -1;
+        }
+        out_file_write(&dev->aggregate_file, text, n);
+    } else {
+        output_write(dev, text, n);
     }
+    return 0;
+}
+
+/* Write the aggregates of one window as a line of csv. */
+static void write_window(void* arg, const aggregate_t* aggregate)
+{
+    device_t* dev = (device_t*)arg;
+    char text[CSV_MAX_TIME_LENGTH + (4*AGGREGATE_MAX_CHANNELS + POWER_MAX_PAIRS)*CSV_MAX_FIELD_LENGTH];
+    char* p = text;
+    unsigned __int64 ticks = aggregate->first_scan * dev->scan_intrv;
+    double scale;
+    int c;
 
-    /* Set Scan and Sampling Rate */
-    if (NumChans == 1) {
-        SampIntrv = 320; /* With just one channel the minimum value should be safe. */
+    p += format_seconds(p, ticks / U1902_TIMEBASE * 1000000000 +
+                           ticks % U1902_TIMEBASE * 1000000000 / U1902_TIMEBASE);
+    for (c = 0; c < dev->no_channels; c++) {
+        scale = dev->channel_lut[c]->scale;
+        *p++ = ',';
+        *p++ = '\t';
+        p += format_exp(p, (double)aggregate->sum[c] * scale / aggregate->scans, precision);
+        *p++ = ',';
+        *p++ = '\t';
+        p += format_exp(p, LUT_VOLTS(dev->channel_lut[c], aggregate->min[c]), precision);
+        *p++ = ',';
+        *p++ = '\t';
+        p += format_exp(p, LUT_VOLTS(dev->channel_lut[c], aggregate->max[c]), precision);
+        *p++ = ',';
+        *p++ = '\t';
+        p += format_exp(p, sqrt((double)aggregate->sum_squares[c] / aggregate->scans) * scale,
+                        precision);
     }
-    err = UD_AI_1902_CounterInterval(card, ScanIntrv, SampIntrv);
-    if (err < 0) {
-        fprintf(stderr, "UD_AI_1902_CounterInterval Error: %d\n", err);
-        exit(1);
+    for (c = 0; c < aggregate->no_pairs; c++) {
+        *p++ = ',';
+        *p++ = '\t';
+        p += format_exp(p, aggregate->power_sum[c] / aggregate->scans, precision);
+    }
+    *p++ = '\n';
+    if (aggregate_file_name != NULL) {
+        dev->card->stats.bytes += p - text;
+        out_file_write(&dev->aggregate_file, text, p - text);
+    } else {
+        output_write(dev, text, p - text);
+    }
+}
+
+/* Start the card's compressor thread if compression was requested. */
+static int start_compressor(device_t* dev, size_t chunk_size)
+{
+    if (compress_codec == COMPRESS_NONE) {
+        return 0;
+    }
+    if (compressor_init(&dev->compressor, &dev->file, compress_codec, compress_level,
+                        output_format == FORMAT_CSV ? COMPRESS_FRAME : COMPRESS_RECORDS,
+                        dev->no_channels, chunk_size) < 0) {
+        return -1;
     }
+    dev->compressor.index = dev->raw_open ? &dev->index : NULL;
+    return 0;
+}
 
-    /* AI Acquisition Start */
-    if (NumChans == 1) {
-        err = UD_AI_ContReadChannel(card, Chans[0], AdRanges[0], NULL /* Not used for DB */, AI_ReadCount, 0/*Ignore*/, ASYNCH_OP);
-        if (err < 0) {
-            DWORD dwError = GetLastError();
+/* Look up the conversion table of each channel's range. */
+static int build_luts(device_t* dev)
+{
+    int i;
 
-            fprintf(stderr, "UD_AI_ContReadChannel Error: %d, GetLastError = %d\n", err, dwError );
-            clean_exit(card, 1);
+    for (i = 0; i < dev->no_channels; i++) {
+        dev->channel_lut[i] = sample_lut_get(dev->channel[i].AdRange,
+                                             output_format == FORMAT_CSV, precision);
+        if (dev->channel_lut[i] == NULL) {
+            return -1;
         }
-    } else {
-        err = UD_AI_ContReadMultiChannels(card, NumChans, Chans, AdRanges, NULL /* Not used for DB */, AI_ReadCount, 0/*Ignore*/, ASYNCH_OP);
-        if (err < 0) {
-            DWORD dwError = GetLastError();
+    }
+    return 0;
+}
+
+/* Find the channels of each power pair in the scan. Needs the LUTs. */
+static int setup_power(device_t* dev)
+{
+    power_pair_t* pair;
+    int p;
+    int c;
+
+    for (p = 0; p < dev->no_pairs; p++) {
+        pair = &dev->pair[p];
+        pair->v_pos = -1;
+        pair->i_pos = -1;
+        for (c = 0; c < dev->no_channels; c++) {
+            if (dev->channel[c].id == pair->v_channel && pair->v_pos < 0) {
+                pair->v_pos = c;
+            }
+            if (dev->channel[c].id == pair->i_channel && pair->i_pos < 0) {
+                pair->i_pos = c;
+            }
+        }
+        if (pair->v_pos < 0 || pair->i_pos < 0) {
+            fprintf(stderr, "Channel %d of the power pair %d:%d is not sampled.\n",
+                    pair->v_pos < 0 ? pair->v_channel : pair->i_channel,
+                    pair->v_channel, pair->i_channel);
+            return -1;
+        }
+        pair->v_volts = dev->channel_lut[pair->v_pos]->volts;
+        pair->i_volts = dev->channel_lut[pair->i_pos]->volts;
+        pair->conductance = 1.0 / pair->shunt;
+        pair->energy = 0.0;
+    }
+    return 0;
+}
+
+/* Allocate the card's pre-trigger history if one was requested. */
+static int setup_pretrigger(device_t* dev)
+{
+    double code;
+    double scans;
+    int c;
+
+    if (pretrigger_seconds <= 0.0) {
+        return 0;
+    }
+    for (c = 0; c < dev->no_channels; c++) {
+        if (dev->channel[c].id == pretrigger_channel) {
+            break;
+        }
+    }
+    if (c == dev->no_channels) {
+        fprintf(stderr, "The trigger channel %d is not sampled.\n", pretrigger_channel);
+        return -1;
+    }
+    code = floor(pretrigger_level / dev->channel_lut[c]->scale + 0.5);
+    if (code < -32768.0) code = -32768.0;
+    if (code > 32767.0) code = 32767.0;
+    scans = pretrigger_seconds * dev->session->recorder.config.sample_rate;
+    if (scans < 1.0) {
+        scans = 1.0;
+    }
+    if ((scans + 1.0) * dev->no_channels > MAX_PRETRIGGER_SAMPLES ||
+        pretrigger_init(&dev->pretrigger, dev->no_channels, c, (short)code,
+                        pretrigger_falling, (unsigned int)scans) < 0) {
+        fprintf(stderr, "Failed to allocate %.0f scans of pre-trigger history.\n", scans);
+        return -1;
+    }
+    return 0;
+}
+
+/* Print the energy of each power pair over the recording. */
+static void print_energy(device_t* dev)
+{
+    double seconds = (double)dev->scans_written * dev->scan_intrv / U1902_TIMEBASE;
+    int p;
+
+    for (p = 0; p < dev->no_pairs; p++) {
+        printf("Power %d:%d (%g ohm shunt): %e J, mean %e W.\n",
+               dev->pair[p].v_channel, dev->pair[p].i_channel, dev->pair[p].shunt,
+               dev->pair[p].energy,
+               seconds > 0.0 ? dev->pair[p].energy / seconds : 0.0);
+    }
+}
+
+/* Open the card's data file. */
+static int open_output(device_t* dev)
+{
+    if (rotate_bytes > 0 || rotate_seconds > 0) {
+        dev->base_name = dev->file_name;
+        dev->file_name = chunk_file_name(dev->base_name, 0);
+        if (dev->file_name == NULL ||
+            out_file_open(&dev->file, dev->file_name, file_backend,
+                          output_format == FORMAT_RAW, 0) < 0) {
+            return -1;
+        }
+        dev->raw_open = output_format == FORMAT_RAW;
+        open_next_chunk(dev);
+        return 0;
+    }
+    if (out_file_open(&dev->file, dev->file_name, file_backend,
+                      output_format == FORMAT_RAW, expected_file_size(dev)) < 0) {
+        return -1;
+    }
+    dev->raw_open = output_format == FORMAT_RAW && file_backend != OUT_FILE_NET;
+    return 0;
+}
+
+/* Start a file of the card's output: the raw header or, for csv, the
+ * common timebase if it is needed. The files of a rotated recording say
+ * where in it they start.
+ */
+static int write_file_header(device_t* dev)
+{
+    const FILETIME* start_time = &dev->session->recorder.start_time;
+    int rotating = dev->base_name != NULL;
+    raw_chunk_t chunk;
+    char text[64];
+
+    if (output_format == FORMAT_RAW) {
+        if (write_raw_header(dev, start_time->dwLowDateTime, start_time->dwHighDateTime) < 0) {
+            return -1;
+        }
+        if (rotating) {
+            memset(&chunk, 0, sizeof(chunk));
+            chunk.chunk = dev->chunk;
+            chunk.first_scan = dev->chunk_first_scan;
+            if (raw_write_record(&dev->file, RAW_RECORD_CHUNK, sizeof(chunk)) < 0 ||
+                out_file_write(&dev->file, &chunk, sizeof(chunk)) < 0) {
+                return -1;
+            }
+        }
+        return 0;
+    }
+    if (dev->session->recorder.no_cards > 1 || timestamps || rotating) {
+        write_time_header(dev);
+    }
+    if (rotating) {
+        output_write(dev, text, sprintf(text, "# chunk %d first_scan %.0f\n",
+                                        dev->chunk, (double)dev->chunk_first_scan));
+    }
+    return 0;
+}
+
+/* Open the card's next file ahead of time so that switching to it is quick. */
+static void open_next_chunk(device_t* dev)
+{
+    dev->next_name = chunk_file_name(dev->base_name, dev->chunk + 1);
+    dev->next_open = dev->next_name != NULL &&
+                     out_file_open(&dev->next_file, dev->next_name, file_backend,
+                                   output_format == FORMAT_RAW, 0) == 0;
+    if (!dev->next_open) {
+        fprintf(stderr, "Card %d: Continuing in '%s'.\n", dev->card_id, dev->file_name);
+        free(dev->next_name);
+        dev->next_name = NULL;
+    }
+}
+
+/* Non-zero if the current file of a rotated recording is complete. */
+static int rotation_due(device_t* dev)
+{
+    if (!dev->next_open) {
+        return 0;
+    }
+    if (rotate_bytes > 0) {
+        /* With compression this lags behind by the queued chunks. */
+        return dev->file.bytes >= rotate_bytes;
+    }
+    return (dev->scans_written - dev->chunk_first_scan) * dev->scan_intrv >=
+           (unsigned __int64)rotate_seconds * U1902_TIMEBASE;
+}
+
+/* Close the card's current file and continue in the one opened ahead.
+ * Called by write_block() between half buffers. Returns 0 on success and
+ * -1 if nothing more can be written.
+ */
+static int rotate_output(device_t* dev)
+{
+    size_t chunk_size = dev->compressor.chunk_size;
+    unsigned __int64 bytes_in = dev->compressor.bytes_in;
+    unsigned __int64 bytes_out = dev->compressor.bytes_out;
 
-            fprintf(stderr, "UD_AI_ContReadMultiChannels Error: %d, GetLastError = %d\n", err, dwError );
-            clean_exit(card, 1);
+    if (compress_codec != COMPRESS_NONE) {
+        /* Each file is a complete frame. */
+        compressor_finish(&dev->compressor);
+    }
+    index_output(dev);
+    if (out_file_close(&dev->file) < 0) {
+        fprintf(stderr, "Card %d: Failed to close '%s'.\n", dev->card_id, dev->file_name);
+    }
+    dev->raw_open = output_format == FORMAT_RAW;
+    dev->blocks_written = 0;
+    dev->file = dev->next_file;
+    dev->next_open = 0;
+    dev->chunk++;
+    dev->chunk_first_scan = dev->scans_written;
+    free(dev->file_name);
+    dev->file_name = dev->next_name;
+    dev->next_name = NULL;
+    if (compress_codec != COMPRESS_NONE) {
+        if (start_compressor(dev, chunk_size) < 0) {
+            return -1;
         }
+        /* Nothing is queued yet, so the totals are still the writer's. */
+        dev->compressor.bytes_in = bytes_in;
+        dev->compressor.bytes_out = bytes_out;
     }
+    if (write_file_header(dev) < 0) {
+        return -1;
+    }
+    open_next_chunk(dev);
+    return 0;
+}
+
+/* Append the index of the blocks written to the card's raw file, which is
+ * about to be closed. Called when no other thread writes to it any more.
+ */
+static void index_output(device_t* dev)
+{
+    raw_index_t* index = &dev->index;
+    unsigned __int64 qpc;
+    U32 i;
 
-    return card;
+    if (!dev->raw_open) {
+        return;
+    }
+    dev->raw_open = 0;
+    if (dev->file.backend == OUT_FILE_MAPPED) {
+        /* The transfer times were stored in the view after the blocks. */
+        for (i = 0; i < index->no_entries; i++) {
+            memcpy(&qpc, dev->file.view + index->entry[i].offset + sizeof(raw_record_t) +
+                         offsetof(raw_block_t, qpc), sizeof(qpc));
+            index->entry[i].qpc = qpc;
+        }
+        raw_index_end(index, dev->mapped_scans);
+    } else {
+        raw_index_end(index, dev->scans_written);
+    }
+    if (index->incomplete || raw_index_output(&dev->file, index) < 0) {
+        fprintf(stderr, "Card %d: '%s' has no index; use '-recover'.\n",
+                dev->card_id, dev->file_name);
+    }
+    /* Keep the memory for the next file. */
+    index->no_entries = 0;
+    index->incomplete = 0;
 }
 
-void clean_exit(U16 card, int code)
+/* Close and remove the card's unused next file. */
+static void discard_next_chunk(device_t* dev)
+{
+    if (!dev->next_open) {
+        return;
+    }
+    out_file_close(&dev->next_file);
+    dev->next_open = 0;
+    DeleteFile(dev->next_name);
+    free(dev->next_name);
+    dev->next_name = NULL;
+}
+
+/* name with '.card<id>' inserted before the extension. */
+static char* card_file_name(const char* name, U16 card_id)
+{
+    char part[16];
+
+    sprintf(part, ".card%d", card_id);
+    return name_with_part(name, part);
+}
+
+/* name with '.<chunk>', six digits, inserted before the extension. */
+static char* chunk_file_name(const char* name, U32 chunk)
+{
+    char part[16];
+
+    sprintf(part, ".%06d", chunk);
+    return name_with_part(name, part);
+}
+
+/* name with part inserted before the extension, or NULL if out of memory. */
+static char* name_with_part(const char* name, const char* part)
+{
+    const char* dot = strrchr(name, '.');
+    size_t base;
+    char* result;
+
+    if (dot == NULL || strpbrk(dot, "\\/") != NULL) {
+        dot = name + strlen(name);
+    }
+    base = dot - name;
+    result = (char*)malloc(strlen(name) + strlen(part) + 1);
+    if (result == NULL) {
+        fprintf(stderr, "Out of memory.\n");
+        return NULL;
+    }
+    memcpy(result, name, base);
+    sprintf(result + base, "%s%s", part, dot);
+    return result;
+}
+
+/* Generous estimate of the size of the card's data file, or 0 if the
+ * duration of the recording is not known.
+ */
+static unsigned __int64 expected_file_size(device_t* dev)
+{
+    unsigned __int64 scans;
+    unsigned __int64 blocks;
+
+    if (duration < 1) {
+        return 0;
+    }
+    /* Room for the final partial half buffer and the time it takes to stop. */
+    scans = (unsigned __int64)duration * dev->session->recorder.config.sample_rate +
+            2*(dev->half_count/dev->no_channels);
+    blocks = scans / (dev->half_count/dev->no_channels) + 1;
+    if (output_format == FORMAT_RAW) {
+        /* Gap, block and samples records and an index entry for every block. */
+        return sizeof(raw_header_t) +
+               blocks * (3*sizeof(raw_record_t) + sizeof(raw_block_t) +
+                         sizeof(raw_index_entry_t)) +
+               sizeof(raw_record_t) + sizeof(raw_index_trailer_t) +
+               scans * dev->no_channels * sizeof(signed short);
+    }
+    return 256 + scans * (dev->no_channels * CSV_MAX_FIELD_LENGTH +
+                          (timestamps ? CSV_MAX_TIME_LENGTH : 0));
+}
+
+/* Lay out the records of the next block of length samples in the mapped
+ * file: a gap record if scans were lost, the block record and the samples
+ * record. Returns where the samples go and sets *qpc to where their transfer
+ * time goes, or returns NULL if the file is full.
+ */
+static signed short* map_block(recorder_card_t* card, U32 lost_scans, U32 length, char** qpc)
+{
+    device_t* dev = (device_t*)card->user;
+    unsigned __int64 needed = 2*sizeof(raw_record_t) + sizeof(raw_block_t) +
+                              sizeof(signed short) * length;
+    raw_block_t block;
+    char* slot;
+
+    if (lost_scans > 0) {
+        needed += sizeof(raw_record_t);
+    }
+    /* Leave room for the index, which is written when the file is closed. */
+    if (out_file_space(&dev->file) < needed + sizeof(raw_record_t) + sizeof(raw_index_trailer_t) +
+                                     sizeof(raw_index_entry_t) * (dev->index.no_entries + 1)) {
+        return NULL;
+    }
+    if (lost_scans > 0) {
+        raw_write_record(&dev->file, RAW_RECORD_GAP, lost_scans);
+        dev->mapped_scans += lost_scans;
+    }
+    memset(&block, 0, sizeof(block));
+    block.sequence = dev->mapped_blocks++;
+    block.first_scan = dev->mapped_scans;
+    dev->mapped_scans += length / dev->no_channels;
+    raw_index_add(&dev->index, out_file_tell(&dev->file), &block);
+    raw_write_record(&dev->file, RAW_RECORD_BLOCK, sizeof(block));
+    slot = (char*)out_file_reserve(&dev->file, sizeof(block));
+    memcpy(slot, &block, sizeof(block));
+    *qpc = slot + offsetof(raw_block_t, qpc);
+    raw_write_record(&dev->file, RAW_RECORD_SAMPLES, length);
+    return (signed short*)out_file_reserve(&dev->file, sizeof(signed short) * length);
+}
+
+/* Describe the recording at the start of a raw file. */
+static int write_raw_header(device_t* dev, DWORD start_time_low, DWORD start_time_high)
+{
+    raw_header_t header;
+    int i;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, RAW_MAGIC, sizeof(header.magic));
+    header.version = RAW_VERSION;
+    header.header_size = sizeof(raw_header_t);
+    header.no_channels = dev->no_channels;
+    header.card_id = dev->card_id;
+    header.sample_rate = dev->session->recorder.config.sample_rate;
+    header.timebase = U1902_TIMEBASE;
+    header.scan_intrv = dev->scan_intrv;
+    header.samp_intrv = dev->card->samp_intrv;
+    header.start_time_low = start_time_low;
+    header.start_time_high = start_time_high;
+    for (i = 0; i < dev->no_channels; i++) {
+        header.channel_id[i] = dev->channel[i].id;
+        header.ad_range[i] = dev->channel[i].AdRange;
+    }
+    header.start_qpc = dev->start_qpc.QuadPart;
+    header.qpc_frequency = qpc_frequency.QuadPart;
+    return raw_write_header(&dev->file, &header);
+}
+
+/* Convert a raw file to the csv file file_name. */
+static void convert_raw_file(char* raw_name)
+{
+    FILE* raw;
+    raw_header_t header;
+    raw_record_t record;
+    device_t* dev = &session.device[0];
+    signed short* buffer;
+    size_t length;
+    size_t chunk;
+    char* packed = NULL;            /* A compressed record. */
+    size_t packed_size = 0;
+    signed short* unpacked = NULL;  /* Its samples. */
+    U32 unpacked_size = 0;
+    raw_compressed_t info;
+    raw_index_t index;
+    const raw_index_entry_t* entry;
+    int samples;
+    int err;
+
+    raw = open_raw_file(raw_name, &header);
+    if (compress_codec == COMPRESS_NONE && aggregate_period == 0) {
+        /* Plain csv is converted in parallel. */
+        process_raw_parallel(raw, raw_name, &header);
+        return;
+    }
+
+    /* Go straight to the block holding the start of the range. */
+    if (range_start >= 0.0) {
+        if (load_index(raw, raw_name, &header, &index) < 0) {
+            fclose(raw);
+            exit(1);
+        }
+        entry = raw_index_find(&index, range_first);
+        if (_fseeki64(raw, entry != NULL ? entry->offset : header.header_size, SEEK_SET) != 0) {
+            perror("fseek error: ");
+            fclose(raw);
+            exit(1);
+        }
+        if (entry != NULL) {
+            dev->scans_written = entry->first_scan;
+        }
+        raw_index_free(&index);
+    }
+    output_format = FORMAT_CSV;
+    print_averages = 0;
+    if (build_luts(dev) < 0 || setup_power(dev) < 0) {
+        fclose(raw);
+        exit(1);
+    }
+
+    /* Convert whole scans at a time. */
+    chunk = DEFAULT_AI_COUNT - DEFAULT_AI_COUNT % dev->no_channels;
+    buffer = (signed short*)malloc(sizeof(signed short) * chunk);
+    dev->csv_buffer = (char*)malloc(csv_buffer_size(dev, chunk));
+    if (buffer == NULL || dev->csv_buffer == NULL) {
+        fprintf(stderr, "Failed to allocate the conversion buffers.\n");
+        fclose(raw);
+        exit(1);
+    }
+
+    if (out_file_open(&dev->file, dev->file_name,
+                      file_backend == OUT_FILE_MAPPED ? OUT_FILE_STDIO : file_backend,
+                      0, 0) < 0) {
+        fclose(raw);
+        exit(1);
+    }
+    if (start_compressor(dev, csv_buffer_size(dev, chunk)) < 0) {
+        fclose(raw);
+        exit(1);
+    }
+    printf("Converting '%s' from card %d with %d channels at %d Hz to '%s'...\n",
+           raw_name, header.card_id, dev->no_channels, header.sample_rate, dev->file_name);
+    if (timestamps) {
+        write_time_header(dev);
+    }
+    if (start_aggregate(dev) < 0) {
+        fclose(raw);
+        exit(1);
+    }
+    while (dev->scans_written < range_end && (err = raw_read_record(raw, &record)) == 0) {
+        if (record.type == RAW_RECORD_INDEX) {
+            break;
+        }
+        if (record.type == RAW_RECORD_GAP) {
+            if (dev->scans_written >= range_first) {
+                process_gap(dev, record.count);
+            } else {
+                dev->scans_written += record.count;
+            }
+            continue;
+        }
+        if (record.type == RAW_RECORD_BLOCK) {
+            raw_block_t block;
+            if (record.count != sizeof(block) || fread(&block, sizeof(block), 1, raw) != 1) {
+                fprintf(stderr, "The file '%s' is truncated.\n", raw_name);
+                break;
+            }
+            dev->scans_written = block.first_scan;
+            continue;
+        }
+        if (record.type == RAW_RECORD_CHUNK) {
+            raw_chunk_t part;
+            if (record.count != sizeof(part) || fread(&part, sizeof(part), 1, raw) != 1) {
+                fprintf(stderr, "The file '%s' is truncated.\n", raw_name);
+                break;
+            }
+            /* A later file of a rotated recording continues its time. */
+            printf("File %d of the recording, from scan %.0f.\n",
+                   part.chunk, (double)part.first_scan);
+            dev->scans_written = part.first_scan;
+            continue;
+        }
+        if (record.type == RAW_RECORD_MARK) {
+            char data[sizeof(raw_mark_t) + MARKER_MAX_LABEL];
+            marker_t marker;
+            U32 kept = record.count < sizeof(data) ? record.count : sizeof(data);
+            if (fread(data, 1, kept, raw) != kept || read_marker(data, kept, &marker) < 0 ||
+                fseek(raw, record.count - kept, SEEK_CUR) != 0) {
+                fprintf(stderr, "The file '%s' is truncated.\n", raw_name);
+                break;
+            }
+            if (marker.scan >= range_first && marker.scan < range_end) {
+                process_marker(dev, &marker);
+            }
+            continue;
+        }
+        if (record.type == RAW_RECORD_TIME) {
+            /* The transfer times are not needed for the csv. */
+            if (fseek(raw, record.count, SEEK_CUR) != 0) {
+                fprintf(stderr, "The file '%s' is truncated.\n", raw_name);
+                break;
+            }
+            continue;
+        }
+        if (record.type == RAW_RECORD_COMPRESSED) {
+            /* Decompress the whole half buffer and convert it in chunks. */
+            if (record.count > packed_size) {
+                packed_size = record.count;
+                free(packed);
+                packed = (char*)malloc(packed_size);
+            }
+            if (packed == NULL || record.count < sizeof(info) ||
+                fread(packed, 1, record.count, raw) != record.count) {
+                fprintf(stderr, "The file '%s' is truncated.\n", raw_name);
+                break;
+            }
+            memcpy(&info, packed, sizeof(info));
+            if (info.samples > unpacked_size) {
+                unpacked_size = info.samples;
+                free(unpacked);
+                unpacked = (signed short*)malloc(sizeof(signed short) * unpacked_size);
+                if (unpacked == NULL) {
+                    fprintf(stderr, "Failed to allocate the conversion buffers.\n");
+                    break;
+                }
+            }
+            samples = compressor_decompress_samples(packed, record.count, unpacked,
+                                                    unpacked_size, dev->no_channels);
+            if (samples < 0) {
+                break;
+            }
+            for (length = 0; length < (size_t)samples; length += chunk) {
+                convert_samples(dev, unpacked + length,
+                                (int)((size_t)samples - length < chunk ?
+                                      (size_t)samples - length : chunk));
+            }
+            continue;
+        }
+        while (record.count > 0) {
+            length = record.count < chunk ? record.count : chunk;
+            length = fread(buffer, sizeof(signed short), length, raw);
+            if (length == 0) {
+                break;
+            }
+            record.count -= (U32)length;
+            /* A truncated file may end in a partial scan. */
+            length -= length % dev->no_channels;
+            convert_samples(dev, buffer, (int)length);
+        }
+        if (record.count > 0) {
+            fprintf(stderr, "The file '%s' is truncated.\n", raw_name);
+            break;
+        }
+    }
+    if (ferror(raw)) {
+        perror("fread error: ");
+    }
+    free(buffer);
+    free(packed);
+    free(unpacked);
+    fclose(raw);
+    if (aggregate_period > 0) {
+        aggregate_flush(&dev->aggregate, write_window, dev);
+        out_file_close(&dev->aggregate_file);
+    }
+    if (compress_codec != COMPRESS_NONE) {
+        compressor_finish(&dev->compressor);
+    }
+    out_file_close(&dev->file);
+    print_energy(dev);
+}
+
+/* Convert the part of length samples that is in the '-range', if any. */
+static void convert_samples(device_t* dev, signed short* buffer, int length)
+{
+    int skip = range_clip(dev, &length);
+
+    if (length > 0) {
+        process_samples(dev, buffer + skip, length);
+    }
+}
+
+/* Clip length samples from scan dev->scans_written to the '-range'. Returns
+ * the samples to skip and sets *length to the samples to keep after them.
+ * dev->scans_written moves to the first scan kept, or past all of them if
+ * none is.
+ */
+static int range_clip(device_t* dev, int* length)
+{
+    unsigned __int64 first = dev->scans_written;
+    unsigned __int64 end = first + *length / dev->no_channels;
+    int skip = 0;
+
+    if (end <= range_first || first >= range_end) {
+        dev->scans_written = end;
+        *length = 0;
+        return 0;
+    }
+    if (first < range_first) {
+        skip = (int)(range_first - first) * dev->no_channels;
+        first = range_first;
+        dev->scans_written = first;
+    }
+    if (end > range_end) {
+        end = range_end;
+    }
+    *length = (int)(end - first) * dev->no_channels;
+    return skip;
+}
+
+/* Open a raw file, read its header and set up the first card and the
+ * '-range' from it.
+ */
+static FILE* open_raw_file(char* raw_name, raw_header_t* header)
+{
+    FILE* raw;
+    device_t* dev = &session.device[0];
+    int i;
+
+    raw = fopen(raw_name, "rb");
+    if (raw == NULL) {
+        perror("fopen error: ");
+        exit(1);
+    }
+    if (raw_read_header(raw, header) < 0) {
+        fclose(raw);
+        exit(1);
+    }
+
+    /* The recording's channel setup replaces any given on the command line. */
+    dev->card_id = header->card_id;
+    dev->no_channels = header->no_channels;
+    for (i = 0; i < dev->no_channels; i++) {
+        dev->channel[i].id = header->channel_id[i];
+        dev->channel[i].AdRange = header->ad_range[i];
+    }
+    dev->scan_intrv = header->scan_intrv;
+    dev->file_name = file_name;
+    dev->start_qpc.QuadPart = header->start_qpc;
+    qpc_frequency.QuadPart = header->qpc_frequency;
+    if (range_start >= 0.0) {
+        range_first = (unsigned __int64)(range_start * U1902_TIMEBASE / dev->scan_intrv);
+        range_end = range_first +
+                    (unsigned __int64)(range_length * U1902_TIMEBASE / dev->scan_intrv);
+    }
+    return raw;
+}
+
+/* Read the index of the raw file, or build it if the file has none.
+ * Returns 0 on success and -1 on failure.
+ */
+static int load_index(FILE* raw, char* raw_name, const raw_header_t* header, raw_index_t* index)
+{
+    int err = raw_index_read(raw, index);
+
+    if (err == 1) {
+        printf("'%s' has no index; scanning it.\n", raw_name);
+        err = _fseeki64(raw, header->header_size, SEEK_SET) != 0 ? -1 :
+              raw_index_scan(raw, header, index);
+    }
+    return err;
+}
+
+/* Convert the raw file to csv, or with '-stats' summarize it, with a thread
+ * per processor or '-j' threads. Each takes a piece of the blocks at a time;
+ * the csv of the pieces is written in order.
+ */
+static void process_raw_parallel(FILE* raw, char* raw_name, const raw_header_t* header)
+{
+    device_t* dev = &session.device[0];
+    convert_worker_t* worker;
+    convert_job_t job;
+    raw_index_t index;
+    const raw_index_entry_t* entry;
+    char text[128];
+    DWORD written;
+    marker_t* marker = NULL;        /* '-stats': the markers of all pieces. */
+    U32 no_markers = 0;
+    int threads = no_workers > 0 ? no_workers : convert_pool_processors();
+    int err = 0;
+    int i;
+    int p;
+
+    if (load_index(raw, raw_name, header, &index) < 0) {
+        fclose(raw);
+        exit(1);
+    }
+    fclose(raw);
+    if (index.truncated) {
+        fprintf(stderr, "The file '%s' is truncated; its damaged end is skipped.\n", raw_name);
+    }
+    output_format = FORMAT_CSV;
+    print_averages = 0;
+    if (build_luts(dev) < 0 || setup_power(dev) < 0) {
+        exit(1);
+    }
+
+    if (threads > CONVERT_MAX_WORKERS) {
+        threads = CONVERT_MAX_WORKERS;
+    }
+    worker = (convert_worker_t*)calloc(threads, sizeof(convert_worker_t));
+    if (worker == NULL) {
+        fprintf(stderr, "Failed to allocate the conversion buffers.\n");
+        exit(1);
+    }
+    for (i = 0; i < threads; i++) {
+        worker[i].dev = *dev;
+        if (summary_file_name != NULL && err == 0) {
+            err = stream_stats_init(&worker[i].totals, dev->no_channels);
+        }
+    }
+    if (summary_file_name != NULL && err == 0) {
+        err = stream_stats_init(&dev->totals, dev->no_channels);
+    }
+    if (err < 0) {
+        exit(1);
+    }
+
+    /* The blocks that hold scans of the range. */
+    memset(&job, 0, sizeof(job));
+    job.raw_name = raw_name;
+    job.index = &index;
+    job.first = 0;
+    job.end = index.no_entries;
+    if (range_start >= 0.0) {
+        entry = raw_index_find(&index, range_first);
+        job.first = entry != NULL ? (U32)(entry - index.entry) : 0;
+        entry = raw_index_find(&index, range_end - 1);
+        job.end = entry != NULL ? (U32)(entry - index.entry) + 1 : 0;
+    }
+    job.start = header->header_size;
+    job.no_workers = threads;
+    job.output = INVALID_HANDLE_VALUE;
+    job.process = convert_piece;
+    job.arg = worker;
+
+    if (summary_file_name == NULL) {
+        /* The pieces are written at their offsets, not through an out_file_t. */
+        job.output = CreateFileA(dev->file_name, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                                 FILE_ATTRIBUTE_NORMAL, NULL);
+        if (job.output == INVALID_HANDLE_VALUE) {
+            fprintf(stderr, "CreateFile error %d for '%s'.\n", GetLastError(), dev->file_name);
+            exit(1);
+        }
+        if (timestamps) {
+            job.output_offset = format_time_header(dev, text);
+            if (!WriteFile(job.output, text, (DWORD)job.output_offset, &written, NULL)) {
+                fprintf(stderr, "WriteFile error %d for '%s'.\n", GetLastError(), dev->file_name);
+                exit(1);
+            }
+        }
+        printf("Converting '%s' from card %d with %d channels at %d Hz to '%s' in %d thread%s...\n",
+               raw_name, header->card_id, dev->no_channels, header->sample_rate,
+               dev->file_name, threads, threads == 1 ? "" : "s");
+    }
+    err = convert_pool_run(&job);
+
+    /* Each worker has the totals and markers of its own pieces. */
+    for (i = 0; i < threads; i++) {
+        no_markers += worker[i].no_markers;
+    }
+    if (no_markers > 0) {
+        marker = (marker_t*)malloc(sizeof(marker_t) * no_markers);
+        if (marker == NULL) {
+            fprintf(stderr, "Failed to allocate the conversion buffers.\n");
+            exit(1);
+        }
+        no_markers = 0;
+    }
+    for (i = 0; i < threads; i++) {
+        if (worker[i].no_markers > 0) {
+            memcpy(marker + no_markers, worker[i].marker,
+                   sizeof(marker_t) * worker[i].no_markers);
+            no_markers += worker[i].no_markers;
+        }
+        free(worker[i].marker);
+        stream_stats_merge(&dev->totals, &worker[i].totals);
+        stream_stats_free(&worker[i].totals);
+        for (p = 0; p < dev->no_pairs; p++) {
+            dev->pair[p].energy += worker[i].dev.pair[p].energy;
+        }
+        dev->gaps_written += worker[i].dev.gaps_written;
+        if (worker[i].dev.scans_written > dev->scans_written) {
+            dev->scans_written = worker[i].dev.scans_written;
+        }
+        free(worker[i].text);
+        free(worker[i].unpacked);
+    }
+    free(worker);
+    raw_index_free(&index);
+    if (job.output != INVALID_HANDLE_VALUE) {
+        CloseHandle(job.output);
+    }
+    if (err < 0) {
+        exit(1);
+    }
+    if (summary_file_name != NULL) {
+        marker_sort(marker, no_markers);
+        print_summary(raw_name, header, marker, no_markers);
+    }
+    free(marker);
+    print_energy(dev);
+}
+
+/* The convert_piece_fn of process_raw_parallel(). Handles the records of a
+ * piece like convert_raw_file() does.
+ */
+static int convert_piece(void* arg, int number, const convert_piece_t* piece,
+                         const char* data, size_t size, const char** text, size_t* length)
+{
+    convert_worker_t* worker = (convert_worker_t*)arg + number;
+    device_t* dev = &worker->dev;
+    raw_record_t record;
+    raw_block_t block;
+    raw_chunk_t part;
+    raw_compressed_t info;
+    marker_t marker;
+    size_t pos = 0;
+    size_t used = 0;
+    size_t payload;
+    int samples;
+
+    dev->scans_written = piece->first_scan;
+    while (pos + sizeof(record) <= size && dev->scans_written < range_end) {
+        memcpy(&record, data + pos, sizeof(record));
+        pos += sizeof(record);
+        payload = record.type == RAW_RECORD_SAMPLES ? sizeof(signed short) * record.count :
+                  record.type == RAW_RECORD_GAP ? 0 : record.count;
+        if (payload > size - pos) {
+            fprintf(stderr, "The raw file is truncated at offset %lld.\n",
+                    (__int64)(piece->offset + pos));
+            return -1;
+        }
+        switch (record.type) {
+        case RAW_RECORD_SAMPLES:
+            if (convert_piece_samples(worker, (const signed short*)(data + pos),
+                                      record.count - record.count % dev->no_channels,
+                                      &used) < 0) {
+                return -1;
+            }
+            break;
+        case RAW_RECORD_GAP:
+            if (dev->scans_written >= range_first) {
+                fprintf(stderr, "Gap of about %u scans at %.3f s into the recording.\n",
+                        record.count,
+                        (double)dev->scans_written * dev->scan_intrv / U1902_TIMEBASE);
+                if (summary_file_name == NULL) {
+                    if (reserve_text(worker, used + 64) < 0) {
+                        return -1;
+                    }
+                    used += sprintf(worker->text + used, "# gap: about %u scans lost\n",
+                                    record.count);
+                }
+                dev->gaps_written++;
+            }
+            dev->scans_written += record.count;
+            break;
+        case RAW_RECORD_BLOCK:
+            if (record.count != sizeof(block)) {
+                fprintf(stderr, "Bad block record at offset %lld.\n",
+                        (__int64)(piece->offset + pos));
+                return -1;
+            }
+            memcpy(&block, data + pos, sizeof(block));
+            dev->scans_written = block.first_scan;
+            break;
+        case RAW_RECORD_CHUNK:
+            if (record.count != sizeof(part)) {
+                fprintf(stderr, "Bad chunk record at offset %lld.\n",
+                        (__int64)(piece->offset + pos));
+                return -1;
+            }
+            memcpy(&part, data + pos, sizeof(part));
+            printf("File %d of the recording, from scan %.0f.\n",
+                   part.chunk, (double)part.first_scan);
+            dev->scans_written = part.first_scan;
+            break;
+        case RAW_RECORD_TIME:
+            /* The transfer times are not needed. */
+            break;
+        case RAW_RECORD_MARK:
+            if (read_marker(data + pos, record.count, &marker) < 0) {
+                fprintf(stderr, "Bad mark record at offset %lld.\n",
+                        (__int64)(piece->offset + pos));
+                return -1;
+            }
+            if (marker.scan < range_first || marker.scan >= range_end) {
+                break;
+            }
+            if (summary_file_name != NULL) {
+                if (keep_marker(worker, &marker) < 0) {
+                    return -1;
+                }
+            } else {
+                if (reserve_text(worker, used + MARKER_MAX_LABEL + 64) < 0) {
+                    return -1;
+                }
+                used += format_marker(&marker, worker->text + used);
+            }
+            break;
+        case RAW_RECORD_COMPRESSED:
+            if (record.count < sizeof(info)) {
+                fprintf(stderr, "compressor: Truncated compressed record.\n");
+                return -1;
+            }
+            memcpy(&info, data + pos, sizeof(info));
+            if (info.samples > worker->unpacked_size) {
+                free(worker->unpacked);
+                worker->unpacked_size = info.samples;
+                worker->unpacked = (signed short*)malloc(sizeof(signed short) * info.samples);
+                if (worker->unpacked == NULL) {
+                    fprintf(stderr, "Failed to allocate the conversion buffers.\n");
+                    worker->unpacked_size = 0;
+                    return -1;
+                }
+            }
+            samples = compressor_decompress_samples(data + pos, record.count, worker->unpacked,
+                                                    worker->unpacked_size, dev->no_channels);
+            if (samples < 0 ||
+                convert_piece_samples(worker, worker->unpacked, samples, &used) < 0) {
+                return -1;
+            }
+            break;
+        case RAW_RECORD_INDEX:
+            /* The end of the blocks. */
+            payload = size - pos;
+            break;
+        default:
+            fprintf(stderr, "Unknown record type %d at offset %lld.\n",
+                    record.type, (__int64)(piece->offset + pos));
+            return -1;
+        }
+        pos += payload;
+    }
+    *text = worker->text;
+    *length = used;
+    return 0;
+}
+
+/* Convert or summarize the part of length samples that is in the '-range'.
+ * used is the length of the worker's text so far.
+ */
+static int convert_piece_samples(convert_worker_t* worker, const signed short* buffer,
+                                 int length, size_t* used)
+{
+    device_t* dev = &worker->dev;
+    int skip = range_clip(dev, &length);
+
+    if (length == 0) {
+        return 0;
+    }
+    buffer += skip;
+    if (summary_file_name != NULL) {
+        stream_stats_add(&worker->totals, buffer, length);
+        power_block(dev->pair, dev->no_pairs, buffer, length / dev->no_channels,
+                    dev->no_channels, (double)dev->scan_intrv / U1902_TIMEBASE);
+    } else {
+        if (reserve_text(worker, *used + csv_buffer_size(dev, length)) < 0) {
+            return -1;
+        }
+        *used = format_scans(dev, buffer, length, worker->text + *used) - worker->text;
+    }
+    dev->scans_written += length / dev->no_channels;
+    return 0;
+}
+
+/* Make room for size bytes of text in the worker's buffer. */
+static int reserve_text(convert_worker_t* worker, size_t size)
+{
+    char* text;
+
+    if (size <= worker->text_size) {
+        return 0;
+    }
+    if (size < 2 * worker->text_size) {
+        size = 2 * worker->text_size;
+    }
+    text = (char*)realloc(worker->text, size);
+    if (text == NULL) {
+        fprintf(stderr, "Failed to allocate the conversion buffers.\n");
+        return -1;
+    }
+    worker->text = text;
+    worker->text_size = size;
+    return 0;
+}
+
+/* Keep a marker of the worker's piece for the summary. */
+static int keep_marker(convert_worker_t* worker, const marker_t* marker)
+{
+    marker_t* kept;
+    U32 capacity;
+
+    if (worker->no_markers == worker->marker_capacity) {
+        capacity = worker->marker_capacity > 0 ? 2 * worker->marker_capacity : 16;
+        kept = (marker_t*)realloc(worker->marker, sizeof(marker_t) * capacity);
+        if (kept == NULL) {
+            fprintf(stderr, "Failed to allocate the conversion buffers.\n");
+            return -1;
+        }
+        worker->marker = kept;
+        worker->marker_capacity = capacity;
+    }
+    worker->marker[worker->no_markers++] = *marker;
+    return 0;
+}
+
+/* Print the statistics of each channel of a raw file. */
+static void summarize_raw_file(char* raw_name)
+{
+    raw_header_t header;
+    FILE* raw = open_raw_file(raw_name, &header);
+
+    process_raw_parallel(raw, raw_name, &header);
+}
+
+/* Print the totals and the markers, in scan order, collected by
+ * process_raw_parallel() for '-stats'.
+ */
+static void print_summary(char* raw_name, const raw_header_t* header,
+                          const marker_t* marker, U32 no_markers)
+{
+    device_t* dev = &session.device[0];
+    double scans = (double)dev->totals.channel[0].count;
+    U32 m;
+
+    printf("'%s': card %d, %d channels at %d Hz.\n",
+           raw_name, header->card_id, dev->no_channels, header->sample_rate);
+    printf("  %.0f scans (%.3f s), %u gap markers.\n",
+           scans, scans * dev->scan_intrv / U1902_TIMEBASE, dev->gaps_written);
+    print_totals(dev);
+    for (m = 0; m < no_markers; m++) {
+        printf("  Marker '%s' at scan %.0f, %.6f s into the recording.\n",
+               marker[m].label, (double)marker[m].scan,
+               (double)marker[m].scan * dev->scan_intrv / U1902_TIMEBASE);
+    }
+}
+
+/* Print the statistics of each channel over all the samples written. */
+static void print_totals(device_t* dev)
+{
+    const stream_channel_t* channel;
+    const sample_lut_t* lut;
+    short code[STREAM_QUANTILES];
+    int i;
+
+    for (i = 0; i < dev->totals.no_channels; i++) {
+        channel = &dev->totals.channel[i];
+        lut = dev->channel_lut[i];
+        if (channel->count == 0) {
+            continue;
+        }
+        stream_stats_quantiles(channel, stream_quantile_level, STREAM_QUANTILES, code);
+        printf("  Channel %d: mean %e V, std %e V, min %e V, max %e V.\n",
+               dev->channel[i].id, channel->mean * lut->scale,
+               sqrt(stream_stats_variance(channel)) * lut->scale,
+               LUT_VOLTS(lut, channel->min), LUT_VOLTS(lut, channel->max));
+        printf("    1%% %e V, 25%% %e V, median %e V, 75%% %e V, 99%% %e V.\n",
+               LUT_VOLTS(lut, code[0]), LUT_VOLTS(lut, code[1]), LUT_VOLTS(lut, code[2]),
+               LUT_VOLTS(lut, code[3]), LUT_VOLTS(lut, code[4]));
+    }
+}
+
+/* Rebuild the index of a raw file whose recording ended without writing it. */
+static void recover_raw_file(char* raw_name)
+{
+    raw_index_t index;
+    int result = raw_index_file(raw_name, &index);
+
+    if (result < 0) {
+        exit(1);
+    }
+    if (result == 1) {
+        printf("'%s' already has an index of %d blocks.\n", raw_name, index.no_entries);
+    } else {
+        printf("Indexed %d blocks of '%s'%s.\n", index.no_entries, raw_name,
+               index.truncated ? " after cutting off a damaged end" : "");
+    }
+    raw_index_free(&index);
+}
+
+/* Measure how fast each output format is written, one half buffer after
+ * another through process_samples() on synthetic samples.
+ */
+static void run_benchmark(device_t* dev)
+{
+    static const struct {
+        const char* name;
+        int format;
+        int codec;
+        int aggregate;                  /* ms per window, or 0. */
+    } modes[] = {
+        { "csv",        FORMAT_CSV, COMPRESS_NONE, 0 },
+        { "raw",        FORMAT_RAW, COMPRESS_NONE, 0 },
+        { "csv lz4",    FORMAT_CSV, COMPRESS_LZ4,  0 },
+        { "raw lz4",    FORMAT_RAW, COMPRESS_LZ4,  0 },
+        { "csv zstd",   FORMAT_CSV, COMPRESS_ZSTD, 0 },
+        { "raw zstd",   FORMAT_RAW, COMPRESS_ZSTD, 0 },
+        { "aggregated", FORMAT_CSV, COMPRESS_NONE, 100 }
+    };
+    int saved_format = output_format;
+    int saved_codec = compress_codec;
+    int saved_level = compress_level;
+    int saved_period = aggregate_period;
+    char* saved_aggregate_file_name = aggregate_file_name;
+    int backend = file_backend == OUT_FILE_DIRECT ? OUT_FILE_DIRECT : OUT_FILE_STDIO;
+    double rate = (double)U1902_TIMEBASE / dev->scan_intrv * dev->no_channels;
+    long no_blocks = BENCH_SAMPLES / dev->half_count + 1;
+    signed short* blocks;
+    U32 noise = 12345;
+    double start, elapsed;
+    long n;
+    int m;
+
+    blocks = (signed short*)malloc(sizeof(signed short) * no_blocks * dev->half_count);
+    if (blocks == NULL) {
+        fprintf(stderr, "Failed to allocate the benchmark buffers.\n");
+        exit(1);
+    }
+    daq_sim_init();
+    daq_sim_fill(blocks, no_blocks * dev->half_count, dev->no_channels, 0, &noise);
+    printf("\nSamples/s written to '%s' with %d channels, half buffers of %d samples:\n",
+           BENCH_FILE_NAME, dev->no_channels, dev->half_count);
+    for (m = 0; m < (int)(sizeof(modes)/sizeof(modes[0])); m++) {
+        if (modes[m].codec != COMPRESS_NONE && compressor_name(modes[m].codec) == NULL) {
+            printf("  %-10s  not compiled in\n", modes[m].name);
+            continue;
+        }
+        output_format = modes[m].format;
+        compress_codec = modes[m].codec;
+        compress_level = compress_codec == COMPRESS_LZ4 ? COMPRESS_DEFAULT_LZ4_LEVEL
+                                                        : COMPRESS_DEFAULT_ZSTD_LEVEL;
+        aggregate_period = modes[m].aggregate;
+        aggregate_file_name = NULL;
+        dev->scans_written = 0;
+        if (build_luts(dev) < 0 || setup_power(dev) < 0 ||
+            out_file_open(&dev->file, BENCH_FILE_NAME, backend,
+                          output_format == FORMAT_RAW, 0) < 0 ||
+            start_compressor(dev, output_format == FORMAT_CSV ?
+                                  csv_buffer_size(dev, dev->half_count) :
+                                  sizeof(signed short) * dev->half_count) < 0 ||
+            (output_format == FORMAT_RAW && write_raw_header(dev, 0, 0) < 0) ||
+            start_aggregate(dev) < 0) {
+            clean_exit(1);
+        }
+
+        start = recorder_seconds();
+        n = 0;
+        do {
+            process_samples(dev, blocks + (n % no_blocks) * dev->half_count,
+                            dev->half_count);
+            n++;
+        } while (recorder_seconds() - start < BENCH_TIME);
+        if (aggregate_period > 0) {
+            aggregate_flush(&dev->aggregate, write_window, dev);
+        }
+        if (compress_codec != COMPRESS_NONE) {
+            compressor_finish(&dev->compressor);
+        }
+        out_file_close(&dev->file);
+        elapsed = recorder_seconds() - start;
+        remove(BENCH_FILE_NAME);
+        printf("  %-10s  %12.4e  %8.1fx the selected rate\n", modes[m].name,
+               (double)n * dev->half_count / elapsed,
+               (double)n * dev->half_count / elapsed / rate);
+    }
+    free(blocks);
+
+    output_format = saved_format;
+    compress_codec = saved_codec;
+    compress_level = saved_level;
+    aggregate_period = saved_period;
+    aggregate_file_name = saved_aggregate_file_name;
+    if (build_luts(dev) < 0 || setup_power(dev) < 0) {
+        clean_exit(1);
+    }
+    memset(&dev->file, 0, sizeof(dev->file));
+    printf("\nRecording from simulated cards for %d s to measure the latency...\n", duration);
+}
+
+/* Note how long after the card filled it the half buffer just processed
+ * was written.
+ */
+static void record_latency(device_t* dev)
+{
+    LARGE_INTEGER now;
+    double ready;
+    float* grown;
+
+    QueryPerformanceCounter(&now);
+    if (dev->no_latencies == dev->latency_capacity) {
+        grown = (float*)realloc(dev->latency,
+                                sizeof(float) * (dev->latency_capacity * 2 + 1024));
+        if (grown == NULL) {
+            return;
+        }
+        dev->latency = grown;
+        dev->latency_capacity = dev->latency_capacity * 2 + 1024;
+    }
+    /* The card filled the last scan written at its nominal time. */
+    ready = (double)dev->start_qpc.QuadPart +
+            (double)dev->scans_written * dev->scan_intrv / U1902_TIMEBASE *
+            (double)qpc_frequency.QuadPart;
+    dev->latency[dev->no_latencies++] =
+        (float)(1000.0 * ((double)now.QuadPart - ready) / (double)qpc_frequency.QuadPart);
+}
+
+static void print_latency(device_t* dev)
+{
+    U32 n = dev->no_latencies;
+
+    if (n == 0) {
+        return;
+    }
+    qsort(dev->latency, n, sizeof(float), compare_floats);
+    printf("Half ready to written over %d half buffers: min %.2f ms, median %.2f ms,\n"
+           "90%% %.2f ms, 99%% %.2f ms, max %.2f ms.\n", n,
+           dev->latency[0], dev->latency[n/2], dev->latency[n*9/10],
+           dev->latency[n*99/100], dev->latency[n-1]);
+}
+
+static int compare_floats(const void* a, const void* b)
+{
+    float x = *(const float*)a;
+    float y = *(const float*)b;
+
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+/* Write the instrumentation of all cards to stats_file_name. The counters
+ * are read while the threads update them, so a card's stages may differ by
+ * a half buffer.
+ */
+static void write_stats(void)
+{
+    FILE* f;
+    device_t* dev;
+    int d;
+
+    f = fopen(stats_file_name, "w");
+    if (f == NULL) {
+        fprintf(stderr, "Failed to open the statistics file '%s'.\n", stats_file_name);
+        return;
+    }
+    fprintf(f, "{\n  \"seconds\": %.3f,\n  \"cards\": [\n",
+            recorder_seconds() - session.recorder.t1);
+    for (d = 0; d < session.recorder.no_cards; d++) {
+        dev = &session.device[d];
+        fprintf(f, "    {\n");
+        fprintf(f, "      \"card\": %d,\n", dev->card_id);
+        fprintf(f, "      \"half_count\": %d,\n", dev->half_count);
+        fprintf(f, "      \"half_period_ms\": %.4f,\n",
+                1000.0 * (dev->half_count / dev->no_channels) * dev->scan_intrv / U1902_TIMEBASE);
+        fprintf(f, "      \"ring_depth\": %d,\n", session.recorder.config.ring_depth);
+        fprintf(f, "      \"ring_high_water\": %d,\n", (int)dev->card->ring.high_water);
+        fprintf(f, "      \"overruns\": %u,\n", dev->card->overruns);
+        fprintf(f, "      \"overrun_scans\": %.0f,\n", (double)dev->card->overrun_scans);
+        fprintf(f, "      \"dropped_blocks\": %u,\n", dev->card->dropped_blocks);
+        fprintf(f, "      \"dropped_scans\": %.0f,\n", (double)dev->card->dropped_scans);
+        fprintf(f, "      \"gaps\": %u,\n", dev->gaps_written);
+        instrument_print_json(f, &dev->card->stats, "      ");
+        fprintf(f, "    }%s\n", d + 1 < session.recorder.no_cards ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    if (fclose(f) != 0) {
+        fprintf(stderr, "Failed to write the statistics file '%s'.\n", stats_file_name);
+        return;
+    }
+    printf("Wrote the statistics to '%s'.\n", stats_file_name);
+}
+
+/* Compare the per buffer statistics kernel with the per sample conversion
+ * loop process_samples() used before, on one half buffer of synthetic data.
+ */
+static void run_kernel_benchmark(void)
+{
+    static signed short buffer[DEFAULT_AI_COUNT/2];
+    static const int counts[] = { 1, 2, 3, 4, 8 };
+    const double min_time = 0.5; /* Seconds per measurement. */
+    volatile double sink = 0.0;
+    int i, j, n;
+
+    for (i = 0; i < DEFAULT_AI_COUNT/2; i++) {
+        buffer[i] = (signed short)((i * 7919) & 0xFFFF);
+    }
+    printf("Samples/s per half buffer of %d samples (kernel: %s):\n",
+           DEFAULT_AI_COUNT/2, kernel_isa());
+    printf("  channels   per sample loop      kernel   speedup\n");
+    for (j = 0; j < (int)(sizeof(counts)/sizeof(counts[0])); j++) {
+        double toVolts[MAX_CHANNELS];
+        double sum[MAX_CHANNELS];
+        double rate_loop, rate_kernel;
+        double start, elapsed;
+        long reps;
+        block_stats_t stats;
+
+        n = counts[j];
+        for (i = 0; i < n; i++) {
+            toVolts[i] = ad_range_to_volt(AD_B_10_V)/(double)(1<<15);
+        }
+
+        start = recorder_seconds();
+        reps = 0;
+        do {
+            for (i = 0; i < n; i++) {
+                sum[i] = 0.0;
+            }
+            for (i = 0; i < DEFAULT_AI_COUNT/2; i++) {
+                int c = (i + 1) % n;
+                sum[c] += (double)buffer[i] * toVolts[c];
+            }
+            sink += sum[0];
+            reps++;
+            elapsed = recorder_seconds() - start;
+        } while (elapsed < min_time);
+        rate_loop = (double)reps * (DEFAULT_AI_COUNT/2) / elapsed;
+
+        start = recorder_seconds();
+        reps = 0;
+        do {
+            kernel_block_stats(buffer, DEFAULT_AI_COUNT/2, n, 1, &stats);
+            sink += (double)stats.sum[0] * toVolts[0];
+            reps++;
+            elapsed = recorder_seconds() - start;
+        } while (elapsed < min_time);
+        rate_kernel = (double)reps * (DEFAULT_AI_COUNT/2) / elapsed;
+
+        printf("  %8d   %15.4e   %9.4e   %6.1fx\n",
+               n, rate_loop, rate_kernel, rate_kernel / rate_loop);
+    }
+}
+
+
+void clean_exit(int code)
 {
-    UD_Release_Card(card);
-    if (file) fclose(file);
+    session_close(&session);
+    telemetry_close(&telemetry);
+    sample_lut_free_all();
     exit(code);
 }
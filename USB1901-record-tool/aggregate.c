@@ -0,0 +1,112 @@
+/*
+ * Windows command line utility to record analog input samples in differential
+ * mode from a USB-1901 DAQ in double buffered mode.
+ *
+ * Copyright (C) 2014, 2016  Anders Gidenstam, Chalmers University of Technology
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*----------------------------------------------------------------------------*/
+/* Windowed aggregation of samples.                                           */
+/*----------------------------------------------------------------------------*/
+
+#include "aggregate.h"
+
+static void aggregate_reset(aggregate_t* aggregate, unsigned __int64 first_scan)
+{
+    int c;
+
+    aggregate->scans = 0;
+    aggregate->first_scan = first_scan;
+    for (c = 0; c < aggregate->no_channels; c++) {
+        aggregate->sum[c] = 0;
+        aggregate->sum_squares[c] = 0;
+        aggregate->min[c] = 32767;
+        aggregate->max[c] = -32768;
+    }
+    for (c = 0; c < aggregate->no_pairs; c++) {
+        aggregate->power_sum[c] = 0.0;
+    }
+}
+
+void aggregate_init(aggregate_t* aggregate, int no_channels, unsigned int window)
+{
+    aggregate->no_channels = no_channels;
+    aggregate->window = window;
+    aggregate->no_pairs = 0;
+    aggregate->pairs = NULL;
+    aggregate_reset(aggregate, 0);
+}
+
+void aggregate_set_pairs(aggregate_t* aggregate, const power_pair_t* pairs, int no_pairs)
+{
+    aggregate->pairs = pairs;
+    aggregate->no_pairs = no_pairs;
+    aggregate_reset(aggregate, aggregate->first_scan);
+}
+
+void aggregate_add(aggregate_t* aggregate, const signed short* buffer, int length,
+                   unsigned __int64 first_scan, aggregate_emit_t emit, void* arg)
+{
+    int no_channels = aggregate->no_channels;
+    unsigned int scans = length / no_channels;
+    unsigned int done = 0;
+    unsigned int n;
+    unsigned int s;
+    int c;
+    int p;
+    int x;
+
+    if (aggregate->scans > 0 &&
+        aggregate->first_scan + aggregate->scans != first_scan) {
+        aggregate_flush(aggregate, emit, arg);
+    }
+    while (done < scans) {
+        if (aggregate->scans == 0) {
+            aggregate_reset(aggregate, first_scan + done);
+        }
+        /* The part of the buffer that belongs to the current window. */
+        n = aggregate->window - aggregate->scans;
+        if (n > scans - done) {
+            n = scans - done;
+        }
+        for (s = 0; s < n; s++) {
+            for (p = 0; p < aggregate->no_pairs; p++) {
+                aggregate->power_sum[p] += POWER_AT(&aggregate->pairs[p], buffer);
+            }
+            for (c = 0; c < no_channels; c++) {
+                x = *buffer++;
+                aggregate->sum[c] += x;
+                aggregate->sum_squares[c] += (unsigned int)(x * x);
+                if (x < aggregate->min[c]) aggregate->min[c] = (short)x;
+                if (x > aggregate->max[c]) aggregate->max[c] = (short)x;
+            }
+        }
+        aggregate->scans += n;
+        done += n;
+        if (aggregate->scans == aggregate->window) {
+            emit(arg, aggregate);
+            aggregate->scans = 0;
+        }
+    }
+}
+
+void aggregate_flush(aggregate_t* aggregate, aggregate_emit_t emit, void* arg)
+{
+    if (aggregate->scans > 0) {
+        emit(arg, aggregate);
+        aggregate->scans = 0;
+    }
+}
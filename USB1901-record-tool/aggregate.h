@@ -0,0 +1,68 @@
+/*
+ * Windows command line utility to record analog input samples in differential
+ * mode from a USB-1901 DAQ in double buffered mode.
+ *
+ * Copyright (C) 2014, 2016  Anders Gidenstam, Chalmers University of Technology
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*----------------------------------------------------------------------------*/
+/* Windowed aggregation of samples.                                           */
+/*                                                                            */
+/* An aggregate_t accumulates the sum, sum of squares, min and max of each    */
+/* channel over windows of a fixed number of scans. Windows may span any      */
+/* number of buffers; nothing is allocated and every sample is visited once.  */
+/*----------------------------------------------------------------------------*/
+
+#ifndef AGGREGATE_H
+#define AGGREGATE_H
+
+#include "power.h"
+
+#define AGGREGATE_MAX_CHANNELS  8
+
+typedef struct {
+    int no_channels;
+    unsigned int window;                /* Scans per window. */
+    unsigned int scans;                 /* Scans in the current window. */
+    unsigned __int64 first_scan;        /* Index of its first scan. */
+    __int64 sum[AGGREGATE_MAX_CHANNELS];
+    unsigned __int64 sum_squares[AGGREGATE_MAX_CHANNELS];
+    short min[AGGREGATE_MAX_CHANNELS];
+    short max[AGGREGATE_MAX_CHANNELS];
+    int no_pairs;                       /* Power pairs to average, if any. */
+    const power_pair_t* pairs;
+    double power_sum[POWER_MAX_PAIRS];
+} aggregate_t;
+
+/* Called with every completed, or flushed partial, window. */
+typedef void (*aggregate_emit_t)(void* arg, const aggregate_t* aggregate);
+
+void aggregate_init(aggregate_t* aggregate, int no_channels, unsigned int window);
+
+/* Also sum the power of the no_pairs pairs, which must stay valid. */
+void aggregate_set_pairs(aggregate_t* aggregate, const power_pair_t* pairs, int no_pairs);
+
+/* Add length interleaved samples of whole scans, the first of which has
+ * index first_scan. A partial window is flushed first if first_scan does
+ * not continue it.
+ */
+void aggregate_add(aggregate_t* aggregate, const signed short* buffer, int length,
+                   unsigned __int64 first_scan, aggregate_emit_t emit, void* arg);
+
+/* Emit the current window if it holds any scans and start a new one. */
+void aggregate_flush(aggregate_t* aggregate, aggregate_emit_t emit, void* arg);
+
+#endif
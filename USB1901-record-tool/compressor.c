@@ -0,0 +1,533 @@
+/*
+ * Windows command line utility to record analog input samples in differential
+ * mode from a USB-1901 DAQ in double buffered mode.
+ *
+ * Copyright (C) 2014, 2016  Anders Gidenstam, Chalmers University of Technology
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*----------------------------------------------------------------------------*/
+/* Streaming compression of the output.                                       */
+/*----------------------------------------------------------------------------*/
+
+#include <process.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "compressor.h"
+
+#ifdef USE_LZ4
+#include <lz4.h>
+#include <lz4hc.h>
+#include <lz4frame.h>
+#endif
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
+
+/* Internal functions. */
+static unsigned __stdcall compressor_thread(void* arg);
+static int begin_frame(compressor_t* c);
+static int compress_frame(compressor_t* c, const char* data, size_t length);
+static int end_frame(compressor_t* c);
+static int compress_samples(compressor_t* c, signed short* samples, size_t length);
+static size_t compress_block(compressor_t* c, const char* data, size_t length,
+                             char* out, size_t out_size);
+static size_t decompress_block(int codec, const char* data, size_t length,
+                               char* out, size_t out_size);
+static void delta_encode(signed short* samples, size_t length, int stride);
+static void delta_decode(signed short* samples, size_t length, int stride);
+
+const char* compressor_name(int codec)
+{
+    switch (codec) {
+#ifdef USE_LZ4
+    case COMPRESS_LZ4:
+        return "lz4";
+#endif
+#ifdef USE_ZSTD
+    case COMPRESS_ZSTD:
+        return "zstd";
+#endif
+    default:
+        return NULL;
+    }
+}
+
+int compressor_init(compressor_t* c, out_file_t* file, int codec, int level,
+                    int framing, int no_channels, size_t chunk_size)
+{
+    int i;
+
+    memset(c, 0, sizeof(compressor_t));
+    c->codec = codec;
+    c->level = level;
+    c->framing = framing;
+    c->no_channels = no_channels;
+    c->file = file;
+    c->chunk_size = chunk_size;
+    if (compressor_name(codec) == NULL) {
+        fprintf(stderr, "compressor_init: Codec %d is not compiled in.\n", codec);
+        return -1;
+    }
+
+    /* Room for the worst case compression of a chunk plus framing. */
+    switch (codec) {
+#ifdef USE_LZ4
+    case COMPRESS_LZ4:
+        c->output_size = LZ4_compressBound((int)chunk_size) + LZ4F_HEADER_SIZE_MAX +
+                         sizeof(raw_record_t) + sizeof(raw_compressed_t);
+        if (framing == COMPRESS_FRAME) {
+            LZ4F_preferences_t preferences;
+
+            memset(&preferences, 0, sizeof(preferences));
+            preferences.compressionLevel = level;
+            c->output_size = LZ4F_compressBound(chunk_size, &preferences) + LZ4F_HEADER_SIZE_MAX;
+        }
+        break;
+#endif
+#ifdef USE_ZSTD
+    case COMPRESS_ZSTD:
+        c->output_size = ZSTD_compressBound(chunk_size) + ZSTD_CStreamOutSize() +
+                         sizeof(raw_record_t) + sizeof(raw_compressed_t);
+        break;
+#endif
+    }
+    c->output = (char*)malloc(c->output_size);
+    c->free_chunks = CreateSemaphore(NULL, COMPRESS_QUEUE_DEPTH, COMPRESS_QUEUE_DEPTH, NULL);
+    c->full_chunks = CreateSemaphore(NULL, 0, COMPRESS_QUEUE_DEPTH, NULL);
+    for (i = 0; i < COMPRESS_QUEUE_DEPTH; i++) {
+        c->chunk[i] = (char*)malloc(chunk_size);
+        if (c->chunk[i] == NULL) {
+            break;
+        }
+    }
+    if (c->output == NULL || c->free_chunks == NULL || c->full_chunks == NULL ||
+        i < COMPRESS_QUEUE_DEPTH) {
+        fprintf(stderr, "compressor_init: Failed to allocate the buffers.\n");
+        return -1;
+    }
+    if (begin_frame(c) < 0) {
+        return -1;
+    }
+    c->thread = (HANDLE)_beginthreadex(NULL, 0, compressor_thread, c, 0, NULL);
+    if (c->thread == NULL) {
+        fprintf(stderr, "compressor_init: _beginthreadex failed.\n");
+        return -1;
+    }
+    return 0;
+}
+
+char* compressor_acquire(compressor_t* c)
+{
+    WaitForSingleObject(c->free_chunks, INFINITE);
+    return c->chunk[c->head];
+}
+
+void compressor_submit(compressor_t* c, int kind, size_t length)
+{
+    c->kind[c->head] = kind;
+    c->length[c->head] = length;
+    c->head = (c->head + 1) % COMPRESS_QUEUE_DEPTH;
+    ReleaseSemaphore(c->full_chunks, 1, NULL);
+}
+
+int compressor_write(compressor_t* c, const void* data, size_t length)
+{
+    const char* p = (const char*)data;
+    size_t n;
+
+    while (length > 0) {
+        n = length < c->chunk_size ? length : c->chunk_size;
+        memcpy(compressor_acquire(c), p, n);
+        compressor_submit(c, COMPRESS_CHUNK_DATA, n);
+        p += n;
+        length -= n;
+    }
+    return c->error ? -1 : 0;
+}
+
+int compressor_write_block(compressor_t* c, const raw_block_t* block)
+{
+    char* chunk = compressor_acquire(c);
+    raw_record_t record;
+
+    record.type = RAW_RECORD_BLOCK;
+    record.reserved = 0;
+    record.count = sizeof(raw_block_t);
+    memcpy(chunk, &record, sizeof(record));
+    memcpy(chunk + sizeof(record), block, sizeof(raw_block_t));
+    compressor_submit(c, COMPRESS_CHUNK_BLOCK, sizeof(record) + sizeof(raw_block_t));
+    return c->error ? -1 : 0;
+}
+
+int compressor_finish(compressor_t* c)
+{
+    int i;
+
+    if (c->thread != NULL) {
+        compressor_acquire(c);
+        compressor_submit(c, COMPRESS_CHUNK_END, 0);
+        WaitForSingleObject(c->thread, INFINITE);
+        CloseHandle(c->thread);
+        c->thread = NULL;
+        if (!c->error && end_frame(c) < 0) {
+            c->error = 1;
+        }
+    }
+    for (i = 0; i < COMPRESS_QUEUE_DEPTH; i++) {
+        free(c->chunk[i]);
+        c->chunk[i] = NULL;
+    }
+    free(c->output);
+    c->output = NULL;
+    if (c->free_chunks != NULL) CloseHandle(c->free_chunks);
+    if (c->full_chunks != NULL) CloseHandle(c->full_chunks);
+    c->free_chunks = NULL;
+    c->full_chunks = NULL;
+    return c->error ? -1 : 0;
+}
+
+static unsigned __stdcall compressor_thread(void* arg)
+{
+    compressor_t* c = (compressor_t*)arg;
+    int kind;
+    size_t length;
+    char* chunk;
+
+    for (;;) {
+        WaitForSingleObject(c->full_chunks, INFINITE);
+        chunk = c->chunk[c->tail];
+        kind = c->kind[c->tail];
+        length = c->length[c->tail];
+        if (kind == COMPRESS_CHUNK_END) {
+            break;
+        }
+        /* After a failure the chunks are only drained. */
+        if (!c->error) {
+            c->bytes_in += length;
+            if (kind == COMPRESS_CHUNK_SAMPLES) {
+                if (compress_samples(c, (signed short*)chunk,
+                                     length / sizeof(signed short)) < 0) {
+                    c->error = 1;
+                }
+            } else if (c->framing == COMPRESS_FRAME) {
+                if (compress_frame(c, chunk, length) < 0) {
+                    c->error = 1;
+                }
+            } else {
+                if (kind == COMPRESS_CHUNK_BLOCK && c->index != NULL) {
+                    /* A failure leaves the index incomplete, not the file. */
+                    raw_index_add(c->index, out_file_tell(c->file),
+                                  (const raw_block_t*)(chunk + sizeof(raw_record_t)));
+                }
+                c->bytes_out += length;
+                if (out_file_write(c->file, chunk, length) < 0) {
+                    c->error = 1;
+                }
+            }
+        }
+        c->tail = (c->tail + 1) % COMPRESS_QUEUE_DEPTH;
+        ReleaseSemaphore(c->free_chunks, 1, NULL);
+    }
+    return 0;
+}
+
+/* Create the codec context and, for COMPRESS_FRAME, write the frame header. */
+static int begin_frame(compressor_t* c)
+{
+    switch (c->codec) {
+#ifdef USE_LZ4
+    case COMPRESS_LZ4:
+        if (c->framing == COMPRESS_FRAME) {
+            LZ4F_preferences_t preferences;
+            LZ4F_compressionContext_t context;
+            size_t n;
+
+            if (LZ4F_isError(LZ4F_createCompressionContext(&context, LZ4F_VERSION))) {
+                fprintf(stderr, "compressor_init: Failed to create the LZ4 context.\n");
+                return -1;
+            }
+            c->context = context;
+            memset(&preferences, 0, sizeof(preferences));
+            preferences.compressionLevel = c->level;
+            n = LZ4F_compressBegin(context, c->output, c->output_size, &preferences);
+            if (LZ4F_isError(n)) {
+                fprintf(stderr, "compressor_init: %s\n", LZ4F_getErrorName(n));
+                return -1;
+            }
+            c->bytes_out += n;
+            return out_file_write(c->file, c->output, n);
+        }
+        return 0;
+#endif
+#ifdef USE_ZSTD
+    case COMPRESS_ZSTD:
+        c->context = ZSTD_createCCtx();
+        if (c->context == NULL) {
+            fprintf(stderr, "compressor_init: Failed to create the zstd context.\n");
+            return -1;
+        }
+        ZSTD_CCtx_setParameter((ZSTD_CCtx*)c->context, ZSTD_c_compressionLevel, c->level);
+        return 0;
+#endif
+    }
+    return -1;
+}
+
+/* Append length bytes to the frame. */
+static int compress_frame(compressor_t* c, const char* data, size_t length)
+{
+    switch (c->codec) {
+#ifdef USE_LZ4
+    case COMPRESS_LZ4: {
+        size_t n = LZ4F_compressUpdate((LZ4F_compressionContext_t)c->context,
+                                       c->output, c->output_size, data, length, NULL);
+        if (LZ4F_isError(n)) {
+            fprintf(stderr, "compressor: %s\n", LZ4F_getErrorName(n));
+            return -1;
+        }
+        c->bytes_out += n;
+        return n > 0 ? out_file_write(c->file, c->output, n) : 0;
+    }
+#endif
+#ifdef USE_ZSTD
+    case COMPRESS_ZSTD: {
+        ZSTD_inBuffer in;
+        ZSTD_outBuffer out;
+        size_t left;
+
+        in.src = data;
+        in.size = length;
+        in.pos = 0;
+        while (in.pos < in.size) {
+            out.dst = c->output;
+            out.size = c->output_size;
+            out.pos = 0;
+            left = ZSTD_compressStream2((ZSTD_CCtx*)c->context, &out, &in, ZSTD_e_continue);
+            if (ZSTD_isError(left)) {
+                fprintf(stderr, "compressor: %s\n", ZSTD_getErrorName(left));
+                return -1;
+            }
+            c->bytes_out += out.pos;
+            if (out.pos > 0 && out_file_write(c->file, c->output, out.pos) < 0) {
+                return -1;
+            }
+        }
+        return 0;
+    }
+#endif
+    }
+    return -1;
+}
+
+/* Flush and end the frame and free the codec context. */
+static int end_frame(compressor_t* c)
+{
+    int result = 0;
+
+    switch (c->codec) {
+#ifdef USE_LZ4
+    case COMPRESS_LZ4:
+        if (c->context != NULL) {
+            size_t n = LZ4F_compressEnd((LZ4F_compressionContext_t)c->context,
+                                        c->output, c->output_size, NULL);
+            if (LZ4F_isError(n)) {
+                fprintf(stderr, "compressor: %s\n", LZ4F_getErrorName(n));
+                result = -1;
+            } else {
+                c->bytes_out += n;
+                result = out_file_write(c->file, c->output, n);
+            }
+            LZ4F_freeCompressionContext((LZ4F_compressionContext_t)c->context);
+        }
+        break;
+#endif
+#ifdef USE_ZSTD
+    case COMPRESS_ZSTD:
+        if (c->framing == COMPRESS_FRAME) {
+            ZSTD_inBuffer in;
+            ZSTD_outBuffer out;
+            size_t left;
+
+            in.src = NULL;
+            in.size = 0;
+            in.pos = 0;
+            do {
+                out.dst = c->output;
+                out.size = c->output_size;
+                out.pos = 0;
+                left = ZSTD_compressStream2((ZSTD_CCtx*)c->context, &out, &in, ZSTD_e_end);
+                if (ZSTD_isError(left)) {
+                    fprintf(stderr, "compressor: %s\n", ZSTD_getErrorName(left));
+                    result = -1;
+                    break;
+                }
+                c->bytes_out += out.pos;
+                if (out_file_write(c->file, c->output, out.pos) < 0) {
+                    result = -1;
+                    break;
+                }
+            } while (left > 0);
+        }
+        ZSTD_freeCCtx((ZSTD_CCtx*)c->context);
+        break;
+#endif
+    }
+    c->context = NULL;
+    return result;
+}
+
+/* Delta encode and compress the samples of a half buffer into a
+ * RAW_RECORD_COMPRESSED record.
+ */
+static int compress_samples(compressor_t* c, signed short* samples, size_t length)
+{
+    const size_t header_size = sizeof(raw_record_t) + sizeof(raw_compressed_t);
+    raw_record_t* record = (raw_record_t*)c->output;
+    raw_compressed_t* info = (raw_compressed_t*)(c->output + sizeof(raw_record_t));
+    size_t n;
+
+    delta_encode(samples, length, c->no_channels);
+    n = compress_block(c, (const char*)samples, length * sizeof(signed short),
+                       c->output + header_size, c->output_size - header_size);
+    if (n == 0) {
+        return -1;
+    }
+    record->type = RAW_RECORD_COMPRESSED;
+    record->reserved = 0;
+    record->count = (U32)(sizeof(raw_compressed_t) + n);
+    info->codec = (U16)c->codec;
+    info->filter = RAW_FILTER_DELTA;
+    info->samples = (U32)length;
+    c->bytes_out += header_size + n;
+    return out_file_write(c->file, c->output, header_size + n);
+}
+
+/* Compress a block on its own. Returns the compressed size or 0 on failure. */
+static size_t compress_block(compressor_t* c, const char* data, size_t length,
+                             char* out, size_t out_size)
+{
+    switch (c->codec) {
+#ifdef USE_LZ4
+    case COMPRESS_LZ4: {
+        int n;
+
+        if (c->level > 1) {
+            n = LZ4_compress_HC(data, out, (int)length, (int)out_size, c->level);
+        } else {
+            n = LZ4_compress_default(data, out, (int)length, (int)out_size);
+        }
+        if (n <= 0) {
+            fprintf(stderr, "compressor: LZ4 compression failed.\n");
+            return 0;
+        }
+        return n;
+    }
+#endif
+#ifdef USE_ZSTD
+    case COMPRESS_ZSTD: {
+        size_t n = ZSTD_compressCCtx((ZSTD_CCtx*)c->context, out, out_size,
+                                     data, length, c->level);
+        if (ZSTD_isError(n)) {
+            fprintf(stderr, "compressor: %s\n", ZSTD_getErrorName(n));
+            return 0;
+        }
+        return n;
+    }
+#endif
+    }
+    return 0;
+}
+
+int compressor_decompress_samples(const char* record, size_t size,
+                                  signed short* samples, U32 capacity,
+                                  int no_channels)
+{
+    raw_compressed_t info;
+
+    if (size < sizeof(raw_compressed_t)) {
+        fprintf(stderr, "compressor: Truncated compressed record.\n");
+        return -1;
+    }
+    memcpy(&info, record, sizeof(info));
+    if (info.samples > capacity) {
+        fprintf(stderr, "compressor: Compressed record too large.\n");
+        return -1;
+    }
+    if (compressor_name(info.codec) == NULL) {
+        fprintf(stderr, "compressor: Codec %d is not compiled in.\n", info.codec);
+        return -1;
+    }
+    if (decompress_block(info.codec, record + sizeof(raw_compressed_t),
+                         size - sizeof(raw_compressed_t), (char*)samples,
+                         info.samples * sizeof(signed short)) !=
+        info.samples * sizeof(signed short)) {
+        fprintf(stderr, "compressor: Corrupt compressed record.\n");
+        return -1;
+    }
+    if (info.filter == RAW_FILTER_DELTA) {
+        delta_decode(samples, info.samples, no_channels);
+    }
+    return (int)info.samples;
+}
+
+/* Decompress a block compressed by compress_block(). Returns the
+ * decompressed size or 0 on failure.
+ */
+static size_t decompress_block(int codec, const char* data, size_t length,
+                               char* out, size_t out_size)
+{
+    switch (codec) {
+#ifdef USE_LZ4
+    case COMPRESS_LZ4: {
+        int n = LZ4_decompress_safe(data, out, (int)length, (int)out_size);
+        return n < 0 ? 0 : (size_t)n;
+    }
+#endif
+#ifdef USE_ZSTD
+    case COMPRESS_ZSTD: {
+        size_t n = ZSTD_decompress(out, out_size, data, length);
+        return ZSTD_isError(n) ? 0 : n;
+    }
+#endif
+    }
+    return 0;
+}
+
+/* Replace each sample with its difference from the sample stride earlier,
+ * working backwards so that every difference uses the original value.
+ * The arithmetic wraps, which delta_decode() undoes exactly.
+ */
+static void delta_encode(signed short* samples, size_t length, int stride)
+{
+    size_t i;
+
+    for (i = length; i > (size_t)stride; i--) {
+        samples[i - 1] = (signed short)((unsigned short)samples[i - 1] -
+                                        (unsigned short)samples[i - 1 - stride]);
+    }
+}
+
+static void delta_decode(signed short* samples, size_t length, int stride)
+{
+    size_t i;
+
+    for (i = stride; i < length; i++) {
+        samples[i] = (signed short)((unsigned short)samples[i] +
+                                    (unsigned short)samples[i - stride]);
+    }
+}
@@ -0,0 +1,130 @@
+/*
+ * Windows command line utility to record analog input samples in differential
+ * mode from a USB-1901 DAQ in double buffered mode.
+ *
+ * Copyright (C) 2014, 2016  Anders Gidenstam, Chalmers University of Technology
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*----------------------------------------------------------------------------*/
+/* Streaming compression of the output.                                       */
+/*                                                                            */
+/* A compressor_t owns a thread that compresses whole chunks, typically half  */
+/* buffers, handed over by the writer thread through a small queue, and       */
+/* writes the result to an out_file_t. csv output becomes a standard LZ4 or   */
+/* zstd frame that the lz4 and zstd tools can decompress. Raw output keeps    */
+/* its records; the samples of each half buffer are delta encoded per channel */
+/* and stored as a RAW_RECORD_COMPRESSED record.                              */
+/*                                                                            */
+/* The codecs are only available if the program is built with USE_LZ4 and/or */
+/* USE_ZSTD defined and linked with the corresponding library.                */
+/*----------------------------------------------------------------------------*/
+
+#ifndef COMPRESSOR_H
+#define COMPRESSOR_H
+
+#include <windows.h>
+
+#include "out_file.h"
+#include "raw_format.h"
+#include "raw_index.h"
+
+/* Codecs. */
+#define COMPRESS_NONE           0
+#define COMPRESS_LZ4            1
+#define COMPRESS_ZSTD           2
+
+#define COMPRESS_DEFAULT_LZ4_LEVEL  1   /* LZ4_compress_default(); > 1 is LZ4 HC. */
+#define COMPRESS_DEFAULT_ZSTD_LEVEL 3
+
+/* Output framing. */
+#define COMPRESS_FRAME          0   /* Everything goes into one LZ4 or zstd frame. */
+#define COMPRESS_RECORDS        1   /* Raw records; only samples are compressed. */
+
+/* Chunk kinds. */
+#define COMPRESS_CHUNK_DATA     0   /* Compressed into the frame or, for
+                                       COMPRESS_RECORDS, written as it is. */
+#define COMPRESS_CHUNK_SAMPLES  1   /* COMPRESS_RECORDS only: samples to store
+                                       as a RAW_RECORD_COMPRESSED record. */
+#define COMPRESS_CHUNK_BLOCK    2   /* COMPRESS_RECORDS only: a RAW_RECORD_BLOCK
+                                       record, written as it is and added to
+                                       the index. */
+#define COMPRESS_CHUNK_END      3   /* Internal. */
+
+#define COMPRESS_QUEUE_DEPTH    4   /* Chunks between writer and compressor. */
+
+typedef struct {
+    int codec;
+    int level;
+    int framing;
+    int no_channels;                    /* Delta encoding stride. */
+    out_file_t* file;
+    raw_index_t* index;                 /* If not NULL, receives the blocks as
+                                           they are written. */
+    size_t chunk_size;                  /* Capacity of each chunk in bytes. */
+    char* chunk[COMPRESS_QUEUE_DEPTH];
+    size_t length[COMPRESS_QUEUE_DEPTH];
+    int kind[COMPRESS_QUEUE_DEPTH];
+    int head;                           /* Next chunk to fill. Writer only. */
+    int tail;                           /* Next chunk to compress. Compressor only. */
+    HANDLE free_chunks;                 /* Semaphore counting empty chunks. */
+    HANDLE full_chunks;                 /* Semaphore counting filled chunks. */
+    HANDLE thread;
+    char* output;                       /* Compressed data. */
+    size_t output_size;
+    void* context;                      /* Codec state. */
+    volatile LONG error;                /* Set after a failure. */
+    unsigned __int64 bytes_in;          /* Bytes before compression. */
+    unsigned __int64 bytes_out;         /* Bytes after compression. */
+} compressor_t;
+
+/* Start a compressor writing to file, which must stay open until
+ * compressor_finish(). Returns 0 on success and -1 on failure, after
+ * printing the reason.
+ */
+int compressor_init(compressor_t* c, out_file_t* file, int codec, int level,
+                    int framing, int no_channels, size_t chunk_size);
+
+/* compressor_acquire() waits for and returns an empty chunk of chunk_size
+ * bytes; compressor_submit() queues it with length bytes of the given kind.
+ * compressor_write() queues a copy of data as COMPRESS_CHUNK_DATA.
+ * Return -1 after a failure.
+ */
+char* compressor_acquire(compressor_t* c);
+void compressor_submit(compressor_t* c, int kind, size_t length);
+int compressor_write(compressor_t* c, const void* data, size_t length);
+
+/* Queue the RAW_RECORD_BLOCK record of block as COMPRESS_CHUNK_BLOCK.
+ * Returns -1 after a failure.
+ */
+int compressor_write_block(compressor_t* c, const raw_block_t* block);
+
+/* Compress everything queued, end the frame and stop the thread.
+ * Returns 0 on success and -1 on failure.
+ */
+int compressor_finish(compressor_t* c);
+
+/* Decompress the size bytes of a RAW_RECORD_COMPRESSED record into samples,
+ * which has room for capacity samples, and undo the filter.
+ * Returns the number of samples or -1 on failure, after printing the reason.
+ */
+int compressor_decompress_samples(const char* record, size_t size,
+                                  signed short* samples, U32 capacity,
+                                  int no_channels);
+
+/* Name of a codec, or NULL if it is unknown or not compiled in. */
+const char* compressor_name(int codec);
+
+#endif
@@ -0,0 +1,332 @@
+/*
+ * Windows command line utility to record analog input samples in differential
+ * mode from a USB-1901 DAQ in double buffered mode.
+ *
+ * Copyright (C) 2014, 2016  Anders Gidenstam, Chalmers University of Technology
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*----------------------------------------------------------------------------*/
+/* Parallel processing of recorded raw files.                                 */
+/*----------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <process.h>
+
+#include "convert_pool.h"
+
+#define MAX_WRITE_SIZE      (1 << 30)   /* Bytes per WriteFile() call. */
+
+/* State shared by the workers of a run. */
+typedef struct {
+    convert_job_t* job;
+    HANDLE mapping;                     /* Read only mapping of the raw file. */
+    DWORD granularity;                  /* Alignment of the mapped views. */
+    convert_piece_t* piece;
+    U32 no_pieces;
+    volatile LONG next_piece;           /* The next piece to take. */
+    volatile LONG error;                /* Set after a failure. */
+    CRITICAL_SECTION lock;              /* Protects the rest. */
+    size_t* text_length;                /* Of each finished piece. */
+    char* done;                         /* Set for each finished piece. */
+    unsigned __int64* text_offset;      /* Known for the pieces up to ready. */
+    U32 ready;                          /* Pieces finished before the first
+                                           unfinished one. */
+    HANDLE wake[CONVERT_MAX_WORKERS];   /* Signalled when the offset a worker */
+    LONG waiting[CONVERT_MAX_WORKERS];  /* waits for, the one of this piece,
+                                           is known; else -1. */
+} pool_t;
+
+typedef struct {
+    pool_t* pool;
+    int number;
+} worker_t;
+
+/* Internal functions. */
+static int split_pieces(pool_t* pool);
+static unsigned __stdcall pool_worker(void* arg);
+static int process_piece(pool_t* pool, int worker, const convert_piece_t* piece,
+                         const char** text, size_t* length);
+static unsigned __int64 finish_piece(pool_t* pool, int worker, U32 number, size_t length);
+static int write_text(pool_t* pool, unsigned __int64 offset, const char* text, size_t length);
+
+int convert_pool_run(convert_job_t* job)
+{
+    pool_t pool;
+    worker_t worker[CONVERT_MAX_WORKERS];
+    HANDLE thread[CONVERT_MAX_WORKERS];
+    HANDLE file;
+    SYSTEM_INFO info;
+    int no_workers = job->no_workers;
+    int started = 0;
+    int i;
+
+    memset(&pool, 0, sizeof(pool));
+    pool.job = job;
+    if (split_pieces(&pool) < 0) {
+        return -1;
+    }
+    pool.text_length = (size_t*)malloc(sizeof(size_t) * pool.no_pieces);
+    pool.done = (char*)calloc(pool.no_pieces, 1);
+    pool.text_offset = (unsigned __int64*)malloc(sizeof(unsigned __int64) * (pool.no_pieces + 1));
+    if (pool.text_length == NULL || pool.done == NULL || pool.text_offset == NULL) {
+        fprintf(stderr, "convert_pool_run: Out of memory.\n");
+        free(pool.piece);
+        free(pool.text_length);
+        free(pool.done);
+        free(pool.text_offset);
+        return -1;
+    }
+    pool.text_offset[0] = job->output_offset;
+    GetSystemInfo(&info);
+    pool.granularity = info.dwAllocationGranularity;
+
+    file = CreateFileA(job->raw_name, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                       FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        fprintf(stderr, "convert_pool_run: CreateFile error %d for '%s'.\n",
+                GetLastError(), job->raw_name);
+        pool.error = 1;
+    } else {
+        pool.mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (pool.mapping == NULL) {
+            fprintf(stderr, "convert_pool_run: CreateFileMapping error %d.\n", GetLastError());
+            pool.error = 1;
+        }
+    }
+
+    /* No more workers than pieces. */
+    if (no_workers > CONVERT_MAX_WORKERS) {
+        no_workers = CONVERT_MAX_WORKERS;
+    }
+    if ((U32)no_workers > pool.no_pieces) {
+        no_workers = (int)pool.no_pieces;
+    }
+    InitializeCriticalSection(&pool.lock);
+    for (i = 0; i < no_workers && !pool.error; i++) {
+        worker[i].pool = &pool;
+        worker[i].number = i;
+        pool.waiting[i] = -1;
+        pool.wake[i] = CreateEvent(NULL, FALSE, FALSE, NULL);
+        thread[i] = pool.wake[i] == NULL ? NULL :
+                    (HANDLE)_beginthreadex(NULL, 0, pool_worker, &worker[i], 0, NULL);
+        if (thread[i] == NULL) {
+            fprintf(stderr, "convert_pool_run: Failed to start worker %d.\n", i);
+            if (pool.wake[i] != NULL) {
+                CloseHandle(pool.wake[i]);
+            }
+            /* The workers already started stop after their current piece. */
+            InterlockedExchange(&pool.error, 1);
+            break;
+        }
+        started++;
+    }
+    for (i = 0; i < started; i++) {
+        WaitForSingleObject(thread[i], INFINITE);
+        CloseHandle(thread[i]);
+        CloseHandle(pool.wake[i]);
+    }
+    DeleteCriticalSection(&pool.lock);
+
+    if (!pool.error) {
+        job->output_offset = pool.text_offset[pool.no_pieces];
+    }
+    if (pool.mapping != NULL) {
+        CloseHandle(pool.mapping);
+    }
+    if (file != INVALID_HANDLE_VALUE) {
+        CloseHandle(file);
+    }
+    free(pool.piece);
+    free(pool.text_length);
+    free(pool.done);
+    free(pool.text_offset);
+    return pool.error ? -1 : 0;
+}
+
+int convert_pool_processors(void)
+{
+    SYSTEM_INFO info;
+
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+}
+
+/* Group the blocks of the job into pieces of at least CONVERT_PIECE_SIZE
+ * bytes, the last one excepted.
+ */
+static int split_pieces(pool_t* pool)
+{
+    const convert_job_t* job = pool->job;
+    const raw_index_t* index = job->index;
+    convert_piece_t* piece;
+    unsigned __int64 end;
+    U32 i;
+
+    pool->piece = (convert_piece_t*)malloc(sizeof(convert_piece_t) *
+                                           (job->end - job->first + 1));
+    if (pool->piece == NULL) {
+        fprintf(stderr, "convert_pool_run: Out of memory.\n");
+        return -1;
+    }
+    piece = &pool->piece[0];
+    piece->number = 0;
+    if (job->first == 0 || job->first >= index->no_entries) {
+        piece->offset = job->start;
+        piece->first_scan = 0;
+    } else {
+        piece->offset = index->entry[job->first].offset;
+        piece->first_scan = index->entry[job->first].first_scan;
+    }
+    for (i = job->first + 1; i < job->end; i++) {
+        if (index->entry[i].offset - piece->offset >= CONVERT_PIECE_SIZE) {
+            piece->end = index->entry[i].offset;
+            piece++;
+            piece->number = (U32)(piece - pool->piece);
+            piece->offset = index->entry[i].offset;
+            piece->first_scan = index->entry[i].first_scan;
+        }
+    }
+    end = job->end < index->no_entries ? index->entry[job->end].offset : index->end;
+    piece->end = end > piece->offset ? end : piece->offset;
+    pool->no_pieces = (U32)(piece - pool->piece) + 1;
+    return 0;
+}
+
+/* Take pieces in order until there are none left or something failed. */
+static unsigned __stdcall pool_worker(void* arg)
+{
+    worker_t* worker = (worker_t*)arg;
+    pool_t* pool = worker->pool;
+    const char* text;
+    size_t length;
+    unsigned __int64 offset;
+    LONG number;
+    int result;
+
+    while (!pool->error) {
+        number = InterlockedIncrement(&pool->next_piece) - 1;
+        if ((U32)number >= pool->no_pieces) {
+            break;
+        }
+        text = NULL;
+        length = 0;
+        result = process_piece(pool, worker->number, &pool->piece[number], &text, &length);
+        if (result < 0) {
+            InterlockedExchange(&pool->error, 1);
+            length = 0;
+        }
+        /* Even a failed piece must be finished, or later ones would wait
+         * for it forever.
+         */
+        offset = finish_piece(pool, worker->number, (U32)number, length);
+        if (result == 0 && length > 0 && !pool->error &&
+            write_text(pool, offset, text, length) < 0) {
+            InterlockedExchange(&pool->error, 1);
+        }
+    }
+    return 0;
+}
+
+/* Map the records of piece and hand them to the job's function. */
+static int process_piece(pool_t* pool, int worker, const convert_piece_t* piece,
+                         const char** text, size_t* length)
+{
+    convert_job_t* job = pool->job;
+    unsigned __int64 start = piece->offset - piece->offset % pool->granularity;
+    const char* view;
+    int result;
+
+    if (piece->end == piece->offset) {
+        return job->process(job->arg, worker, piece, NULL, 0, text, length);
+    }
+    view = (const char*)MapViewOfFile(pool->mapping, FILE_MAP_READ,
+                                      (DWORD)(start >> 32), (DWORD)(start & 0xFFFFFFFF),
+                                      (SIZE_T)(piece->end - start));
+    if (view == NULL) {
+        fprintf(stderr, "convert_pool_run: MapViewOfFile error %d.\n", GetLastError());
+        return -1;
+    }
+    result = job->process(job->arg, worker, piece, view + (piece->offset - start),
+                          (size_t)(piece->end - piece->offset), text, length);
+    UnmapViewOfFile(view);
+    return result;
+}
+
+/* Record that piece number produced length bytes of text and return the
+ * output offset of that text, waiting until the pieces before it are done.
+ */
+static unsigned __int64 finish_piece(pool_t* pool, int worker, U32 number, size_t length)
+{
+    unsigned __int64 offset;
+    int known;
+    int i;
+
+    EnterCriticalSection(&pool->lock);
+    pool->text_length[number] = length;
+    pool->done[number] = 1;
+    while (pool->ready < pool->no_pieces && pool->done[pool->ready]) {
+        pool->text_offset[pool->ready + 1] =
+            pool->text_offset[pool->ready] + pool->text_length[pool->ready];
+        pool->ready++;
+    }
+    for (i = 0; i < CONVERT_MAX_WORKERS; i++) {
+        if (pool->wake[i] != NULL && pool->waiting[i] >= 0 &&
+            (U32)pool->waiting[i] <= pool->ready) {
+            pool->waiting[i] = -1;
+            SetEvent(pool->wake[i]);
+        }
+    }
+    known = number <= pool->ready;
+    if (!known) {
+        pool->waiting[worker] = (LONG)number;
+    }
+    LeaveCriticalSection(&pool->lock);
+
+    if (!known) {
+        /* The event stays signalled if it was set before the wait. */
+        WaitForSingleObject(pool->wake[worker], INFINITE);
+    }
+    EnterCriticalSection(&pool->lock);
+    offset = pool->text_offset[number];
+    LeaveCriticalSection(&pool->lock);
+    return offset;
+}
+
+/* Write length bytes of text at offset of the output. */
+static int write_text(pool_t* pool, unsigned __int64 offset, const char* text, size_t length)
+{
+    OVERLAPPED overlapped;
+    DWORD chunk;
+    DWORD written;
+
+    while (length > 0) {
+        chunk = length < MAX_WRITE_SIZE ? (DWORD)length : MAX_WRITE_SIZE;
+        memset(&overlapped, 0, sizeof(overlapped));
+        overlapped.Offset = (DWORD)(offset & 0xFFFFFFFF);
+        overlapped.OffsetHigh = (DWORD)(offset >> 32);
+        if (!WriteFile(pool->job->output, text, chunk, &written, &overlapped) ||
+            written != chunk) {
+            fprintf(stderr, "convert_pool_run: WriteFile error %d.\n", GetLastError());
+            return -1;
+        }
+        offset += chunk;
+        text += chunk;
+        length -= chunk;
+    }
+    return 0;
+}
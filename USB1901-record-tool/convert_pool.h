@@ -0,0 +1,84 @@
+/*
+ * Windows command line utility to record analog input samples in differential
+ * mode from a USB-1901 DAQ in double buffered mode.
+ *
+ * Copyright (C) 2014, 2016  Anders Gidenstam, Chalmers University of Technology
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*----------------------------------------------------------------------------*/
+/* Parallel processing of recorded raw files.                                 */
+/*                                                                            */
+/* The indexed blocks of a raw file are split into pieces of a few MB that    */
+/* worker threads take in order. Each worker maps its piece of the file and  */
+/* hands the records to a function, which may return text for the output.    */
+/* The text of a piece is written at the file offset following that of the   */
+/* piece before it, as soon as the lengths of all earlier pieces are known,   */
+/* so the output is the same as if the pieces had been processed one by one. */
+/*----------------------------------------------------------------------------*/
+
+#ifndef CONVERT_POOL_H
+#define CONVERT_POOL_H
+
+#include <windows.h>
+
+#include "raw_index.h"
+
+#define CONVERT_MAX_WORKERS 64
+#define CONVERT_PIECE_SIZE  (1024*1024)     /* Min bytes of records per piece. */
+
+typedef struct {
+    U32 number;                         /* Position of the piece, from 0. */
+    unsigned __int64 offset;            /* File offset of its first record */
+    unsigned __int64 end;               /* and after its last. */
+    unsigned __int64 first_scan;        /* Scans recorded before it. */
+} convert_piece_t;
+
+/* Process the size bytes of records of piece at data. worker is the number
+ * of the calling thread, from 0, so that it can keep its own state. If there
+ * is an output, set *text and *length to what to write for the piece; the
+ * text must stay valid until the next call from the same worker. Returns 0
+ * on success and -1 on failure, after printing the reason, which stops the
+ * run.
+ */
+typedef int (*convert_piece_fn)(void* arg, int worker, const convert_piece_t* piece,
+                                const char* data, size_t size,
+                                const char** text, size_t* length);
+
+typedef struct {
+    const char* raw_name;               /* The raw file. */
+    const raw_index_t* index;           /* Its block index. */
+    U32 first;                          /* The entries of the blocks to */
+    U32 end;                            /* process. */
+    unsigned __int64 start;             /* File offset of the first record if
+                                           first is 0, just after the header. */
+    int no_workers;
+    HANDLE output;                      /* Where the text goes, or
+                                           INVALID_HANDLE_VALUE. */
+    unsigned __int64 output_offset;     /* Offset of the text of the first
+                                           piece; after the run, the end. */
+    convert_piece_fn process;
+    void* arg;
+} convert_job_t;
+
+/* Run job with job->no_workers threads. Returns 0 on success and -1 on
+ * failure, after printing the reason.
+ */
+int convert_pool_run(convert_job_t* job);
+
+/* Number of processors, the default number of workers. */
+int convert_pool_processors(void);
+
+#endif
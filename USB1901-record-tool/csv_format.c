@@ -0,0 +1,226 @@
+/*
+ * Windows command line utility to record analog input samples in differential
+ * mode from a USB-1901 DAQ in double buffered mode.
+ *
+ * Copyright (C) 2014, 2016  Anders Gidenstam, Chalmers University of Technology
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*----------------------------------------------------------------------------*/
+/* Fast formatting of sample values as text.                                  */
+/*----------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "csv_format.h"
+
+/* The CRT's printf used 3 exponent digits before Visual Studio 2015. */
+#if defined(_MSC_VER) && _MSC_VER < 1900
+#define EXP_DIGITS  3
+#else
+#define EXP_DIGITS  2
+#endif
+
+/* Values with decimal exponents outside +/-MAX_EXP are left to sprintf. */
+#define MAX_EXP     32
+/* The largest n for which 10^n is exact in a double. */
+#define MAX_EXACT   22
+
+static const char digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+/* pow10_table[MAX_EXP + n] == 10^n for -MAX_EXP <= n <= MAX_EXP + CSV_MAX_PRECISION. */
+static double pow10_table[2*MAX_EXP + CSV_MAX_PRECISION + 1];
+static int pow10_ready = 0;
+
+static void init_pow10_table(void)
+{
+    int i;
+    double p = 1.0;
+
+    for (i = 0; i <= MAX_EXP + CSV_MAX_PRECISION; i++) {
+        pow10_table[MAX_EXP + i] = p;
+        p *= 10.0;
+    }
+    p = 1.0;
+    for (i = 1; i <= MAX_EXP; i++) {
+        p *= 10.0;
+        pow10_table[MAX_EXP - i] = 1.0 / p;
+    }
+    pow10_ready = 1;
+}
+
+/* hi + lo == a * b exactly (Dekker's product). */
+static void two_product(double a, double b, double* hi, double* lo)
+{
+    const double split = 134217729.0; /* 2^27 + 1 */
+    double t, a_hi, a_lo, b_hi, b_lo;
+
+    *hi = a * b;
+    t = split * a;
+    a_hi = t - (t - a);
+    a_lo = a - a_hi;
+    t = split * b;
+    b_hi = t - (t - b);
+    b_lo = b - b_hi;
+    *lo = ((a_hi * b_hi - *hi) + a_hi * b_lo + a_lo * b_hi) + a_lo * b_lo;
+}
+
+/* Non-zero if the sign bit of value is set, also for -0.0. signbit() is C99. */
+static int sign_bit(double value)
+{
+    unsigned __int64 bits;
+
+    memcpy(&bits, &value, sizeof(bits));
+    return (int)(bits >> 63);
+}
+
+/* Round value * 10^n to the nearest integer, ties to even like printf.
+ * Requires 0 <= n <= MAX_EXACT, so that 10^n and thus the result are exact.
+ */
+static unsigned __int64 scale_round(double value, int n)
+{
+    unsigned __int64 mantissa;
+    double hi, lo, rest;
+
+    two_product(value, pow10_table[MAX_EXP + n], &hi, &lo);
+    mantissa = (unsigned __int64)hi;
+    rest = (hi - (double)mantissa - 0.5) + lo;
+    if (rest > 0.0 || (rest == 0.0 && (mantissa & 1))) {
+        mantissa++;
+    }
+    return mantissa;
+}
+
+int format_exp(char* out, double value, int precision)
+{
+    char digits[CSV_MAX_PRECISION + 2];
+    char* p = out;
+    unsigned __int64 mantissa;
+    int exp = 0;
+    int n;
+    int i;
+
+    if (!pow10_ready) {
+        init_pow10_table();
+    }
+
+    if (sign_bit(value)) {
+        *p++ = '-';
+        value = -value;
+    }
+    if (value != 0.0) {
+        /* Find exp such that 10^exp <= value < 10^(exp + 1). */
+        if (!(value >= pow10_table[0] && value < pow10_table[2*MAX_EXP])) {
+            return (int)(p - out) + sprintf(p, "%.*e", precision, value);
+        }
+        exp = (value >= 1.0) ? 0 : -MAX_EXP;
+        while (exp < MAX_EXP && pow10_table[MAX_EXP + exp + 1] <= value) {
+            exp++;
+        }
+        /* Both scalings below must be exact. */
+        if (precision - exp < 0 || precision - exp + 1 > MAX_EXACT) {
+            return (int)(p - out) + sprintf(p, "%.*e", precision, value);
+        }
+
+        /* Scale to precision + 1 significant digits. The table entries for
+         * negative exponents are inexact, so exp may be one too large.
+         */
+        mantissa = scale_round(value, precision - exp);
+        if (mantissa < (unsigned __int64)pow10_table[MAX_EXP + precision]) {
+            exp--;
+            mantissa = scale_round(value, precision - exp);
+        }
+        if (mantissa >= (unsigned __int64)pow10_table[MAX_EXP + precision + 1]) {
+            /* Rounded up to the next power of ten. */
+            mantissa /= 10;
+            exp++;
+        }
+    } else {
+        mantissa = 0;
+    }
+    /* Mantissa digits, most significant first. */
+    n = precision + 1;
+    for (i = n - 1; i > 0; i -= 2) {
+        const char* pair = digit_pairs + 2*(mantissa % 100);
+        digits[i] = pair[1];
+        digits[i - 1] = pair[0];
+        mantissa /= 100;
+    }
+    if (i == 0) {
+        digits[0] = (char)('0' + mantissa % 10);
+    }
+    *p++ = digits[0];
+    if (precision > 0) {
+        *p++ = '.';
+        for (i = 1; i < n; i++) {
+            *p++ = digits[i];
+        }
+    }
+
+    /* Exponent. */
+    *p++ = 'e';
+    if (exp < 0) {
+        *p++ = '-';
+        exp = -exp;
+    } else {
+        *p++ = '+';
+    }
+#if EXP_DIGITS == 3
+    *p++ = (char)('0' + exp / 100);
+#endif
+    *p++ = digit_pairs[2*(exp % 100)];
+    *p++ = digit_pairs[2*(exp % 100) + 1];
+    return (int)(p - out);
+}
+
+int format_seconds(char* out, unsigned __int64 ns)
+{
+    char digits[20];
+    unsigned __int64 seconds = ns / 1000000000;
+    unsigned int fraction = (unsigned int)(ns % 1000000000);
+    char* p = out;
+    int n = 0;
+    int i;
+
+    /* Whole seconds, least significant digit first. */
+    do {
+        digits[n++] = (char)('0' + seconds % 10);
+        seconds /= 10;
+    } while (seconds > 0);
+    while (n > 0) {
+        *p++ = digits[--n];
+    }
+    *p++ = '.';
+    /* Nine fraction digits, two at a time from the right. */
+    p[8] = (char)('0' + fraction % 10);
+    fraction /= 10;
+    for (i = 6; i >= 0; i -= 2) {
+        p[i] = digit_pairs[2*(fraction % 100)];
+        p[i + 1] = digit_pairs[2*(fraction % 100) + 1];
+        fraction /= 100;
+    }
+    return (int)(p - out) + 9;
+}
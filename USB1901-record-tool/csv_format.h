@@ -0,0 +1,53 @@
+/*
+ * Windows command line utility to record analog input samples in differential
+ * mode from a USB-1901 DAQ in double buffered mode.
+ *
+ * Copyright (C) 2014, 2016  Anders Gidenstam, Chalmers University of Technology
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*----------------------------------------------------------------------------*/
+/* Fast formatting of sample values as text.                                  */
+/*                                                                            */
+/* format_exp() produces the same text as printf("%.*e") for any value,      */
+/* without the locale, varargs and FILE locking overhead of the CRT for the   */
+/* common ones. Rounding is exact, and thus identical to printf, when the     */
+/* value is scaled to its digits by a power of ten from 10^0 to 10^22, which  */
+/* a double holds exactly. Other values are left to sprintf.                  */
+/*----------------------------------------------------------------------------*/
+
+#ifndef CSV_FORMAT_H
+#define CSV_FORMAT_H
+
+#define CSV_DEFAULT_PRECISION   6   /* Like "%e". */
+#define CSV_MAX_PRECISION       14
+/* Upper bound on the length of one formatted value and its separator. */
+#define CSV_MAX_FIELD_LENGTH    (CSV_MAX_PRECISION + 12)
+/* Upper bound on the length of a formatted time and its separator. */
+#define CSV_MAX_TIME_LENGTH     32
+
+/* Write value in "%.<precision>e" form to out, which must have room for
+ * CSV_MAX_FIELD_LENGTH characters. No terminating 0 is written.
+ * Returns the number of characters written.
+ */
+int format_exp(char* out, double value, int precision);
+
+/* Write ns nanoseconds as seconds in "%.9f" form to out, which must have room
+ * for CSV_MAX_TIME_LENGTH characters. No terminating 0 is written.
+ * Returns the number of characters written.
+ */
+int format_seconds(char* out, unsigned __int64 ns);
+
+#endif
@@ -0,0 +1,111 @@
+/*
+ * Windows command line utility to record analog input samples in differential
+ * mode from a USB-1901 DAQ in double buffered mode.
+ *
+ * Copyright (C) 2014, 2016  Anders Gidenstam, Chalmers University of Technology
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*----------------------------------------------------------------------------*/
+/* Markers in the sample stream.                                              */
+/*----------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "marker.h"
+
+/* Internal functions. */
+static int compare_markers(const void* a, const void* b);
+
+void marker_queue_reset(marker_queue_t* queue)
+{
+    queue->head = 0;
+    queue->tail = 0;
+}
+
+int marker_push(marker_queue_t* queue, __int64 qpc, const char* label)
+{
+    LONG head = queue->head;
+    LONG tail = queue->tail;
+    marker_t* marker;
+
+    /* Observe the consumer's pop before reusing the slot. */
+    MemoryBarrier();
+    if ((DWORD)(head - tail) >= MARKER_QUEUE_SIZE) {
+        return -1;
+    }
+    marker = &queue->marker[(DWORD)head % MARKER_QUEUE_SIZE];
+    marker->qpc = qpc;
+    marker->scan = 0;
+    strncpy(marker->label, label, MARKER_MAX_LABEL - 1);
+    marker->label[MARKER_MAX_LABEL - 1] = '\0';
+    /* InterlockedExchange is a full barrier: the marker is visible before
+     * the new head.
+     */
+    InterlockedExchange(&queue->head, (LONG)((DWORD)head + 1));
+    return 0;
+}
+
+int marker_room(marker_queue_t* queue)
+{
+    return (DWORD)(queue->head - queue->tail) < MARKER_QUEUE_SIZE;
+}
+
+marker_t* marker_peek(marker_queue_t* queue)
+{
+    LONG tail = queue->tail;
+    LONG head = queue->head;
+
+    /* Observe the marker published before head. */
+    MemoryBarrier();
+    if (head == tail) {
+        return NULL;
+    }
+    return &queue->marker[(DWORD)tail % MARKER_QUEUE_SIZE];
+}
+
+void marker_pop(marker_queue_t* queue)
+{
+    InterlockedExchange(&queue->tail, (LONG)((DWORD)queue->tail + 1));
+}
+
+unsigned __int64 marker_place(__int64 qpc, unsigned __int64 first_scan, DWORD scans,
+                              __int64 block_qpc, double scans_per_tick)
+{
+    double after = (double)(block_qpc - qpc) * scans_per_tick;
+
+    /* The scans acquired after the marker are at the end of the block. */
+    if (after <= 0.0) {
+        return first_scan + scans;
+    }
+    if (after >= (double)scans) {
+        return first_scan;
+    }
+    return first_scan + scans - (unsigned __int64)(after + 0.5);
+}
+
+void marker_sort(marker_t* marker, DWORD count)
+{
+    qsort(marker, count, sizeof(marker_t), compare_markers);
+}
+
+static int compare_markers(const void* a, const void* b)
+{
+    unsigned __int64 x = ((const marker_t*)a)->scan;
+    unsigned __int64 y = ((const marker_t*)b)->scan;
+
+    return x < y ? -1 : x > y ? 1 : 0;
+}
@@ -0,0 +1,80 @@
+/*
+ * Windows command line utility to record analog input samples in differential
+ * mode from a USB-1901 DAQ in double buffered mode.
+ *
+ * Copyright (C) 2014, 2016  Anders Gidenstam, Chalmers University of Technology
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*----------------------------------------------------------------------------*/
+/* Markers in the sample stream.                                              */
+/*                                                                            */
+/* A marker is a label given at a QueryPerformanceCounter() time. It is       */
+/* passed from the thread that receives it to the delivery thread of each     */
+/* card through a single-producer/single-consumer queue; the delivery thread  */
+/* converts the time to the index of the scan acquired then.                  */
+/*----------------------------------------------------------------------------*/
+
+#ifndef MARKER_H
+#define MARKER_H
+
+#include <windows.h>
+
+#define MARKER_QUEUE_SIZE   64  /* Markers waiting for their scan. */
+#define MARKER_MAX_LABEL    64  /* Including the terminating 0. */
+
+typedef struct {
+    __int64 qpc;                        /* QueryPerformanceCounter() when given. */
+    unsigned __int64 scan;              /* Scans, including lost ones, recorded
+                                           before it. Set once placed. */
+    char label[MARKER_MAX_LABEL];
+} marker_t;
+
+typedef struct {
+    marker_t marker[MARKER_QUEUE_SIZE];
+    volatile LONG head;                 /* Markers pushed. Only written by the
+                                           producer. */
+    volatile LONG tail;                 /* Markers popped. Only written by the
+                                           consumer. */
+} marker_queue_t;
+
+/* Empty the queue. Only while neither side uses it. */
+void marker_queue_reset(marker_queue_t* queue);
+
+/* Producer side. Queue a marker with the label, cut to MARKER_MAX_LABEL - 1
+ * characters, given at qpc. Returns 0 on success and -1 if the queue is full.
+ */
+int marker_push(marker_queue_t* queue, __int64 qpc, const char* label);
+
+/* Producer side. Non-zero if marker_push() has room for another marker. */
+int marker_room(marker_queue_t* queue);
+
+/* Consumer side. marker_peek() returns the oldest marker or NULL if the
+ * queue is empty. marker_pop() removes it.
+ */
+marker_t* marker_peek(marker_queue_t* queue);
+void marker_pop(marker_queue_t* queue);
+
+/* The scans recorded before qpc, given a block of scans scans after
+ * first_scan whose last scan was acquired at block_qpc. Kept within the
+ * block.
+ */
+unsigned __int64 marker_place(__int64 qpc, unsigned __int64 first_scan, DWORD scans,
+                              __int64 block_qpc, double scans_per_tick);
+
+/* Sort an array of placed markers by scan. */
+void marker_sort(marker_t* marker, DWORD count);
+
+#endif
@@ -0,0 +1,319 @@
+/*
+ * Windows command line utility to record analog input samples in differential
+ * mode from a USB-1901 DAQ in double buffered mode.
+ *
+ * Copyright (C) 2014, 2016  Anders Gidenstam, Chalmers University of Technology
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*----------------------------------------------------------------------------*/
+/* Network output.                                                            */
+/*----------------------------------------------------------------------------*/
+
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <process.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "net_sink.h"
+
+struct net_sink_s {
+    SOCKET socket;
+    int udp;
+    size_t packet_size;                 /* Capacity of each packet in bytes. */
+    char* packet[NET_QUEUE_DEPTH];
+    size_t length[NET_QUEUE_DEPTH];     /* Bytes in each packet, with header. */
+    int head;                           /* Packet being filled. Writer only. */
+    int tail;                           /* Next packet to send. Sender only. */
+    int filling;                        /* Set while the writer owns packet[head]. */
+    DWORD started;                      /* GetTickCount() when it was taken. */
+    HANDLE free_packets;                /* Semaphore counting empty packets. */
+    HANDLE full_packets;                /* Semaphore counting filled packets,
+                                           plus one to wake the sender to stop. */
+    volatile LONG queued;               /* Packets submitted and not yet sent. */
+    HANDLE thread;
+    U32 sequence;
+    unsigned __int64 offset;            /* Stream offset of the next byte. */
+    volatile LONG error;                /* Set after a failure. */
+    volatile LONG stop;                 /* Set to end the sender. */
+    unsigned __int64 bytes_sent;
+    U32 dropped;                        /* UDP packets the queue had no room for. */
+    U32 refused;                        /* UDP packets the collector refused. */
+};
+
+/* Internal functions. */
+static unsigned __stdcall sender_thread(void* arg);
+static int connect_to(net_sink_t* sink, const char* address);
+static int take_packet(net_sink_t* sink);
+static void submit_packet(net_sink_t* sink);
+static void free_sink(net_sink_t* sink);
+
+int net_sink_address(const char* address)
+{
+    return strncmp(address, "tcp:", 4) == 0 || strncmp(address, "udp:", 4) == 0;
+}
+
+net_sink_t* net_sink_open(const char* address)
+{
+    net_sink_t* sink;
+    WSADATA wsa;
+    int i;
+
+    if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) {
+        fprintf(stderr, "net_sink_open: WSAStartup failed.\n");
+        return NULL;
+    }
+    sink = (net_sink_t*)calloc(1, sizeof(net_sink_t));
+    if (sink == NULL) {
+        fprintf(stderr, "net_sink_open: Out of memory.\n");
+        WSACleanup();
+        return NULL;
+    }
+    sink->socket = INVALID_SOCKET;
+    sink->udp = strncmp(address, "udp:", 4) == 0;
+    sink->packet_size = sink->udp ? NET_UDP_PACKET_SIZE : NET_TCP_PACKET_SIZE;
+    sink->free_packets = CreateSemaphore(NULL, NET_QUEUE_DEPTH, NET_QUEUE_DEPTH, NULL);
+    sink->full_packets = CreateSemaphore(NULL, 0, NET_QUEUE_DEPTH + 1, NULL);
+    for (i = 0; i < NET_QUEUE_DEPTH; i++) {
+        sink->packet[i] = (char*)malloc(sink->packet_size);
+        if (sink->packet[i] == NULL) {
+            break;
+        }
+    }
+    if (sink->free_packets == NULL || sink->full_packets == NULL || i < NET_QUEUE_DEPTH) {
+        fprintf(stderr, "net_sink_open: Failed to allocate the buffers.\n");
+        free_sink(sink);
+        return NULL;
+    }
+    if (connect_to(sink, address) < 0) {
+        free_sink(sink);
+        return NULL;
+    }
+    sink->thread = (HANDLE)_beginthreadex(NULL, 0, sender_thread, sink, 0, NULL);
+    if (sink->thread == NULL) {
+        fprintf(stderr, "net_sink_open: _beginthreadex failed.\n");
+        free_sink(sink);
+        return NULL;
+    }
+    return sink;
+}
+
+int net_sink_write(net_sink_t* sink, const void* data, size_t length)
+{
+    const char* p = (const char*)data;
+    size_t n;
+
+    while (length > 0) {
+        if (!sink->filling && take_packet(sink) < 0) {
+            /* Dropped; the data is accounted for in the stream offset. */
+            n = length < sink->packet_size - sizeof(net_packet_header_t) ?
+                length : sink->packet_size - sizeof(net_packet_header_t);
+            sink->offset += n;
+            sink->sequence++;
+            sink->dropped++;
+            p += n;
+            length -= n;
+            continue;
+        }
+        n = sink->packet_size - sink->length[sink->head];
+        if (n > length) {
+            n = length;
+        }
+        memcpy(sink->packet[sink->head] + sink->length[sink->head], p, n);
+        sink->length[sink->head] += n;
+        sink->offset += n;
+        p += n;
+        length -= n;
+        if (sink->length[sink->head] == sink->packet_size) {
+            submit_packet(sink);
+        }
+    }
+    /* Do not hold back a slow stream for long. */
+    if (sink->filling && GetTickCount() - sink->started >= NET_MAX_DELAY) {
+        submit_packet(sink);
+    }
+    return sink->error ? -1 : 0;
+}
+
+int net_sink_close(net_sink_t* sink, unsigned __int64* bytes_sent, U32* dropped)
+{
+    int result;
+
+    if (sink->filling) {
+        submit_packet(sink);
+    }
+    InterlockedExchange(&sink->stop, 1);
+    ReleaseSemaphore(sink->full_packets, 1, NULL);
+    WaitForSingleObject(sink->thread, INFINITE);
+    CloseHandle(sink->thread);
+    sink->thread = NULL;
+    if (!sink->udp && sink->socket != INVALID_SOCKET) {
+        shutdown(sink->socket, SD_SEND);
+    }
+    *bytes_sent = sink->bytes_sent;
+    *dropped = sink->dropped + sink->refused;
+    result = sink->error ? -1 : 0;
+    free_sink(sink);
+    return result;
+}
+
+/* Start a packet at the head of the queue. A TCP sink waits for one to be
+ * free; a UDP sink returns -1 if there is none.
+ */
+static int take_packet(net_sink_t* sink)
+{
+    net_packet_header_t* header;
+
+    if (WaitForSingleObject(sink->free_packets, sink->udp ? 0 : INFINITE) != WAIT_OBJECT_0) {
+        return -1;
+    }
+    header = (net_packet_header_t*)sink->packet[sink->head];
+    header->magic = NET_PACKET_MAGIC;
+    header->sequence = sink->sequence++;
+    header->offset = sink->offset;
+    header->reserved = 0;
+    sink->length[sink->head] = sizeof(net_packet_header_t);
+    sink->filling = 1;
+    sink->started = GetTickCount();
+    return 0;
+}
+
+static void submit_packet(net_sink_t* sink)
+{
+    net_packet_header_t* header = (net_packet_header_t*)sink->packet[sink->head];
+
+    header->length = (U32)(sink->length[sink->head] - sizeof(net_packet_header_t));
+    sink->filling = 0;
+    sink->head = (sink->head + 1) % NET_QUEUE_DEPTH;
+    InterlockedIncrement(&sink->queued);
+    ReleaseSemaphore(sink->full_packets, 1, NULL);
+}
+
+static unsigned __stdcall sender_thread(void* arg)
+{
+    net_sink_t* sink = (net_sink_t*)arg;
+    const char* p;
+    size_t left;
+    int n;
+
+    for (;;) {
+        WaitForSingleObject(sink->full_packets, INFINITE);
+        /* head == tail both when the queue is empty and when it is full. */
+        if (sink->queued == 0) {
+            if (sink->stop) {
+                break;
+            }
+            continue;
+        }
+        p = sink->packet[sink->tail];
+        left = sink->length[sink->tail];
+        /* After a failure the packets are only drained. */
+        while (left > 0 && !sink->error) {
+            n = send(sink->socket, p, (int)left, 0);
+            if (n == SOCKET_ERROR && sink->udp &&
+                (WSAGetLastError() == WSAECONNRESET || WSAGetLastError() == WSAECONNREFUSED)) {
+                /* An ICMP port unreachable for an earlier packet: the
+                 * collector is not listening yet or restarted. A datagram
+                 * stream just loses the packet.
+                 */
+                sink->refused++;
+                break;
+            }
+            if (n == SOCKET_ERROR) {
+                fprintf(stderr, "net_sink: send error %d.\n", WSAGetLastError());
+                InterlockedExchange(&sink->error, 1);
+                break;
+            }
+            p += n;
+            left -= n;
+            sink->bytes_sent += n;
+        }
+        sink->tail = (sink->tail + 1) % NET_QUEUE_DEPTH;
+        InterlockedDecrement(&sink->queued);
+        ReleaseSemaphore(sink->free_packets, 1, NULL);
+    }
+    return 0;
+}
+
+/* Resolve "<proto>:<host>:<port>" and connect the socket. */
+static int connect_to(net_sink_t* sink, const char* address)
+{
+    char host[256];
+    const char* port;
+    struct addrinfo hints;
+    struct addrinfo* list;
+    struct addrinfo* a;
+    int err;
+
+    port = strrchr(address + 4, ':');
+    if (port == NULL || port - (address + 4) >= (int)sizeof(host) || port == address + 4) {
+        fprintf(stderr, "net_sink_open: Bad address '%s'.\n", address);
+        return -1;
+    }
+    memcpy(host, address + 4, port - (address + 4));
+    host[port - (address + 4)] = 0;
+    port++;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = sink->udp ? SOCK_DGRAM : SOCK_STREAM;
+    hints.ai_protocol = sink->udp ? IPPROTO_UDP : IPPROTO_TCP;
+    err = getaddrinfo(host, port, &hints, &list);
+    if (err != 0) {
+        fprintf(stderr, "net_sink_open: Cannot resolve '%s', error %d.\n", address, err);
+        return -1;
+    }
+    for (a = list; a != NULL; a = a->ai_next) {
+        sink->socket = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (sink->socket == INVALID_SOCKET) {
+            continue;
+        }
+        if (connect(sink->socket, a->ai_addr, (int)a->ai_addrlen) == 0) {
+            break;
+        }
+        closesocket(sink->socket);
+        sink->socket = INVALID_SOCKET;
+    }
+    freeaddrinfo(list);
+    if (sink->socket == INVALID_SOCKET) {
+        fprintf(stderr, "net_sink_open: Cannot connect to '%s', error %d.\n",
+                address, WSAGetLastError());
+        return -1;
+    }
+    if (!sink->udp) {
+        /* Room for a few packets in the kernel as well. */
+        int size = 4 * NET_TCP_PACKET_SIZE;
+        setsockopt(sink->socket, SOL_SOCKET, SO_SNDBUF, (const char*)&size, sizeof(size));
+    }
+    return 0;
+}
+
+static void free_sink(net_sink_t* sink)
+{
+    int i;
+
+    if (sink->socket != INVALID_SOCKET) {
+        closesocket(sink->socket);
+    }
+    for (i = 0; i < NET_QUEUE_DEPTH; i++) {
+        free(sink->packet[i]);
+    }
+    if (sink->free_packets != NULL) CloseHandle(sink->free_packets);
+    if (sink->full_packets != NULL) CloseHandle(sink->full_packets);
+    free(sink);
+    WSACleanup();
+}
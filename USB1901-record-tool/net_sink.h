@@ -0,0 +1,75 @@
+/*
+ * Windows command line utility to record analog input samples in differential
+ * mode from a USB-1901 DAQ in double buffered mode.
+ *
+ * Copyright (C) 2014, 2016  Anders Gidenstam, Chalmers University of Technology
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*----------------------------------------------------------------------------*/
+/* Network output.                                                            */
+/*                                                                            */
+/* A net sink sends the bytes written to it to a remote collector over TCP   */
+/* or UDP. The bytes are batched into large packets, each starting with a    */
+/* net_packet_header_t, and handed to a sender thread through a bounded      */
+/* queue. When the queue is full a TCP sink makes the writer wait, which in   */
+/* turn makes the acquisition thread drop half buffers into gaps rather than */
+/* wait itself; a UDP sink drops the packet and counts it instead. The       */
+/* sequence numbers and stream offsets in the headers show the collector     */
+/* where packets were dropped or lost.                                        */
+/*----------------------------------------------------------------------------*/
+
+#ifndef NET_SINK_H
+#define NET_SINK_H
+
+#include "UsbDask.h"
+
+#define NET_PACKET_MAGIC        0x4E393155  /* "U19N" */
+#define NET_TCP_PACKET_SIZE     (256*1024)  /* Bytes per packet, with header. */
+#define NET_UDP_PACKET_SIZE     65000       /* Less than the largest datagram. */
+#define NET_QUEUE_DEPTH         16          /* Packets between writer and sender. */
+#define NET_MAX_DELAY           200         /* Max ms data waits in a packet
+                                               that is not full. */
+
+typedef struct {
+    U32 magic;                          /* NET_PACKET_MAGIC. */
+    U32 sequence;                       /* Counts all packets, even dropped ones. */
+    unsigned __int64 offset;            /* Stream offset of the first byte. */
+    U32 length;                         /* Bytes after the header. */
+    U32 reserved;
+} net_packet_header_t;
+
+typedef struct net_sink_s net_sink_t;
+
+/* Connect to address, "tcp:<host>:<port>" or "udp:<host>:<port>".
+ * Returns NULL on failure, after printing the reason.
+ */
+net_sink_t* net_sink_open(const char* address);
+
+/* Append length bytes to the stream. Returns 0 on success and -1 after a
+ * send failed.
+ */
+int net_sink_write(net_sink_t* sink, const void* data, size_t length);
+
+/* Send what is left, close the connection and free the sink. Stores the
+ * bytes sent and the packets dropped, counting UDP packets the collector
+ * refused. Returns 0 on success and -1 on failure.
+ */
+int net_sink_close(net_sink_t* sink, unsigned __int64* bytes_sent, U32* dropped);
+
+/* Returns 1 if address names a network sink. */
+int net_sink_address(const char* address);
+
+#endif
@@ -0,0 +1,378 @@
+/*
+ * Windows command line utility to record analog input samples in differential
+ * mode from a USB-1901 DAQ in double buffered mode.
+ *
+ * Copyright (C) 2014, 2016  Anders Gidenstam, Chalmers University of Technology
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*----------------------------------------------------------------------------*/
+/* Output files.                                                              */
+/*----------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "out_file.h"
+
+/* Internal functions. */
+static int direct_open(out_file_t* file, const char* name, unsigned __int64 expected_size);
+static void direct_preallocate(out_file_t* file, unsigned __int64 size);
+static int direct_submit(out_file_t* file, DWORD length);
+static int direct_wait(out_file_t* file, int i);
+static int direct_close(out_file_t* file);
+static void enable_volume_privilege(void);
+static int mapped_open(out_file_t* file, const char* name, unsigned __int64 size);
+static int mapped_close(out_file_t* file);
+
+int out_file_open(out_file_t* file, const char* name, int backend, int binary,
+                  unsigned __int64 expected_size)
+{
+    memset(file, 0, sizeof(out_file_t));
+    file->backend = backend;
+    file->handle = INVALID_HANDLE_VALUE;
+    if (backend == OUT_FILE_DIRECT) {
+        return direct_open(file, name, expected_size);
+    }
+    if (backend == OUT_FILE_MAPPED) {
+        return mapped_open(file, name, expected_size);
+    }
+    if (backend == OUT_FILE_NET) {
+        file->net = net_sink_open(name);
+        return file->net != NULL ? 0 : -1;
+    }
+
+    file->stdio = fopen(name, binary ? "wb" : "w");
+    if (file->stdio == NULL) {
+        perror("fopen error: ");
+        return -1;
+    }
+    /* The CRT default of 4 KB means a write system call every few scans. */
+    file->stdio_buffer = (char*)malloc(OUT_FILE_BUFFER_SIZE);
+    if (file->stdio_buffer != NULL) {
+        setvbuf(file->stdio, file->stdio_buffer, _IOFBF, OUT_FILE_BUFFER_SIZE);
+    }
+    return 0;
+}
+
+int out_file_write(out_file_t* file, const void* data, size_t length)
+{
+    const char* p = (const char*)data;
+    size_t n;
+
+    file->bytes += length;
+    if (file->backend == OUT_FILE_STDIO) {
+        if (fwrite(data, 1, length, file->stdio) != length) {
+            perror("fwrite error: ");
+            return -1;
+        }
+        return 0;
+    }
+    if (file->backend == OUT_FILE_MAPPED) {
+        char* target = (char*)out_file_reserve(file, length);
+        if (target == NULL) {
+            if (!file->error) {
+                fprintf(stderr, "out_file_write: The mapped file is full.\n");
+            }
+            file->error = 1;
+            return -1;
+        }
+        memcpy(target, data, length);
+        return 0;
+    }
+    if (file->backend == OUT_FILE_NET) {
+        return net_sink_write(file->net, data, length);
+    }
+
+    while (length > 0) {
+        n = OUT_FILE_BUFFER_SIZE - file->fill;
+        if (n > length) {
+            n = length;
+        }
+        memcpy(file->buffer[file->current] + file->fill, p, n);
+        file->fill += n;
+        p += n;
+        length -= n;
+        if (file->fill == OUT_FILE_BUFFER_SIZE &&
+            direct_submit(file, OUT_FILE_BUFFER_SIZE) < 0) {
+            return -1;
+        }
+    }
+    return file->error ? -1 : 0;
+}
+
+void* out_file_reserve(out_file_t* file, size_t length)
+{
+    char* target;
+
+    if (length > out_file_space(file)) {
+        return NULL;
+    }
+    target = file->view + file->offset;
+    file->offset += length;
+    return target;
+}
+
+unsigned __int64 out_file_space(const out_file_t* file)
+{
+    return file->size - file->offset;
+}
+
+unsigned __int64 out_file_tell(const out_file_t* file)
+{
+    /* out_file_reserve() places data in the view without counting it. */
+    return file->backend == OUT_FILE_MAPPED ? file->offset : file->bytes;
+}
+
+int out_file_close(out_file_t* file)
+{
+    int result = 0;
+
+    if (file->backend == OUT_FILE_DIRECT) {
+        return direct_close(file);
+    }
+    if (file->backend == OUT_FILE_MAPPED) {
+        return mapped_close(file);
+    }
+    if (file->backend == OUT_FILE_NET) {
+        if (file->net != NULL) {
+            result = net_sink_close(file->net, &file->net_bytes_sent, &file->net_dropped);
+            file->net = NULL;
+        }
+        return result;
+    }
+    if (file->stdio != NULL) {
+        if (fclose(file->stdio) != 0) {
+            perror("fclose error: ");
+            result = -1;
+        }
+        file->stdio = NULL;
+    }
+    free(file->stdio_buffer);
+    file->stdio_buffer = NULL;
+    return result;
+}
+
+static int direct_open(out_file_t* file, const char* name, unsigned __int64 expected_size)
+{
+    int i;
+
+    file->handle = CreateFileA(name, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                               FILE_ATTRIBUTE_NORMAL |
+                               FILE_FLAG_NO_BUFFERING | FILE_FLAG_OVERLAPPED,
+                               NULL);
+    if (file->handle == INVALID_HANDLE_VALUE) {
+        fprintf(stderr, "out_file_open: CreateFile error %d for '%s'.\n",
+                GetLastError(), name);
+        return -1;
+    }
+    for (i = 0; i < OUT_FILE_MAX_IN_FLIGHT; i++) {
+        /* VirtualAlloc() returns page, and thus sector, aligned memory. */
+        file->buffer[i] = (char*)VirtualAlloc(NULL, OUT_FILE_BUFFER_SIZE,
+                                              MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+        file->overlapped[i].hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+        if (file->buffer[i] == NULL || file->overlapped[i].hEvent == NULL) {
+            fprintf(stderr, "out_file_open: Failed to allocate the write buffers.\n");
+            direct_close(file);
+            return -1;
+        }
+    }
+    if (expected_size > 0) {
+        direct_preallocate(file, expected_size);
+    }
+    return 0;
+}
+
+/* Reserve size bytes on the disk so that the file does not have to be
+ * extended, and zero filled, while recording. This is only an optimization,
+ * so failures are ignored. The unused space is cut off by direct_close().
+ */
+static void direct_preallocate(out_file_t* file, unsigned __int64 size)
+{
+    LARGE_INTEGER end;
+
+    size = (size + OUT_FILE_ALIGNMENT - 1) / OUT_FILE_ALIGNMENT * OUT_FILE_ALIGNMENT;
+    end.QuadPart = (LONGLONG)size;
+    if (!SetFilePointerEx(file->handle, end, NULL, FILE_BEGIN) ||
+        !SetEndOfFile(file->handle)) {
+        return;
+    }
+    file->allocated = size;
+    /* Avoids the zero filling too, but requires SE_MANAGE_VOLUME_NAME. */
+    enable_volume_privilege();
+    SetFileValidData(file->handle, (LONGLONG)size);
+}
+
+/* Start writing the current buffer and move on to the next, waiting for
+ * its previous write to complete if necessary.
+ */
+static int direct_submit(out_file_t* file, DWORD length)
+{
+    OVERLAPPED* overlapped = &file->overlapped[file->current];
+
+    overlapped->Offset = (DWORD)(file->offset & 0xFFFFFFFF);
+    overlapped->OffsetHigh = (DWORD)(file->offset >> 32);
+    ResetEvent(overlapped->hEvent);
+    if (!WriteFile(file->handle, file->buffer[file->current], length, NULL, overlapped) &&
+        GetLastError() != ERROR_IO_PENDING) {
+        fprintf(stderr, "out_file_write: WriteFile error %d.\n", GetLastError());
+        file->error = 1;
+        return -1;
+    }
+    file->pending[file->current] = 1;
+    file->offset += length;
+    file->fill = 0;
+    file->current = (file->current + 1) % OUT_FILE_MAX_IN_FLIGHT;
+    if (file->pending[file->current]) {
+        return direct_wait(file, file->current);
+    }
+    return 0;
+}
+
+/* Wait for the write of buffer i to complete. */
+static int direct_wait(out_file_t* file, int i)
+{
+    DWORD written;
+
+    file->pending[i] = 0;
+    if (!GetOverlappedResult(file->handle, &file->overlapped[i], &written, TRUE)) {
+        fprintf(stderr, "out_file_write: Write error %d.\n", GetLastError());
+        file->error = 1;
+        return -1;
+    }
+    return 0;
+}
+
+/* Write out the partial last buffer, padded to whole sectors, and cut the
+ * file to the length actually written.
+ */
+static int direct_close(out_file_t* file)
+{
+    unsigned __int64 size = file->offset + file->fill;
+    LARGE_INTEGER end;
+    size_t padded;
+    int i;
+
+    if (file->handle == INVALID_HANDLE_VALUE) {
+        return 0;
+    }
+    if (file->fill > 0 && !file->error) {
+        padded = (file->fill + OUT_FILE_ALIGNMENT - 1) / OUT_FILE_ALIGNMENT * OUT_FILE_ALIGNMENT;
+        memset(file->buffer[file->current] + file->fill, 0, padded - file->fill);
+        direct_submit(file, (DWORD)padded);
+    }
+    for (i = 0; i < OUT_FILE_MAX_IN_FLIGHT; i++) {
+        if (file->pending[i]) {
+            direct_wait(file, i);
+        }
+    }
+    if (file->offset != size || file->allocated > size) {
+        end.QuadPart = (LONGLONG)size;
+        if (!SetFilePointerEx(file->handle, end, NULL, FILE_BEGIN) ||
+            !SetEndOfFile(file->handle)) {
+            fprintf(stderr, "out_file_close: SetEndOfFile error %d.\n", GetLastError());
+            file->error = 1;
+        }
+    }
+    CloseHandle(file->handle);
+    file->handle = INVALID_HANDLE_VALUE;
+    for (i = 0; i < OUT_FILE_MAX_IN_FLIGHT; i++) {
+        if (file->buffer[i] != NULL) VirtualFree(file->buffer[i], 0, MEM_RELEASE);
+        if (file->overlapped[i].hEvent != NULL) CloseHandle(file->overlapped[i].hEvent);
+        file->buffer[i] = NULL;
+        file->overlapped[i].hEvent = NULL;
+    }
+    return file->error ? -1 : 0;
+}
+
+/* SetFileValidData() requires the SE_MANAGE_VOLUME_NAME privilege, which
+ * administrators have but which is disabled by default.
+ */
+static void enable_volume_privilege(void)
+{
+    static int done = 0;
+    HANDLE token;
+    TOKEN_PRIVILEGES privileges;
+
+    if (done) {
+        return;
+    }
+    done = 1;
+    if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES, &token)) {
+        return;
+    }
+    privileges.PrivilegeCount = 1;
+    privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+    if (LookupPrivilegeValue(NULL, SE_MANAGE_VOLUME_NAME, &privileges.Privileges[0].Luid)) {
+        AdjustTokenPrivileges(token, FALSE, &privileges, 0, NULL, NULL);
+    }
+    CloseHandle(token);
+}
+
+static int mapped_open(out_file_t* file, const char* name, unsigned __int64 size)
+{
+    if (size == 0 || size > (SIZE_T)-1) {
+        fprintf(stderr, "out_file_open: Cannot map a file of %.0f bytes.\n", (double)size);
+        return -1;
+    }
+    file->handle = CreateFileA(name, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                               FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file->handle == INVALID_HANDLE_VALUE) {
+        fprintf(stderr, "out_file_open: CreateFile error %d for '%s'.\n",
+                GetLastError(), name);
+        return -1;
+    }
+    /* Mapping a size larger than the file extends it. */
+    file->mapping = CreateFileMapping(file->handle, NULL, PAGE_READWRITE,
+                                      (DWORD)(size >> 32), (DWORD)(size & 0xFFFFFFFF), NULL);
+    if (file->mapping != NULL) {
+        file->view = (char*)MapViewOfFile(file->mapping, FILE_MAP_WRITE, 0, 0, (SIZE_T)size);
+    }
+    if (file->view == NULL) {
+        fprintf(stderr, "out_file_open: Failed to map %.0f bytes of '%s', error %d.\n",
+                (double)size, name, GetLastError());
+        mapped_close(file);
+        return -1;
+    }
+    file->size = size;
+    return 0;
+}
+
+/* Unmap the view and cut the file to the bytes actually written. */
+static int mapped_close(out_file_t* file)
+{
+    LARGE_INTEGER end;
+
+    if (file->handle == INVALID_HANDLE_VALUE) {
+        return 0;
+    }
+    if (file->view != NULL) {
+        UnmapViewOfFile(file->view);
+        file->view = NULL;
+    }
+    if (file->mapping != NULL) {
+        CloseHandle(file->mapping);
+        file->mapping = NULL;
+    }
+    end.QuadPart = (LONGLONG)file->offset;
+    if (!SetFilePointerEx(file->handle, end, NULL, FILE_BEGIN) ||
+        !SetEndOfFile(file->handle)) {
+        fprintf(stderr, "out_file_close: SetEndOfFile error %d.\n", GetLastError());
+        file->error = 1;
+    }
+    CloseHandle(file->handle);
+    file->handle = INVALID_HANDLE_VALUE;
+    return file->error ? -1 : 0;
+}
@@ -0,0 +1,108 @@
+/*
+ * Windows command line utility to record analog input samples in differential
+ * mode from a USB-1901 DAQ in double buffered mode.
+ *
+ * Copyright (C) 2014, 2016  Anders Gidenstam, Chalmers University of Technology
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*----------------------------------------------------------------------------*/
+/* Output files.                                                              */
+/*                                                                            */
+/* An out_file_t is either a stdio FILE with a large buffer or a file opened  */
+/* with FILE_FLAG_NO_BUFFERING | FILE_FLAG_OVERLAPPED. The latter collects    */
+/* the data in a few large sector aligned buffers and keeps several writes    */
+/* in flight, so the recording never waits for the system file cache.        */
+/* A file of known size can also be mapped into memory, which lets the data   */
+/* be placed in the file without any copy at all; see out_file_reserve().     */
+/* Finally the output can go to a collector on the network instead.          */
+/*----------------------------------------------------------------------------*/
+
+#ifndef OUT_FILE_H
+#define OUT_FILE_H
+
+#include <stdio.h>
+#include <windows.h>
+
+#include "net_sink.h"
+
+/* Backends. */
+#define OUT_FILE_STDIO          0   /* fopen() with a OUT_FILE_BUFFER_SIZE buffer. */
+#define OUT_FILE_DIRECT         1   /* Unbuffered overlapped CreateFile(). */
+#define OUT_FILE_MAPPED         2   /* A view of a file of fixed maximum size. */
+#define OUT_FILE_NET            3   /* A net_sink_t; the name is its address. */
+
+#define OUT_FILE_BUFFER_SIZE    (4*1024*1024)   /* Bytes per buffer. */
+#define OUT_FILE_MAX_IN_FLIGHT  3               /* Direct writes in flight. */
+#define OUT_FILE_ALIGNMENT      4096            /* A multiple of the sector size
+                                                   of all common disks. */
+
+typedef struct {
+    int backend;                        /* OUT_FILE_*. */
+    unsigned __int64 bytes;             /* Bytes written since opening. */
+    FILE* stdio;                        /* OUT_FILE_STDIO state. */
+    char* stdio_buffer;
+
+    /* OUT_FILE_DIRECT and OUT_FILE_MAPPED state. */
+    HANDLE handle;
+    char* buffer[OUT_FILE_MAX_IN_FLIGHT];
+    OVERLAPPED overlapped[OUT_FILE_MAX_IN_FLIGHT];
+    int pending[OUT_FILE_MAX_IN_FLIGHT]; /* Set while a write is in flight. */
+    int current;                        /* Buffer being filled. */
+    size_t fill;                        /* Bytes in the current buffer. */
+    unsigned __int64 offset;            /* File offset of the current buffer
+                                           or of the next byte in the view. */
+    unsigned __int64 allocated;         /* Bytes preallocated, or 0. */
+    int error;                          /* Set after a failed write. */
+
+    /* OUT_FILE_MAPPED state. */
+    HANDLE mapping;
+    char* view;                         /* The whole file. */
+    unsigned __int64 size;              /* Bytes in the view. */
+
+    /* OUT_FILE_NET state. The totals are kept after closing. */
+    net_sink_t* net;
+    unsigned __int64 net_bytes_sent;
+    U32 net_dropped;
+} out_file_t;
+
+/* Open a file for writing. binary selects "wb" over "w" for the stdio
+ * backend; the others always write the bytes as they are.
+ * If expected_size is known, > 0, the direct backend preallocates the file.
+ * The mapped backend requires it and can hold no more than that.
+ * Returns 0 on success and -1 on failure, after printing the reason.
+ */
+int out_file_open(out_file_t* file, const char* name, int backend, int binary,
+                  unsigned __int64 expected_size);
+
+/* Append length bytes. Returns 0 on success and -1 on failure. */
+int out_file_write(out_file_t* file, const void* data, size_t length);
+
+/* OUT_FILE_MAPPED only. out_file_reserve() appends length bytes and returns
+ * them for the caller to fill in, or NULL if the file is full.
+ * out_file_space() returns the number of bytes left.
+ */
+void* out_file_reserve(out_file_t* file, size_t length);
+unsigned __int64 out_file_space(const out_file_t* file);
+
+/* The file offset of the next byte appended. */
+unsigned __int64 out_file_tell(const out_file_t* file);
+
+/* Write out everything and close the file. Returns 0 on success and -1 on
+ * failure. Closing a file that is not open does nothing.
+ */
+int out_file_close(out_file_t* file);
+
+#endif
@@ -0,0 +1,46 @@
+/*
+ * Windows command line utility to record analog input samples in differential
+ * mode from a USB-1901 DAQ in double buffered mode.
+ *
+ * Copyright (C) 2014, 2016  Anders Gidenstam, Chalmers University of Technology
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*----------------------------------------------------------------------------*/
+/* Power and energy of voltage and shunt channel pairs.                       */
+/*----------------------------------------------------------------------------*/
+
+#include "power.h"
+
+void power_block(power_pair_t* pairs, int no_pairs, const signed short* buffer,
+                 int scans, int no_channels, double scan_time)
+{
+    double sum[POWER_MAX_PAIRS];
+    int s;
+    int p;
+
+    for (p = 0; p < no_pairs; p++) {
+        sum[p] = 0.0;
+    }
+    for (s = 0; s < scans; s++) {
+        for (p = 0; p < no_pairs; p++) {
+            sum[p] += POWER_AT(&pairs[p], buffer);
+        }
+        buffer += no_channels;
+    }
+    for (p = 0; p < no_pairs; p++) {
+        pairs[p].energy += sum[p] * scan_time;
+    }
+}
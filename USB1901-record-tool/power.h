@@ -0,0 +1,59 @@
+/*
+ * Windows command line utility to record analog input samples in differential
+ * mode from a USB-1901 DAQ in double buffered mode.
+ *
+ * Copyright (C) 2014, 2016  Anders Gidenstam, Chalmers University of Technology
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*----------------------------------------------------------------------------*/
+/* Power and energy of voltage and shunt channel pairs.                       */
+/*                                                                            */
+/* A pair multiplies the voltage of one channel by the current through a     */
+/* shunt, measured as the voltage over it on another channel of the same     */
+/* scan. The volts come from the channels' lookup tables.                     */
+/*----------------------------------------------------------------------------*/
+
+#ifndef POWER_H
+#define POWER_H
+
+#include "UsbDask.h"
+
+#define POWER_MAX_PAIRS     4
+
+typedef struct {
+    U16 v_channel;                      /* Channel id of the voltage. */
+    U16 i_channel;                      /* Channel id of the shunt voltage. */
+    double shunt;                       /* Shunt resistance in ohms. */
+    int v_pos;                          /* Scan positions of the channels. */
+    int i_pos;
+    const double* v_volts;              /* Their code to volts tables. */
+    const double* i_volts;
+    double conductance;                 /* 1/shunt. */
+    double energy;                      /* Joules so far. */
+} power_pair_t;
+
+/* Instantaneous power in watts of pair in the scan starting at scan. */
+#define POWER_AT(pair, scan) \
+    ((pair)->v_volts[(U16)(scan)[(pair)->v_pos]] * \
+     (pair)->i_volts[(U16)(scan)[(pair)->i_pos]] * (pair)->conductance)
+
+/* Add the energy of the scans scans of no_channels samples in buffer,
+ * scan_time seconds apart, to each of the pairs.
+ */
+void power_block(power_pair_t* pairs, int no_pairs, const signed short* buffer,
+                 int scans, int no_channels, double scan_time);
+
+#endif
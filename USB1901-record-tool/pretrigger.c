@@ -0,0 +1,129 @@
+/*
+ * Windows command line utility to record analog input samples in differential
+ * mode from a USB-1901 DAQ in double buffered mode.
+ *
+ * Copyright (C) 2014, 2016  Anders Gidenstam, Chalmers University of Technology
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*----------------------------------------------------------------------------*/
+/* Software pre-trigger.                                                      */
+/*----------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "pretrigger.h"
+
+int pretrigger_init(pretrigger_t* t, int no_channels, int position, short level,
+                    int falling, unsigned int capacity)
+{
+    memset(t, 0, sizeof(pretrigger_t));
+    t->no_channels = no_channels;
+    t->position = position;
+    t->level = level;
+    t->falling = falling;
+    t->capacity = capacity;
+    t->history = (signed short*)malloc(sizeof(signed short) * no_channels * (capacity + 1));
+    return t->history != NULL ? 0 : -1;
+}
+
+void pretrigger_free(pretrigger_t* t)
+{
+    free(t->history);
+    t->history = NULL;
+}
+
+int pretrigger_find(pretrigger_t* t, const signed short* buffer, unsigned int scans)
+{
+    const signed short* p = buffer + t->position;
+    unsigned int s;
+    short x;
+
+    for (s = 0; s < scans; s++) {
+        x = *p;
+        p += t->no_channels;
+        if (t->have_last &&
+            (t->falling ? t->last > t->level && x <= t->level
+                        : t->last < t->level && x >= t->level)) {
+            t->fired = 1;
+            return (int)s;
+        }
+        t->last = x;
+        t->have_last = 1;
+    }
+    return -1;
+}
+
+unsigned int pretrigger_keep(pretrigger_t* t, const signed short* buffer, unsigned int scans)
+{
+    unsigned int dropped = 0;
+    unsigned int end;
+    unsigned int n;
+
+    if (scans > t->capacity) {
+        /* Only the newest capacity scans can be kept. */
+        dropped = scans - t->capacity + t->fill;
+        buffer += (scans - t->capacity) * t->no_channels;
+        scans = t->capacity;
+        t->start = 0;
+        t->fill = 0;
+    } else if (t->fill + scans > t->capacity) {
+        n = t->fill + scans - t->capacity;
+        t->start = (t->start + n) % t->capacity;
+        t->fill -= n;
+        dropped = n;
+    }
+    while (scans > 0) {
+        end = (t->start + t->fill) % t->capacity;
+        n = t->capacity - end;
+        if (n > scans) {
+            n = scans;
+        }
+        memcpy(t->history + end * t->no_channels, buffer,
+               sizeof(signed short) * n * t->no_channels);
+        buffer += n * t->no_channels;
+        t->fill += n;
+        scans -= n;
+    }
+    return dropped;
+}
+
+unsigned int pretrigger_reset(pretrigger_t* t)
+{
+    unsigned int dropped = t->fill;
+
+    t->start = 0;
+    t->fill = 0;
+    t->have_last = 0;
+    return dropped;
+}
+
+unsigned int pretrigger_history(const pretrigger_t* t, unsigned int scans,
+                                const signed short** first, unsigned int* first_scans,
+                                const signed short** second, unsigned int* second_scans)
+{
+    unsigned int begin;
+
+    if (scans > t->fill) {
+        scans = t->fill;
+    }
+    begin = (t->start + t->fill - scans) % (t->capacity > 0 ? t->capacity : 1);
+    *first = t->history + begin * t->no_channels;
+    *first_scans = scans < t->capacity - begin ? scans : t->capacity - begin;
+    *second = t->history;
+    *second_scans = scans - *first_scans;
+    return scans;
+}
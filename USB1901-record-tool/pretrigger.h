@@ -0,0 +1,70 @@
+/*
+ * Windows command line utility to record analog input samples in differential
+ * mode from a USB-1901 DAQ in double buffered mode.
+ *
+ * Copyright (C) 2014, 2016  Anders Gidenstam, Chalmers University of Technology
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*----------------------------------------------------------------------------*/
+/* Software pre-trigger.                                                      */
+/*                                                                            */
+/* Until one channel crosses a threshold the scans are only kept in a         */
+/* circular history of fixed length. When the crossing is found the history  */
+/* is handed out, so the recording starts that long before the event.        */
+/*----------------------------------------------------------------------------*/
+
+#ifndef PRETRIGGER_H
+#define PRETRIGGER_H
+
+typedef struct {
+    int no_channels;
+    int position;                       /* Scan position of the trigger channel. */
+    short level;                        /* Threshold as an ADC code. */
+    int falling;                        /* Trigger on a fall through the level
+                                           rather than a rise. */
+    int have_last;                      /* Set if last is valid. */
+    short last;                         /* Trigger channel in the previous scan. */
+    signed short* history;              /* capacity scans. */
+    unsigned int capacity;
+    unsigned int start;                 /* Oldest scan in the history. */
+    unsigned int fill;                  /* Scans in the history. */
+    int fired;                          /* Set once the trigger was found. */
+} pretrigger_t;
+
+/* Keep up to capacity scans of no_channels samples. Returns 0 on success
+ * and -1 if the history cannot be allocated.
+ */
+int pretrigger_init(pretrigger_t* t, int no_channels, int position, short level,
+                    int falling, unsigned int capacity);
+void pretrigger_free(pretrigger_t* t);
+
+/* Index of the first scan of buffer that crosses the level, or -1. */
+int pretrigger_find(pretrigger_t* t, const signed short* buffer, unsigned int scans);
+
+/* Append scans to the history. Returns the number of old scans dropped. */
+unsigned int pretrigger_keep(pretrigger_t* t, const signed short* buffer, unsigned int scans);
+
+/* Forget the history, e.g. after a gap. Returns the number of scans dropped. */
+unsigned int pretrigger_reset(pretrigger_t* t);
+
+/* The newest scans of the history as up to two spans in time order. The
+ * scans of the second span follow those of the first. Returns the total.
+ */
+unsigned int pretrigger_history(const pretrigger_t* t, unsigned int scans,
+                                const signed short** first, unsigned int* first_scans,
+                                const signed short** second, unsigned int* second_scans);
+
+#endif
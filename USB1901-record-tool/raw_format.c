@@ -0,0 +1,87 @@
+/*
+ * Windows command line utility to record analog input samples in differential
+ * mode from a USB-1901 DAQ in double buffered mode.
+ *
+ * Copyright (C) 2014, 2016  Anders Gidenstam, Chalmers University of Technology
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*----------------------------------------------------------------------------*/
+/* Raw binary sample file format.                                             */
+/*----------------------------------------------------------------------------*/
+
+#include <string.h>
+
+#include "raw_format.h"
+
+int raw_write_header(out_file_t* file, const raw_header_t* header)
+{
+    return out_file_write(file, header, sizeof(raw_header_t));
+}
+
+int raw_read_header(FILE* file, raw_header_t* header)
+{
+    if (fread(header, sizeof(raw_header_t), 1, file) != 1) {
+        fprintf(stderr, "raw_read_header: File too short.\n");
+        return -1;
+    }
+    if (memcmp(header->magic, RAW_MAGIC, sizeof(header->magic)) != 0) {
+        fprintf(stderr, "raw_read_header: Not a raw USB-1901 sample file.\n");
+        return -1;
+    }
+    if (header->version < RAW_MIN_VERSION || header->version > RAW_VERSION ||
+        header->header_size != sizeof(raw_header_t)) {
+        fprintf(stderr, "raw_read_header: Unsupported file version %d.\n",
+                header->version);
+        return -1;
+    }
+    if (header->no_channels < 1 || header->no_channels > RAW_MAX_CHANNELS) {
+        fprintf(stderr, "raw_read_header: Bad channel count %d.\n",
+                header->no_channels);
+        return -1;
+    }
+    return 0;
+}
+
+int raw_write_record(out_file_t* file, U16 type, U32 count)
+{
+    raw_record_t record;
+
+    record.type = type;
+    record.reserved = 0;
+    record.count = count;
+    return out_file_write(file, &record, sizeof(raw_record_t));
+}
+
+int raw_read_record(FILE* file, raw_record_t* record)
+{
+    size_t n = fread(record, 1, sizeof(raw_record_t), file);
+
+    if (n == 0 && feof(file)) {
+        return 1;
+    }
+    if (n != sizeof(raw_record_t)) {
+        fprintf(stderr, "raw_read_record: Truncated record.\n");
+        return -1;
+    }
+    if (record->type != RAW_RECORD_SAMPLES && record->type != RAW_RECORD_GAP &&
+        record->type != RAW_RECORD_TIME && record->type != RAW_RECORD_COMPRESSED &&
+        record->type != RAW_RECORD_CHUNK && record->type != RAW_RECORD_BLOCK &&
+        record->type != RAW_RECORD_INDEX && record->type != RAW_RECORD_MARK) {
+        fprintf(stderr, "raw_read_record: Unknown record type %d.\n", record->type);
+        return -1;
+    }
+    return 0;
+}
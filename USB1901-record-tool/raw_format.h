@@ -0,0 +1,147 @@
+/*
+ * Windows command line utility to record analog input samples in differential
+ * mode from a USB-1901 DAQ in double buffered mode.
+ *
+ * Copyright (C) 2014, 2016  Anders Gidenstam, Chalmers University of Technology
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*----------------------------------------------------------------------------*/
+/* Raw binary sample file format.                                             */
+/*                                                                            */
+/* A raw file is a raw_header_t followed by a sequence of records. Each       */
+/* record is a raw_record_t, followed for RAW_RECORD_SAMPLES by the           */
+/* interleaved 16-bit ADC codes of whole scans exactly as delivered by        */
+/* UD_AI_AsyncDblBufferTransfer, for RAW_RECORD_TIME by a 64-bit              */
+/* QueryPerformanceCounter() value, for RAW_RECORD_COMPRESSED by a            */
+/* raw_compressed_t and the compressed samples, for RAW_RECORD_CHUNK by a     */
+/* raw_chunk_t, for RAW_RECORD_BLOCK by a raw_block_t and for                 */
+/* RAW_RECORD_MARK by a raw_mark_t and the label.                             */
+/*                                                                            */
+/* Each half buffer is a block: a RAW_RECORD_BLOCK followed by its samples,   */
+/* possibly after a RAW_RECORD_GAP, and so is each half buffer of the         */
+/* pre-trigger history of '-x'. A RAW_RECORD_MARK comes before the block that */
+/* holds its scan, or after the last block. A complete file ends in a         */
+/* RAW_RECORD_INDEX of the blocks, see raw_index.h. All fields are            */
+/* little-endian.                                                             */
+/*----------------------------------------------------------------------------*/
+
+#ifndef RAW_FORMAT_H
+#define RAW_FORMAT_H
+
+#include <stdio.h>
+
+#include "UsbDask.h"
+#include "out_file.h"
+
+#define RAW_MAGIC           "U1901RAW"
+#define RAW_VERSION         8
+#define RAW_MIN_VERSION     3   /* Oldest version with this header. */
+#define RAW_MAX_CHANNELS    8
+
+/* Record types. */
+#define RAW_RECORD_SAMPLES  1   /* count samples follow. */
+#define RAW_RECORD_GAP      2   /* About count scans were lost here. */
+#define RAW_RECORD_TIME     3   /* count bytes holding the QPC value at which
+                                   the next samples were transferred. */
+#define RAW_RECORD_COMPRESSED 4 /* count bytes holding compressed samples. */
+#define RAW_RECORD_CHUNK    5   /* count bytes holding a raw_chunk_t. Follows
+                                   the header of each file of a rotated
+                                   recording. */
+#define RAW_RECORD_BLOCK    6   /* count bytes holding a raw_block_t. Replaces
+                                   RAW_RECORD_TIME from version 7. */
+#define RAW_RECORD_INDEX    7   /* count bytes holding the index and its
+                                   raw_index_trailer_t. The last record. */
+#define RAW_RECORD_MARK     8   /* count bytes holding a raw_mark_t followed by
+                                   the label, not 0-terminated. From version 8. */
+
+/* Transformations applied to the samples before compression. */
+#define RAW_FILTER_NONE     0
+#define RAW_FILTER_DELTA    1   /* Each code minus the one of the same channel
+                                   in the previous scan. The first scan of a
+                                   record is kept as it is. */
+
+#pragma pack(push, 1)
+typedef struct {
+    char magic[8];                      /* RAW_MAGIC, not 0-terminated. */
+    U16  version;                       /* RAW_VERSION. */
+    U16  header_size;                   /* sizeof(raw_header_t). */
+    U16  no_channels;                   /* Channels per scan. */
+    U16  card_id;                       /* Card id of the recording card. */
+    U32  sample_rate;                   /* Requested scan rate in Hz. */
+    U32  timebase;                      /* Counter clock in Hz. */
+    U32  scan_intrv;                    /* Timebase ticks between scans. */
+    U32  samp_intrv;                    /* Timebase ticks between conversions. */
+    U32  start_time_low;                /* Start of the recording as a */
+    U32  start_time_high;               /* FILETIME (UTC). */
+    U16  channel_id[RAW_MAX_CHANNELS];  /* Channel id of each scan position. */
+    U16  ad_range[RAW_MAX_CHANNELS];    /* UD-DASK AD_B_* range code of each. */
+    /* The common timebase of cards recorded together: */
+    unsigned __int64 start_qpc;         /* QueryPerformanceCounter() at the start. */
+    unsigned __int64 qpc_frequency;     /* QueryPerformanceFrequency(). */
+} raw_header_t;
+
+typedef struct {
+    U16  type;                          /* RAW_RECORD_*. */
+    U16  reserved;
+    U32  count;                         /* See the record types. */
+} raw_record_t;
+
+typedef struct {
+    U16  codec;                         /* COMPRESS_* codec. */
+    U16  filter;                        /* RAW_FILTER_*. */
+    U32  samples;                       /* Samples after decompression. */
+} raw_compressed_t;
+
+typedef struct {
+    U32  chunk;                         /* Number of the file, from 0. */
+    U32  reserved;
+    unsigned __int64 first_scan;        /* Scans, including lost ones, recorded
+                                           before the file. */
+} raw_chunk_t;
+
+typedef struct {
+    U32  sequence;                      /* Number of the block in the file. */
+    U16  phase;                         /* Scan position of the first sample;
+                                           0 as blocks hold whole scans. */
+    U16  reserved;
+    unsigned __int64 first_scan;        /* Scans, including lost ones, recorded
+                                           before the block. */
+    unsigned __int64 qpc;               /* QueryPerformanceCounter() when the
+                                           block was transferred from the card. */
+} raw_block_t;
+
+typedef struct {
+    unsigned __int64 scan;              /* Scans, including lost ones, recorded
+                                           before the marker. */
+    unsigned __int64 qpc;               /* QueryPerformanceCounter() when the
+                                           marker was given. */
+} raw_mark_t;
+#pragma pack(pop)
+
+/* Write or read and validate a header. Return 0 on success and -1 on
+ * failure, after printing the reason to stderr.
+ */
+int raw_write_header(out_file_t* file, const raw_header_t* header);
+int raw_read_header(FILE* file, raw_header_t* header);
+
+/* Write a record header. Returns 0 on success and -1 on failure. */
+int raw_write_record(out_file_t* file, U16 type, U32 count);
+/* Read the next record header. Returns 0 on success, 1 at the end of the
+ * file and -1 on failure.
+ */
+int raw_read_record(FILE* file, raw_record_t* record);
+
+#endif
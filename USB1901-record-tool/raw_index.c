@@ -0,0 +1,321 @@
+/*
+ * Windows command line utility to record analog input samples in differential
+ * mode from a USB-1901 DAQ in double buffered mode.
+ *
+ * Copyright (C) 2014, 2016  Anders Gidenstam, Chalmers University of Technology
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*----------------------------------------------------------------------------*/
+/* Block index of raw sample files.                                           */
+/*----------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <io.h>
+
+#include "raw_index.h"
+
+static int add_entry(raw_index_t* index, unsigned __int64 offset,
+                     unsigned __int64 first_scan, unsigned __int64 qpc, U32 sequence);
+static void end_entry(raw_index_t* index, unsigned __int64 scan);
+
+int raw_index_scan(FILE* file, const raw_header_t* header, raw_index_t* index)
+{
+    raw_record_t record;
+    raw_block_t block;
+    raw_chunk_t chunk;
+    raw_compressed_t compressed;
+    unsigned __int64 size;
+    unsigned __int64 pos;
+    unsigned __int64 next;
+    unsigned __int64 scan = 0;
+    __int64 qpc;
+    int ok = 1;
+    int added = 0;
+
+    memset(index, 0, sizeof(raw_index_t));
+    pos = _ftelli64(file);
+    if (_fseeki64(file, 0, SEEK_END) != 0) {
+        perror("raw_index_scan: fseek error: ");
+        return -1;
+    }
+    size = _ftelli64(file);
+
+    while (ok && pos + sizeof(raw_record_t) <= size) {
+        if (_fseeki64(file, pos, SEEK_SET) != 0 ||
+            fread(&record, sizeof(raw_record_t), 1, file) != 1) {
+            break;
+        }
+        next = pos + sizeof(raw_record_t);
+        if (record.type == RAW_RECORD_SAMPLES) {
+            next += (unsigned __int64)record.count * sizeof(signed short);
+        } else if (record.type != RAW_RECORD_GAP) {
+            next += record.count;
+        }
+        if (next > size) {
+            break;
+        }
+        switch (record.type) {
+        case RAW_RECORD_SAMPLES:
+            scan += record.count / header->no_channels;
+            break;
+        case RAW_RECORD_GAP:
+            scan += record.count;
+            break;
+        case RAW_RECORD_COMPRESSED:
+            ok = record.count >= sizeof(compressed) &&
+                 fread(&compressed, sizeof(compressed), 1, file) == 1;
+            if (ok) {
+                scan += compressed.samples / header->no_channels;
+            }
+            break;
+        case RAW_RECORD_CHUNK:
+            ok = record.count == sizeof(chunk) && fread(&chunk, sizeof(chunk), 1, file) == 1;
+            if (ok) {
+                scan = chunk.first_scan;
+            }
+            break;
+        case RAW_RECORD_BLOCK:
+            ok = record.count == sizeof(block) && fread(&block, sizeof(block), 1, file) == 1;
+            if (ok) {
+                scan = block.first_scan;
+                end_entry(index, scan);
+                added = add_entry(index, pos, scan, block.qpc, block.sequence);
+            }
+            break;
+        case RAW_RECORD_TIME:
+            ok = record.count == sizeof(qpc) && fread(&qpc, sizeof(qpc), 1, file) == 1;
+            if (ok) {
+                end_entry(index, scan);
+                added = add_entry(index, pos, scan, qpc, index->no_entries);
+            }
+            break;
+        case RAW_RECORD_MARK:
+            break;
+        case RAW_RECORD_INDEX:
+            index->complete = 1;
+            ok = 0;
+            break;
+        default:
+            ok = 0;
+            break;
+        }
+        if (added < 0) {
+            fprintf(stderr, "raw_index_scan: Out of memory.\n");
+            raw_index_free(index);
+            return -1;
+        }
+        if (ok) {
+            pos = next;
+        }
+    }
+    end_entry(index, scan);
+    index->end = pos;
+    index->truncated = !index->complete && pos < size;
+    return 0;
+}
+
+int raw_index_read(FILE* file, raw_index_t* index)
+{
+    raw_index_trailer_t trailer;
+    raw_record_t record;
+
+    memset(index, 0, sizeof(raw_index_t));
+    if (_fseeki64(file, -(__int64)sizeof(trailer), SEEK_END) != 0 ||
+        fread(&trailer, sizeof(trailer), 1, file) != 1 ||
+        memcmp(trailer.magic, RAW_INDEX_MAGIC, sizeof(trailer.magic)) != 0) {
+        return 1;
+    }
+    if (_fseeki64(file, trailer.index_offset, SEEK_SET) != 0 ||
+        fread(&record, sizeof(record), 1, file) != 1 ||
+        record.type != RAW_RECORD_INDEX ||
+        record.count != trailer.no_entries * sizeof(raw_index_entry_t) + sizeof(trailer)) {
+        fprintf(stderr, "raw_index_read: The index is damaged.\n");
+        return -1;
+    }
+    index->entry = (raw_index_entry_t*)malloc(sizeof(raw_index_entry_t) *
+                                              (trailer.no_entries + 1));
+    if (index->entry == NULL) {
+        fprintf(stderr, "raw_index_read: Out of memory.\n");
+        return -1;
+    }
+    if (fread(index->entry, sizeof(raw_index_entry_t), trailer.no_entries, file) !=
+        trailer.no_entries) {
+        fprintf(stderr, "raw_index_read: The index is damaged.\n");
+        raw_index_free(index);
+        return -1;
+    }
+    index->no_entries = trailer.no_entries;
+    index->capacity = trailer.no_entries + 1;
+    index->end = trailer.index_offset;
+    index->complete = 1;
+    return 0;
+}
+
+int raw_index_write(FILE* file, const raw_index_t* index)
+{
+    raw_record_t record;
+    raw_index_trailer_t trailer;
+
+    trailer.index_offset = _ftelli64(file);
+    trailer.no_entries = index->no_entries;
+    memcpy(trailer.magic, RAW_INDEX_MAGIC, sizeof(trailer.magic));
+    record.type = RAW_RECORD_INDEX;
+    record.reserved = 0;
+    record.count = index->no_entries * sizeof(raw_index_entry_t) + sizeof(trailer);
+    if (fwrite(&record, sizeof(record), 1, file) != 1 ||
+        fwrite(index->entry, sizeof(raw_index_entry_t), index->no_entries, file) !=
+        index->no_entries ||
+        fwrite(&trailer, sizeof(trailer), 1, file) != 1) {
+        perror("raw_index_write: fwrite error: ");
+        return -1;
+    }
+    return 0;
+}
+
+int raw_index_add(raw_index_t* index, unsigned __int64 offset, const raw_block_t* block)
+{
+    end_entry(index, block->first_scan);
+    if (add_entry(index, offset, block->first_scan, block->qpc, block->sequence) < 0) {
+        index->incomplete = 1;
+        return -1;
+    }
+    return 0;
+}
+
+void raw_index_end(raw_index_t* index, unsigned __int64 scan)
+{
+    end_entry(index, scan);
+}
+
+int raw_index_output(out_file_t* file, const raw_index_t* index)
+{
+    raw_index_trailer_t trailer;
+
+    trailer.index_offset = out_file_tell(file);
+    trailer.no_entries = index->no_entries;
+    memcpy(trailer.magic, RAW_INDEX_MAGIC, sizeof(trailer.magic));
+    if (raw_write_record(file, RAW_RECORD_INDEX,
+                         index->no_entries * sizeof(raw_index_entry_t) + sizeof(trailer)) < 0 ||
+        out_file_write(file, index->entry, sizeof(raw_index_entry_t) * index->no_entries) < 0 ||
+        out_file_write(file, &trailer, sizeof(trailer)) < 0) {
+        fprintf(stderr, "raw_index_output: Failed to write the index.\n");
+        return -1;
+    }
+    return 0;
+}
+
+const raw_index_entry_t* raw_index_find(const raw_index_t* index, unsigned __int64 scan)
+{
+    U32 low = 0;
+    U32 high = index->no_entries;
+    U32 mid;
+
+    /* The first entry after scan is in [low, high]. */
+    while (low < high) {
+        mid = low + (high - low) / 2;
+        if (index->entry[mid].first_scan <= scan) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low > 0 ? &index->entry[low - 1] : NULL;
+}
+
+void raw_index_free(raw_index_t* index)
+{
+    free(index->entry);
+    index->entry = NULL;
+    index->no_entries = 0;
+    index->capacity = 0;
+}
+
+int raw_index_file(const char* name, raw_index_t* index)
+{
+    FILE* file;
+    raw_header_t header;
+    raw_index_t scanned;
+    int result = 0;
+
+    file = fopen(name, "r+b");
+    if (file == NULL) {
+        fprintf(stderr, "raw_index_file: Cannot open '%s'.\n", name);
+        return -1;
+    }
+    if (raw_read_header(file, &header) < 0 || raw_index_scan(file, &header, &scanned) < 0) {
+        fclose(file);
+        return -1;
+    }
+    if (scanned.complete) {
+        result = 1;
+    } else {
+        /* Whatever follows the last complete record is of no use. */
+        if (scanned.truncated && _chsize_s(_fileno(file), (__int64)scanned.end) != 0) {
+            fprintf(stderr, "raw_index_file: Cannot truncate '%s'.\n", name);
+            result = -1;
+        }
+        if (result == 0 &&
+            (_fseeki64(file, scanned.end, SEEK_SET) != 0 || raw_index_write(file, &scanned) < 0)) {
+            result = -1;
+        }
+    }
+    if (fclose(file) != 0) {
+        perror("raw_index_file: fclose error: ");
+        result = -1;
+    }
+    if (index != NULL) {
+        *index = scanned;
+    } else {
+        raw_index_free(&scanned);
+    }
+    return result;
+}
+
+static int add_entry(raw_index_t* index, unsigned __int64 offset,
+                     unsigned __int64 first_scan, unsigned __int64 qpc, U32 sequence)
+{
+    raw_index_entry_t* grown;
+    raw_index_entry_t* e;
+
+    if (index->no_entries == index->capacity) {
+        grown = (raw_index_entry_t*)realloc(index->entry, sizeof(raw_index_entry_t) *
+                                            (index->capacity * 2 + 1024));
+        if (grown == NULL) {
+            return -1;
+        }
+        index->entry = grown;
+        index->capacity = index->capacity * 2 + 1024;
+    }
+    e = &index->entry[index->no_entries++];
+    e->offset = offset;
+    e->first_scan = first_scan;
+    e->qpc = qpc;
+    e->sequence = sequence;
+    e->scans = 0;
+    return 0;
+}
+
+/* The last block so far ends at scan. */
+static void end_entry(raw_index_t* index, unsigned __int64 scan)
+{
+    raw_index_entry_t* e;
+
+    if (index->no_entries > 0) {
+        e = &index->entry[index->no_entries - 1];
+        e->scans = (U32)(scan - e->first_scan);
+    }
+}
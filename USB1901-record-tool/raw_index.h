@@ -0,0 +1,121 @@
+/*
+ * Windows command line utility to record analog input samples in differential
+ * mode from a USB-1901 DAQ in double buffered mode.
+ *
+ * Copyright (C) 2014, 2016  Anders Gidenstam, Chalmers University of Technology
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*----------------------------------------------------------------------------*/
+/* Block index of raw sample files.                                           */
+/*                                                                            */
+/* The index lists the offset, first scan and transfer time of every block  */
+/* of a raw file, so that a part of a long recording can be read without     */
+/* reading everything before it. It is stored as the RAW_RECORD_INDEX at the */
+/* end of the file: an array of raw_index_entry_t followed by a              */
+/* raw_index_trailer_t, which is the last 16 bytes of the file.              */
+/*                                                                            */
+/* The writer adds an entry as it writes each block and appends the index   */
+/* when it closes the file. Scanning the record headers of the file builds  */
+/* the same index, which is how that of a file whose recording died is      */
+/* recovered.                                                                 */
+/*----------------------------------------------------------------------------*/
+
+#ifndef RAW_INDEX_H
+#define RAW_INDEX_H
+
+#include <stdio.h>
+
+#include "raw_format.h"
+
+#define RAW_INDEX_MAGIC     "U19X"
+
+#pragma pack(push, 1)
+typedef struct {
+    unsigned __int64 offset;            /* File offset of the block's first
+                                           record. */
+    unsigned __int64 first_scan;        /* As in raw_block_t. */
+    unsigned __int64 qpc;
+    U32  sequence;
+    U32  scans;                         /* Scans in the block, including a gap
+                                           before the next one. */
+} raw_index_entry_t;
+
+typedef struct {
+    unsigned __int64 index_offset;      /* File offset of the RAW_RECORD_INDEX. */
+    U32  no_entries;
+    char magic[4];                      /* RAW_INDEX_MAGIC, not 0-terminated. */
+} raw_index_trailer_t;
+#pragma pack(pop)
+
+typedef struct {
+    raw_index_entry_t* entry;
+    U32 no_entries;
+    U32 capacity;
+    unsigned __int64 end;               /* Offset after the last complete record. */
+    int complete;                       /* Set if the file already ends in an
+                                           index. */
+    int truncated;                      /* Set if it ends in a partial or
+                                           damaged record. */
+    int incomplete;                     /* Set if raw_index_add() ran out of
+                                           memory. */
+} raw_index_t;
+
+/* Build the index of file by reading the record headers from its current
+ * position, just after header, to the end or the first damaged record.
+ * Blocks written before version 7 are indexed by their RAW_RECORD_TIME.
+ * Returns 0 on success and -1 on failure.
+ */
+int raw_index_scan(FILE* file, const raw_header_t* header, raw_index_t* index);
+
+/* Load the index stored at the end of file. Returns 0 on success, 1 if the
+ * file has no index and -1 on failure.
+ */
+int raw_index_read(FILE* file, raw_index_t* index);
+
+/* Append index to file at its current position. Returns 0 on success and
+ * -1 on failure.
+ */
+int raw_index_write(FILE* file, const raw_index_t* index);
+
+/* Add the block at offset, the file offset of its RAW_RECORD_BLOCK, while
+ * writing the file. The previous block ends where it starts. Returns 0 on
+ * success and -1, setting index->incomplete, if out of memory.
+ */
+int raw_index_add(raw_index_t* index, unsigned __int64 offset, const raw_block_t* block);
+
+/* The last block added ends at scan. */
+void raw_index_end(raw_index_t* index, unsigned __int64 scan);
+
+/* Append index to file, which is being written, at its current position.
+ * Returns 0 on success and -1 on failure.
+ */
+int raw_index_output(out_file_t* file, const raw_index_t* index);
+
+/* The last block that starts at or before scan, or NULL if scan is before
+ * the first block.
+ */
+const raw_index_entry_t* raw_index_find(const raw_index_t* index, unsigned __int64 scan);
+
+void raw_index_free(raw_index_t* index);
+
+/* Scan the raw file name and append its index, first cutting off a damaged
+ * end. Returns 0 on success, 1 if the file already had an index and -1 on
+ * failure, after printing the reason. If index is not NULL it receives the
+ * result.
+ */
+int raw_index_file(const char* name, raw_index_t* index);
+
+#endif
@@ -0,0 +1,291 @@
+/*
+ * Windows command line utility to record analog input samples in differential
+ * mode from a USB-1901 DAQ in double buffered mode.
+ *
+ * Copyright (C) 2014, 2016  Anders Gidenstam, Chalmers University of Technology
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*----------------------------------------------------------------------------*/
+/* Per buffer sample kernels.                                                 */
+/*----------------------------------------------------------------------------*/
+
+#include "sample_kernel.h"
+
+#if defined(__AVX2__)
+#define KERNEL_AVX2
+#include <immintrin.h>
+#endif
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define KERNEL_SSE2
+#include <emmintrin.h>
+#endif
+
+/* The 32-bit lane sums are moved to 64 bits before they can overflow. */
+#define FLUSH_INTERVAL  65535
+
+static void stats_reset(block_stats_t* stats, int no_channels)
+{
+    int c;
+
+    for (c = 0; c < no_channels; c++) {
+        stats->count[c] = 0;
+        stats->sum[c] = 0;
+        stats->sum_sq[c] = 0;
+        stats->min[c] = 32767;
+        stats->max[c] = -32768;
+    }
+}
+
+/* Scalar loop over samples from phase c. Returns the phase after the last. */
+static int stats_scalar(const signed short* buffer, int length,
+                        int no_channels, int c, block_stats_t* stats)
+{
+    int i;
+
+    for (i = 0; i < length; i++) {
+        short v = buffer[i];
+
+        stats->count[c]++;
+        stats->sum[c] += v;
+        stats->sum_sq[c] += (int)v * v;
+        if (v < stats->min[c]) stats->min[c] = v;
+        if (v > stats->max[c]) stats->max[c] = v;
+        if (++c == no_channels) {
+            c = 0;
+        }
+    }
+    return c;
+}
+
+void kernel_block_stats_scalar(const signed short* buffer, int length,
+                               int no_channels, int offset, block_stats_t* stats)
+{
+    stats_reset(stats, no_channels);
+    stats_scalar(buffer, length, no_channels, offset, stats);
+}
+
+/* Fold lane-wise results into channels. Lane l holds channel l % NCH. */
+static void fold_lanes(const int* lane_sum, const __int64* lane_total,
+                       const __int64* lane_sq, const short* lane_min, const short* lane_max,
+                       int lanes, int no_channels, int vectors,
+                       block_stats_t* stats)
+{
+    int l;
+
+    for (l = 0; l < lanes; l++) {
+        int c = l % no_channels;
+
+        stats->count[c] += vectors;
+        stats->sum[c] += lane_total[l] + lane_sum[l];
+        stats->sum_sq[c] += lane_sq[l];
+        if (lane_min[l] < stats->min[c]) stats->min[c] = lane_min[l];
+        if (lane_max[l] > stats->max[c]) stats->max[c] = lane_max[l];
+    }
+}
+
+#if defined(KERNEL_AVX2)
+
+#define LANES 16
+
+static int stats_simd(const signed short* buffer, int length,
+                      int no_channels, block_stats_t* stats)
+{
+    __m256i vmin = _mm256_set1_epi16(32767);
+    __m256i vmax = _mm256_set1_epi16(-32768);
+    __m256i acc_lo = _mm256_setzero_si256();
+    __m256i acc_hi = _mm256_setzero_si256();
+    __m256i acc_sq[4];
+    __m256i zero = _mm256_setzero_si256();
+    int lane_sum[LANES];
+    short lane_min[LANES];
+    short lane_max[LANES];
+    __int64 lane_total[LANES];
+    __int64 lane_sq[LANES];
+    __int64 sq[4][4];
+    int vectors = length / LANES;
+    int i, l;
+
+    for (l = 0; l < 4; l++) {
+        acc_sq[l] = _mm256_setzero_si256();
+    }
+
+    for (l = 0; l < LANES; l++) {
+        lane_total[l] = 0;
+    }
+    for (i = 0; i < vectors; i++) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(buffer + i*LANES));
+
+        vmin = _mm256_min_epi16(vmin, v);
+        vmax = _mm256_max_epi16(vmax, v);
+        /* Sign extend to 32 bits. Unpacking works per 128-bit half, so acc_lo
+         * holds lanes 0-3 and 8-11 and acc_hi lanes 4-7 and 12-15.
+         */
+        acc_lo = _mm256_add_epi32(acc_lo, _mm256_srai_epi32(_mm256_unpacklo_epi16(v, v), 16));
+        acc_hi = _mm256_add_epi32(acc_hi, _mm256_srai_epi32(_mm256_unpackhi_epi16(v, v), 16));
+        /* The squares need 32 bits each and 64 bits once summed. */
+        {
+            __m256i sq_lo16 = _mm256_mullo_epi16(v, v);
+            __m256i sq_hi16 = _mm256_mulhi_epi16(v, v);
+            __m256i sq_lo = _mm256_unpacklo_epi16(sq_lo16, sq_hi16);
+            __m256i sq_hi = _mm256_unpackhi_epi16(sq_lo16, sq_hi16);
+
+            acc_sq[0] = _mm256_add_epi64(acc_sq[0], _mm256_unpacklo_epi32(sq_lo, zero));
+            acc_sq[1] = _mm256_add_epi64(acc_sq[1], _mm256_unpackhi_epi32(sq_lo, zero));
+            acc_sq[2] = _mm256_add_epi64(acc_sq[2], _mm256_unpacklo_epi32(sq_hi, zero));
+            acc_sq[3] = _mm256_add_epi64(acc_sq[3], _mm256_unpackhi_epi32(sq_hi, zero));
+        }
+        if ((i + 1) % FLUSH_INTERVAL == 0 || i + 1 == vectors) {
+            int lo[8];
+            int hi[8];
+
+            _mm256_storeu_si256((__m256i*)lo, acc_lo);
+            _mm256_storeu_si256((__m256i*)hi, acc_hi);
+            for (l = 0; l < 4; l++) {
+                lane_total[l]      += lo[l];
+                lane_total[l + 4]  += hi[l];
+                lane_total[l + 8]  += lo[l + 4];
+                lane_total[l + 12] += hi[l + 4];
+            }
+            acc_lo = _mm256_setzero_si256();
+            acc_hi = _mm256_setzero_si256();
+        }
+    }
+    for (l = 0; l < LANES; l++) {
+        lane_sum[l] = 0;
+    }
+    /* acc_sq[k] holds lanes 2k, 2k+1, 2k+8 and 2k+9. */
+    for (l = 0; l < 4; l++) {
+        _mm256_storeu_si256((__m256i*)sq[l], acc_sq[l]);
+        lane_sq[2*l]     = sq[l][0];
+        lane_sq[2*l + 1] = sq[l][1];
+        lane_sq[2*l + 8] = sq[l][2];
+        lane_sq[2*l + 9] = sq[l][3];
+    }
+    _mm256_storeu_si256((__m256i*)lane_min, vmin);
+    _mm256_storeu_si256((__m256i*)lane_max, vmax);
+    fold_lanes(lane_sum, lane_total, lane_sq, lane_min, lane_max, LANES, no_channels,
+               vectors, stats);
+    return vectors * LANES;
+}
+
+#elif defined(KERNEL_SSE2)
+
+#define LANES 8
+
+static int stats_simd(const signed short* buffer, int length,
+                      int no_channels, block_stats_t* stats)
+{
+    __m128i vmin = _mm_set1_epi16(32767);
+    __m128i vmax = _mm_set1_epi16(-32768);
+    __m128i acc_lo = _mm_setzero_si128();
+    __m128i acc_hi = _mm_setzero_si128();
+    __m128i acc_sq[4];
+    __m128i zero = _mm_setzero_si128();
+    int lane_sum[LANES];
+    short lane_min[LANES];
+    short lane_max[LANES];
+    __int64 lane_total[LANES];
+    __int64 lane_sq[LANES];
+    int vectors = length / LANES;
+    int i, l;
+
+    for (l = 0; l < 4; l++) {
+        acc_sq[l] = _mm_setzero_si128();
+    }
+
+    for (l = 0; l < LANES; l++) {
+        lane_total[l] = 0;
+    }
+    for (i = 0; i < vectors; i++) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(buffer + i*LANES));
+
+        vmin = _mm_min_epi16(vmin, v);
+        vmax = _mm_max_epi16(vmax, v);
+        /* Sign extend to 32 bits: acc_lo holds lanes 0-3, acc_hi lanes 4-7. */
+        acc_lo = _mm_add_epi32(acc_lo, _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16));
+        acc_hi = _mm_add_epi32(acc_hi, _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16));
+        /* The squares need 32 bits each and 64 bits once summed:
+         * acc_sq[k] holds lanes 2k and 2k+1.
+         */
+        {
+            __m128i sq_lo16 = _mm_mullo_epi16(v, v);
+            __m128i sq_hi16 = _mm_mulhi_epi16(v, v);
+            __m128i sq_lo = _mm_unpacklo_epi16(sq_lo16, sq_hi16);
+            __m128i sq_hi = _mm_unpackhi_epi16(sq_lo16, sq_hi16);
+
+            acc_sq[0] = _mm_add_epi64(acc_sq[0], _mm_unpacklo_epi32(sq_lo, zero));
+            acc_sq[1] = _mm_add_epi64(acc_sq[1], _mm_unpackhi_epi32(sq_lo, zero));
+            acc_sq[2] = _mm_add_epi64(acc_sq[2], _mm_unpacklo_epi32(sq_hi, zero));
+            acc_sq[3] = _mm_add_epi64(acc_sq[3], _mm_unpackhi_epi32(sq_hi, zero));
+        }
+        if ((i + 1) % FLUSH_INTERVAL == 0) {
+            _mm_storeu_si128((__m128i*)lane_sum, acc_lo);
+            _mm_storeu_si128((__m128i*)(lane_sum + 4), acc_hi);
+            for (l = 0; l < LANES; l++) {
+                lane_total[l] += lane_sum[l];
+            }
+            acc_lo = _mm_setzero_si128();
+            acc_hi = _mm_setzero_si128();
+        }
+    }
+    _mm_storeu_si128((__m128i*)lane_sum, acc_lo);
+    _mm_storeu_si128((__m128i*)(lane_sum + 4), acc_hi);
+    for (l = 0; l < 4; l++) {
+        _mm_storeu_si128((__m128i*)(lane_sq + 2*l), acc_sq[l]);
+    }
+    _mm_storeu_si128((__m128i*)lane_min, vmin);
+    _mm_storeu_si128((__m128i*)lane_max, vmax);
+    fold_lanes(lane_sum, lane_total, lane_sq, lane_min, lane_max, LANES, no_channels,
+               vectors, stats);
+    return vectors * LANES;
+}
+
+#endif
+
+void kernel_block_stats(const signed short* buffer, int length,
+                        int no_channels, int offset, block_stats_t* stats)
+{
+    stats_reset(stats, no_channels);
+#if defined(LANES)
+    if (LANES % no_channels == 0) {
+        /* Align the start with a scan so that lane l holds channel
+         * l % no_channels.
+         */
+        int head = (no_channels - offset) % no_channels;
+        int done;
+
+        if (head > length) {
+            head = length;
+        }
+        stats_scalar(buffer, head, no_channels, offset, stats);
+        done = head + stats_simd(buffer + head, length - head, no_channels, stats);
+        stats_scalar(buffer + done, length - done, no_channels, 0, stats);
+        return;
+    }
+#endif
+    stats_scalar(buffer, length, no_channels, offset, stats);
+}
+
+const char* kernel_isa(void)
+{
+#if defined(KERNEL_AVX2)
+    return "AVX2";
+#elif defined(KERNEL_SSE2)
+    return "SSE2";
+#else
+    return "scalar";
+#endif
+}
@@ -0,0 +1,58 @@
+/*
+ * Windows command line utility to record analog input samples in differential
+ * mode from a USB-1901 DAQ in double buffered mode.
+ *
+ * Copyright (C) 2014, 2016  Anders Gidenstam, Chalmers University of Technology
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*----------------------------------------------------------------------------*/
+/* Per buffer sample kernels.                                                 */
+/*                                                                            */
+/* The kernels work on a whole buffer of interleaved samples at a time. For   */
+/* 1, 2, 4 and 8 channels every SIMD lane always holds the same channel, so   */
+/* the per channel sums, sums of squares, minima and maxima are accumulated  */
+/* lane-wise without de-interleaving and only folded into channels once at    */
+/* the end. Other channel counts use a scalar loop. The SIMD width, SSE2 or   */
+/* AVX2, is chosen at compile time.                                           */
+/*----------------------------------------------------------------------------*/
+
+#ifndef SAMPLE_KERNEL_H
+#define SAMPLE_KERNEL_H
+
+#define KERNEL_MAX_CHANNELS 8
+
+typedef struct {
+    int       count[KERNEL_MAX_CHANNELS];   /* Samples of each channel. */
+    __int64   sum[KERNEL_MAX_CHANNELS];     /* Sum of the ADC codes. */
+    __int64   sum_sq[KERNEL_MAX_CHANNELS];  /* Sum of their squares. */
+    short     min[KERNEL_MAX_CHANNELS];     /* Smallest ADC code. */
+    short     max[KERNEL_MAX_CHANNELS];     /* Largest ADC code. */
+} block_stats_t;
+
+/* Compute the statistics of length interleaved samples of no_channels
+ * channels, where buffer[0] belongs to channel offset.
+ */
+void kernel_block_stats(const signed short* buffer, int length,
+                        int no_channels, int offset, block_stats_t* stats);
+
+/* The same computed one sample at a time, for reference. */
+void kernel_block_stats_scalar(const signed short* buffer, int length,
+                               int no_channels, int offset, block_stats_t* stats);
+
+/* Name of the instruction set kernel_block_stats() was built for. */
+const char* kernel_isa(void);
+
+#endif
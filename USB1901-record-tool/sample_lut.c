@@ -0,0 +1,103 @@
+/*
+ * Windows command line utility to record analog input samples in differential
+ * mode from a USB-1901 DAQ in double buffered mode.
+ *
+ * Copyright (C) 2014, 2016  Anders Gidenstam, Chalmers University of Technology
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*----------------------------------------------------------------------------*/
+/* Code to volts lookup tables.                                               */
+/*----------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sample_lut.h"
+#include "recorder.h"
+
+/* One table per AD range. */
+#define MAX_LUTS            4
+
+static sample_lut_t luts[MAX_LUTS];
+static int no_luts = 0;
+
+static int build_text(sample_lut_t* lut, int precision)
+{
+    int code;
+
+    lut->text = (char*)malloc((size_t)LUT_SIZE * LUT_TEXT_STRIDE);
+    if (lut->text == NULL) {
+        return -1;
+    }
+    for (code = 0; code < LUT_SIZE; code++) {
+        char* entry = lut->text + (size_t)code*LUT_TEXT_STRIDE;
+
+        memset(entry, 0, LUT_TEXT_STRIDE);
+        entry[LUT_TEXT_STRIDE - 1] = (char)format_exp(entry, lut->volts[code], precision);
+    }
+    return 0;
+}
+
+const sample_lut_t* sample_lut_get(U16 range, int with_text, int precision)
+{
+    sample_lut_t* lut = NULL;
+    int i;
+
+    for (i = 0; i < no_luts; i++) {
+        if (luts[i].AdRange == range) {
+            lut = &luts[i];
+            break;
+        }
+    }
+    if (lut == NULL) {
+        if (no_luts == MAX_LUTS) {
+            fprintf(stderr, "sample_lut_get: Too many AD ranges.\n");
+            return NULL;
+        }
+        lut = &luts[no_luts];
+        lut->AdRange = range;
+        lut->text = NULL;
+        lut->volts = (double*)malloc(sizeof(double) * LUT_SIZE);
+        if (lut->volts == NULL) {
+            fprintf(stderr, "sample_lut_get: Out of memory.\n");
+            return NULL;
+        }
+        lut->scale = ad_range_to_volt(range)/(double)(1<<15);
+        for (i = 0; i < LUT_SIZE; i++) {
+            lut->volts[i] = (double)(signed short)(U16)i * lut->scale;
+        }
+        no_luts++;
+    }
+    if (with_text && lut->text == NULL) {
+        if (build_text(lut, precision) < 0) {
+            fprintf(stderr, "sample_lut_get: Out of memory.\n");
+            return NULL;
+        }
+    }
+    return lut;
+}
+
+void sample_lut_free_all(void)
+{
+    int i;
+
+    for (i = 0; i < no_luts; i++) {
+        free(luts[i].volts);
+        free(luts[i].text);
+    }
+    no_luts = 0;
+}
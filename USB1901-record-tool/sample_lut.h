@@ -0,0 +1,67 @@
+/*
+ * Windows command line utility to record analog input samples in differential
+ * mode from a USB-1901 DAQ in double buffered mode.
+ *
+ * Copyright (C) 2014, 2016  Anders Gidenstam, Chalmers University of Technology
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*----------------------------------------------------------------------------*/
+/* Code to volts lookup tables.                                               */
+/*                                                                            */
+/* There are only 65536 ADC codes and a handful of AD ranges, so the value    */
+/* of every code, and optionally its csv text, is computed once per range at  */
+/* startup. Converting a sample is then a single indexed load.                */
+/*----------------------------------------------------------------------------*/
+
+#ifndef SAMPLE_LUT_H
+#define SAMPLE_LUT_H
+
+#include "UsbDask.h"
+#include "csv_format.h"
+
+#define LUT_SIZE            65536
+/* Bytes per preformatted code. The text is not 0-terminated; the last byte
+ * holds its length instead. Must be at most CSV_MAX_FIELD_LENGTH - 2.
+ */
+#define LUT_TEXT_STRIDE     24
+
+typedef struct {
+    U16 AdRange;
+    double scale;   /* Volts per ADC code step. */
+    double* volts;  /* volts[(U16)code] is the voltage of code. */
+    char* text;     /* text + (U16)code*LUT_TEXT_STRIDE is its csv text. */
+} sample_lut_t;
+
+/* The voltage of code in range. */
+#define LUT_VOLTS(lut, code) \
+    ((lut)->volts[(U16)(code)])
+/* Copy the text of code to out, which must have room for LUT_TEXT_STRIDE
+ * characters, and advance out past it.
+ */
+#define LUT_COPY_TEXT(lut, code, out) \
+    do { \
+        const char* lut_entry = (lut)->text + (size_t)(U16)(code)*LUT_TEXT_STRIDE; \
+        memcpy((out), lut_entry, LUT_TEXT_STRIDE); \
+        (out) += lut_entry[LUT_TEXT_STRIDE - 1]; \
+    } while (0)
+
+/* Get the table for range, building it on first use. If with_text the csv
+ * text with the given precision is built too. Returns NULL on failure.
+ */
+const sample_lut_t* sample_lut_get(U16 range, int with_text, int precision);
+void sample_lut_free_all(void);
+
+#endif
@@ -0,0 +1,205 @@
+/*
+ * Windows command line utility to record analog input samples in differential
+ * mode from a USB-1901 DAQ in double buffered mode.
+ *
+ * Copyright (C) 2014, 2016  Anders Gidenstam, Chalmers University of Technology
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*----------------------------------------------------------------------------*/
+/* Control of the recording over a named pipe.                                */
+/*----------------------------------------------------------------------------*/
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "service.h"
+
+/* Internal functions. */
+static int start_io(service_t* service);
+static void disconnect(service_t* service);
+
+int service_open(service_t* service, const char* name)
+{
+    char path[MAX_PATH];
+
+    memset(service, 0, sizeof(service_t));
+    if (strlen(SERVICE_PIPE_PREFIX) + strlen(name) >= sizeof(path)) {
+        fprintf(stderr, "service_open: The pipe name '%s' is too long.\n", name);
+        return -1;
+    }
+    sprintf(path, "%s%s", SERVICE_PIPE_PREFIX, name);
+    service->pipe = CreateNamedPipeA(path, PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED,
+                                     PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT,
+                                     1, SERVICE_MAX_LINE, SERVICE_MAX_LINE, 0, NULL);
+    if (service->pipe == INVALID_HANDLE_VALUE) {
+        fprintf(stderr, "service_open: CreateNamedPipe error %d for '%s'.\n",
+                GetLastError(), path);
+        return -1;
+    }
+    service->overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (service->overlapped.hEvent == NULL) {
+        fprintf(stderr, "service_open: CreateEvent error %d.\n", GetLastError());
+        CloseHandle(service->pipe);
+        return -1;
+    }
+    return 0;
+}
+
+void service_close(service_t* service)
+{
+    DWORD n;
+
+    if (service->pending) {
+        CancelIo(service->pipe);
+        GetOverlappedResult(service->pipe, &service->overlapped, &n, TRUE);
+    }
+    if (service->connected) {
+        FlushFileBuffers(service->pipe);
+        DisconnectNamedPipe(service->pipe);
+    }
+    CloseHandle(service->overlapped.hEvent);
+    CloseHandle(service->pipe);
+}
+
+int service_next(service_t* service, DWORD timeout, char** command)
+{
+    LARGE_INTEGER now;
+    char* end;
+    DWORD n;
+    BOOL ok;
+
+    /* Drop the command returned last time. */
+    if (service->used > 0) {
+        memmove(service->line, service->line + service->used, service->fill - service->used);
+        service->fill -= service->used;
+        service->used = 0;
+    }
+    for (;;) {
+        end = (char*)memchr(service->line, '\n', service->fill);
+        if (end != NULL) {
+            service->used = (DWORD)(end - service->line) + 1;
+            *end = '\0';
+            if (end > service->line && end[-1] == '\r') {
+                end[-1] = '\0';
+            }
+            *command = service->line;
+            return 1;
+        }
+        if (service->fill == sizeof(service->line)) {
+            /* Not a command; drop it so the client can go on. */
+            service->fill = 0;
+            service_reply(service, "error Commands are at most %d characters.",
+                          SERVICE_MAX_LINE - 1);
+        }
+        if (!service->pending && start_io(service) < 0) {
+            return -1;
+        }
+        if (WaitForSingleObject(service->overlapped.hEvent, timeout) == WAIT_TIMEOUT) {
+            return 0;
+        }
+        ok = GetOverlappedResult(service->pipe, &service->overlapped, &n, FALSE);
+        service->pending = 0;
+        if (!service->connected) {
+            if (!ok) {
+                fprintf(stderr, "service_next: ConnectNamedPipe error %d.\n", GetLastError());
+                return -1;
+            }
+            service->connected = 1;
+        } else if (!ok) {
+            if (GetLastError() != ERROR_BROKEN_PIPE) {
+                fprintf(stderr, "service_next: ReadFile error %d.\n", GetLastError());
+                return -1;
+            }
+            disconnect(service);
+        } else {
+            QueryPerformanceCounter(&now);
+            service->qpc = now.QuadPart;
+            service->fill += n;
+        }
+    }
+}
+
+void service_reply(service_t* service, const char* format, ...)
+{
+    char text[2 * SERVICE_MAX_LINE];
+    va_list args;
+    DWORD written;
+    int length;
+
+    if (!service->connected) {
+        return;
+    }
+    va_start(args, format);
+    length = _vsnprintf(text, sizeof(text) - 2, format, args);
+    va_end(args);
+    if (length < 0) {
+        length = sizeof(text) - 2;
+    }
+    text[length++] = '\n';
+    /* Only the reply is in flight, so the overlapped structure is free. */
+    ResetEvent(service->overlapped.hEvent);
+    if (!WriteFile(service->pipe, text, length, NULL, &service->overlapped) &&
+        GetLastError() != ERROR_IO_PENDING) {
+        disconnect(service);
+        return;
+    }
+    if (!GetOverlappedResult(service->pipe, &service->overlapped, &written, TRUE)) {
+        disconnect(service);
+    }
+}
+
+/* Start waiting for a client or reading from the connected one. */
+static int start_io(service_t* service)
+{
+    ResetEvent(service->overlapped.hEvent);
+    if (!service->connected) {
+        if (!ConnectNamedPipe(service->pipe, &service->overlapped)) {
+            if (GetLastError() == ERROR_IO_PENDING) {
+                service->pending = 1;
+                return 0;
+            }
+            if (GetLastError() != ERROR_PIPE_CONNECTED) {
+                fprintf(stderr, "service_next: ConnectNamedPipe error %d.\n", GetLastError());
+                return -1;
+            }
+        }
+        /* The client came before the call. */
+        service->connected = 1;
+    }
+    /* A read that completes at once still signals the event. */
+    if (!ReadFile(service->pipe, service->line + service->fill,
+                  sizeof(service->line) - service->fill, NULL, &service->overlapped) &&
+        GetLastError() != ERROR_IO_PENDING) {
+        if (GetLastError() != ERROR_BROKEN_PIPE) {
+            fprintf(stderr, "service_next: ReadFile error %d.\n", GetLastError());
+            return -1;
+        }
+        disconnect(service);
+        return start_io(service);
+    }
+    service->pending = 1;
+    return 0;
+}
+
+/* Let the client go and get ready for the next one. */
+static void disconnect(service_t* service)
+{
+    DisconnectNamedPipe(service->pipe);
+    service->connected = 0;
+    service->fill = 0;
+    service->used = 0;
+}
@@ -0,0 +1,66 @@
+/*
+ * Windows command line utility to record analog input samples in differential
+ * mode from a USB-1901 DAQ in double buffered mode.
+ *
+ * Copyright (C) 2014, 2016  Anders Gidenstam, Chalmers University of Technology
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*----------------------------------------------------------------------------*/
+/* Control of the recording over a named pipe.                                */
+/*                                                                            */
+/* One client at a time sends commands, one line of text each, and gets one  */
+/* line back for each. The pipe is read with overlapped I/O so that the       */
+/* thread serving it can wait for a command and watch the recording at the   */
+/* same time. When a client disconnects, the next one is accepted.            */
+/*----------------------------------------------------------------------------*/
+
+#ifndef SERVICE_H
+#define SERVICE_H
+
+#include <windows.h>
+
+#define SERVICE_PIPE_PREFIX "\\\\.\\pipe\\"
+#define SERVICE_MAX_LINE    512 /* Longest command, including its end. */
+
+typedef struct {
+    HANDLE pipe;
+    OVERLAPPED overlapped;              /* Of the pending connect or read. */
+    int connected;                      /* Set while a client is connected. */
+    int pending;                        /* Set while a connect or read is
+                                           pending. */
+    char line[SERVICE_MAX_LINE];        /* Received text. */
+    DWORD fill;                         /* Bytes in line. */
+    DWORD used;                         /* Bytes of the last command returned. */
+    __int64 qpc;                        /* QueryPerformanceCounter() when the
+                                           last command was received. */
+} service_t;
+
+/* Create the pipe SERVICE_PIPE_PREFIX name. Returns 0 on success and -1 on
+ * failure, after printing the reason to stderr.
+ */
+int service_open(service_t* service, const char* name);
+void service_close(service_t* service);
+
+/* Wait up to timeout ms for the next command. Returns 1 with the command,
+ * 0-terminated and without its line end, in *command, 0 if none came in
+ * time and -1 on failure.
+ */
+int service_next(service_t* service, DWORD timeout, char** command);
+
+/* Answer the last command with a line of printf() formatted text. */
+void service_reply(service_t* service, const char* format, ...);
+
+#endif
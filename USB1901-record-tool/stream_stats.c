@@ -0,0 +1,184 @@
+/*
+ * Windows command line utility to record analog input samples in differential
+ * mode from a USB-1901 DAQ in double buffered mode.
+ *
+ * Copyright (C) 2014, 2016  Anders Gidenstam, Chalmers University of Technology
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*----------------------------------------------------------------------------*/
+/* Statistics of each channel over a whole recording.                         */
+/*----------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "UsbDask.h"
+#include "stream_stats.h"
+
+const double stream_quantile_level[STREAM_QUANTILES] = { 0.01, 0.25, 0.5, 0.75, 0.99 };
+
+/* Internal functions. */
+static void merge_moments(stream_channel_t* channel, unsigned __int64 count,
+                          double mean, double m2);
+
+int stream_stats_init(stream_stats_t* stats, int no_channels)
+{
+    int c;
+
+    stats->no_channels = 0;
+    for (c = 0; c < no_channels; c++) {
+        stats->channel[c].histogram =
+            (unsigned __int64*)calloc(STREAM_CODES, sizeof(unsigned __int64));
+        if (stats->channel[c].histogram == NULL) {
+            fprintf(stderr, "stream_stats_init: Out of memory.\n");
+            stats->no_channels = c;
+            stream_stats_free(stats);
+            return -1;
+        }
+    }
+    stats->no_channels = no_channels;
+    stream_stats_reset(stats);
+    return 0;
+}
+
+void stream_stats_free(stream_stats_t* stats)
+{
+    int c;
+
+    for (c = 0; c < stats->no_channels; c++) {
+        free(stats->channel[c].histogram);
+        stats->channel[c].histogram = NULL;
+    }
+    stats->no_channels = 0;
+}
+
+void stream_stats_reset(stream_stats_t* stats)
+{
+    int c;
+
+    for (c = 0; c < stats->no_channels; c++) {
+        stats->channel[c].count = 0;
+        stats->channel[c].mean = 0.0;
+        stats->channel[c].m2 = 0.0;
+        stats->channel[c].min = 32767;
+        stats->channel[c].max = -32768;
+        memset(stats->channel[c].histogram, 0, STREAM_CODES * sizeof(unsigned __int64));
+    }
+}
+
+void stream_stats_add(stream_stats_t* stats, const signed short* buffer, int length)
+{
+    block_stats_t block;
+    stream_channel_t* channel;
+    double mean;
+    int i;
+    int c;
+
+    if (stats->no_channels == 0 || length <= 0) {
+        return;
+    }
+    kernel_block_stats(buffer, length, stats->no_channels, 0, &block);
+    for (c = 0; c < stats->no_channels; c++) {
+        channel = &stats->channel[c];
+        if (block.count[c] == 0) {
+            continue;
+        }
+        mean = (double)block.sum[c] / block.count[c];
+        merge_moments(channel, block.count[c], mean,
+                      (double)block.sum_sq[c] - (double)block.sum[c] * mean);
+        if (block.min[c] < channel->min) {
+            channel->min = block.min[c];
+        }
+        if (block.max[c] > channel->max) {
+            channel->max = block.max[c];
+        }
+    }
+    c = 0;
+    for (i = 0; i < length; i++) {
+        stats->channel[c].histogram[(U16)buffer[i]]++;
+        if (++c == stats->no_channels) {
+            c = 0;
+        }
+    }
+}
+
+void stream_stats_merge(stream_stats_t* stats, const stream_stats_t* other)
+{
+    stream_channel_t* channel;
+    const stream_channel_t* from;
+    int code;
+    int c;
+
+    for (c = 0; c < stats->no_channels && c < other->no_channels; c++) {
+        channel = &stats->channel[c];
+        from = &other->channel[c];
+        if (from->count == 0) {
+            continue;
+        }
+        merge_moments(channel, from->count, from->mean, from->m2);
+        if (from->min < channel->min) {
+            channel->min = from->min;
+        }
+        if (from->max > channel->max) {
+            channel->max = from->max;
+        }
+        for (code = 0; code < STREAM_CODES; code++) {
+            channel->histogram[code] += from->histogram[code];
+        }
+    }
+}
+
+double stream_stats_variance(const stream_channel_t* channel)
+{
+    return channel->count > 0 ? channel->m2 / (double)channel->count : 0.0;
+}
+
+void stream_stats_quantiles(const stream_channel_t* channel, const double* level,
+                            int no_levels, short* code)
+{
+    unsigned __int64 seen = 0;
+    unsigned __int64 rank;
+    int value = -32768;
+    int l;
+
+    for (l = 0; l < no_levels; l++) {
+        /* The rank of the level, from 1. */
+        rank = (unsigned __int64)(level[l] * (double)channel->count);
+        if ((double)rank < level[l] * (double)channel->count || rank == 0) {
+            rank++;
+        }
+        while (value < 32767 && seen + channel->histogram[(U16)value] < rank) {
+            seen += channel->histogram[(U16)value];
+            value++;
+        }
+        code[l] = (short)value;
+    }
+}
+
+/* Add count samples with the given mean and sum of squared deviations to
+ * the moments of channel (Chan et al.'s pairwise update).
+ */
+static void merge_moments(stream_channel_t* channel, unsigned __int64 count,
+                          double mean, double m2)
+{
+    unsigned __int64 total = channel->count + count;
+    double delta = mean - channel->mean;
+
+    channel->mean += delta * (double)count / (double)total;
+    channel->m2 += m2 + delta * delta * (double)channel->count * (double)count / (double)total;
+    channel->count = total;
+}
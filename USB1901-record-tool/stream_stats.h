@@ -0,0 +1,84 @@
+/*
+ * Windows command line utility to record analog input samples in differential
+ * mode from a USB-1901 DAQ in double buffered mode.
+ *
+ * Copyright (C) 2014, 2016  Anders Gidenstam, Chalmers University of Technology
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*----------------------------------------------------------------------------*/
+/* Statistics of each channel over a whole recording.                         */
+/*                                                                            */
+/* Every buffer is summarized by kernel_block_stats() and merged into the     */
+/* running count, mean and sum of squared deviations of each channel with    */
+/* the pairwise form of Welford's update, which stays accurate over billions */
+/* of samples. A histogram of the 65536 ADC codes gives exact quantiles.     */
+/* All values are in ADC codes; multiply by the range's volts per code.      */
+/*----------------------------------------------------------------------------*/
+
+#ifndef STREAM_STATS_H
+#define STREAM_STATS_H
+
+#include "sample_kernel.h"
+
+#define STREAM_CODES        65536
+#define STREAM_QUANTILES    5   /* Levels reported, see stream_quantile_level. */
+
+typedef struct {
+    unsigned __int64 count;
+    double mean;
+    double m2;                          /* Sum of squared deviations from the
+                                           mean. */
+    short min;
+    short max;
+    unsigned __int64* histogram;        /* Samples of each code, indexed by
+                                           (U16)code. */
+} stream_channel_t;
+
+typedef struct {
+    int no_channels;                    /* 0 until stream_stats_init(). */
+    stream_channel_t channel[KERNEL_MAX_CHANNELS];
+} stream_stats_t;
+
+/* The quantile levels the program reports: 1%, 25%, 50%, 75% and 99%. */
+extern const double stream_quantile_level[STREAM_QUANTILES];
+
+/* Start empty statistics of no_channels channels. Returns 0 on success and
+ * -1 on failure, after printing the reason.
+ */
+int stream_stats_init(stream_stats_t* stats, int no_channels);
+void stream_stats_free(stream_stats_t* stats);
+
+/* Empty the statistics for a new recording of the same channels. */
+void stream_stats_reset(stream_stats_t* stats);
+
+/* Add length interleaved samples, whole scans. Does nothing before
+ * stream_stats_init().
+ */
+void stream_stats_add(stream_stats_t* stats, const signed short* buffer, int length);
+
+/* Add the statistics of other, of the same channels, to stats. */
+void stream_stats_merge(stream_stats_t* stats, const stream_stats_t* other);
+
+/* Population variance of a channel. */
+double stream_stats_variance(const stream_channel_t* channel);
+
+/* The codes at the no_levels ascending quantile levels, the smallest codes
+ * with at least that fraction of the samples at or below them.
+ */
+void stream_stats_quantiles(const stream_channel_t* channel, const double* level,
+                            int no_levels, short* code);
+
+#endif
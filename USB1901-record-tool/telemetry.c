@@ -0,0 +1,90 @@
+/*
+ * Windows command line utility to record analog input samples in differential
+ * mode from a USB-1901 DAQ in double buffered mode.
+ *
+ * Copyright (C) 2014, 2016  Anders Gidenstam, Chalmers University of Technology
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*----------------------------------------------------------------------------*/
+/* Live telemetry in named shared memory.                                     */
+/*----------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <string.h>
+#include "telemetry.h"
+
+int telemetry_open(telemetry_t* telemetry, const char* name, int no_cards)
+{
+    DWORD size = sizeof(telemetry_header_t) + no_cards * sizeof(telemetry_card_t);
+
+    telemetry->mapping = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+                                           0, size, name);
+    if (telemetry->mapping == NULL) {
+        fprintf(stderr, "telemetry_open: CreateFileMapping error %d for '%s'.\n",
+                GetLastError(), name);
+        return -1;
+    }
+    if (GetLastError() == ERROR_ALREADY_EXISTS) {
+        /* Another recording publishes there; its section may be smaller. */
+        fprintf(stderr, "telemetry_open: '%s' is already in use by another program.\n", name);
+        CloseHandle(telemetry->mapping);
+        telemetry->mapping = NULL;
+        return -1;
+    }
+    telemetry->header = (telemetry_header_t*)MapViewOfFile(telemetry->mapping, FILE_MAP_WRITE,
+                                                           0, 0, size);
+    if (telemetry->header == NULL) {
+        fprintf(stderr, "telemetry_open: MapViewOfFile error %d for '%s'.\n",
+                GetLastError(), name);
+        CloseHandle(telemetry->mapping);
+        telemetry->mapping = NULL;
+        return -1;
+    }
+    memset(telemetry->header, 0, size);
+    telemetry->card = (telemetry_card_t*)(telemetry->header + 1);
+    telemetry->header->version = TELEMETRY_VERSION;
+    telemetry->header->no_cards = no_cards;
+    telemetry->header->card_size = sizeof(telemetry_card_t);
+    /* Readers check the magic last. */
+    MemoryBarrier();
+    telemetry->header->magic = TELEMETRY_MAGIC;
+    return 0;
+}
+
+telemetry_card_t* telemetry_begin(telemetry_t* telemetry, int index)
+{
+    telemetry_card_t* card = &telemetry->card[index];
+
+    InterlockedIncrement(&card->sequence);
+    return card;
+}
+
+void telemetry_end(telemetry_t* telemetry, int index)
+{
+    InterlockedIncrement(&telemetry->card[index].sequence);
+}
+
+void telemetry_close(telemetry_t* telemetry)
+{
+    if (telemetry->header != NULL) {
+        UnmapViewOfFile(telemetry->header);
+        telemetry->header = NULL;
+    }
+    if (telemetry->mapping != NULL) {
+        CloseHandle(telemetry->mapping);
+        telemetry->mapping = NULL;
+    }
+}
@@ -0,0 +1,109 @@
+/*
+ * Windows command line utility to record analog input samples in differential
+ * mode from a USB-1901 DAQ in double buffered mode.
+ *
+ * Copyright (C) 2014, 2016  Anders Gidenstam, Chalmers University of Technology
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*----------------------------------------------------------------------------*/
+/* Live telemetry in named shared memory.                                     */
+/*                                                                            */
+/* Monitoring programs open the named file mapping read-only and find a       */
+/* telemetry_header_t, followed by one telemetry_card_t per card. The writer  */
+/* thread of each card updates its slot after every half buffer. A slot is    */
+/* guarded by its sequence number, which is odd while an update is under     */
+/* way: read it, copy the slot, and keep the copy only if the sequence was     */
+/* even and is unchanged afterwards.                                          */
+/*----------------------------------------------------------------------------*/
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <windows.h>
+#include "UsbDask.h"
+
+#define TELEMETRY_MAGIC         0x54393155  /* "U19T" */
+#define TELEMETRY_VERSION       2
+#define TELEMETRY_MAX_CARDS     4
+#define TELEMETRY_MAX_CHANNELS  8
+#define TELEMETRY_MAX_PAIRS     4
+#define TELEMETRY_LATEST        1024        /* Latest samples kept per card. */
+#define TELEMETRY_QUANTILES     5           /* 1%, 25%, 50%, 75% and 99%. */
+
+typedef struct {
+    U32 magic;                          /* TELEMETRY_MAGIC. */
+    U32 version;                        /* TELEMETRY_VERSION. */
+    U32 no_cards;
+    U32 card_size;                      /* sizeof(telemetry_card_t). */
+} telemetry_header_t;
+
+typedef struct {
+    volatile LONG sequence;             /* Odd while being updated. */
+    U16 card_id;
+    U16 no_channels;
+    U16 channel_id[TELEMETRY_MAX_CHANNELS];
+    double scan_rate;                   /* Hz. */
+    __int64 qpc;                        /* Transfer time of the last block. */
+    unsigned __int64 scans;             /* Scans recorded, including gaps. */
+    U32 gaps;
+    U32 overruns;
+    U32 dropped_blocks;
+
+    /* Volts of each channel over the last half buffer. */
+    double mean[TELEMETRY_MAX_CHANNELS];
+    double min[TELEMETRY_MAX_CHANNELS];
+    double max[TELEMETRY_MAX_CHANNELS];
+
+    /* The '-P' power pairs. */
+    U32 no_pairs;
+    double power[TELEMETRY_MAX_PAIRS];  /* Mean W over the last half buffer. */
+    double energy[TELEMETRY_MAX_PAIRS]; /* J so far. */
+
+    /* The last whole scans of the last half buffer as ADC codes, and the
+     * volts per code of each channel.
+     */
+    double scale[TELEMETRY_MAX_CHANNELS];
+    U32 latest_length;                  /* Samples in latest. */
+    signed short latest[TELEMETRY_LATEST];
+
+    /* Version 2: volts of each channel over the whole recording. The
+     * quantiles are refreshed about once a second.
+     */
+    double total_mean[TELEMETRY_MAX_CHANNELS];
+    double total_std[TELEMETRY_MAX_CHANNELS];
+    double total_min[TELEMETRY_MAX_CHANNELS];
+    double total_max[TELEMETRY_MAX_CHANNELS];
+    double quantile[TELEMETRY_MAX_CHANNELS][TELEMETRY_QUANTILES];
+} telemetry_card_t;
+
+typedef struct {
+    HANDLE mapping;
+    telemetry_header_t* header;
+    telemetry_card_t* card;             /* no_cards slots. */
+} telemetry_t;
+
+/* Create the shared memory name with room for no_cards cards.
+ * Returns 0 on success and -1 on failure, after printing the reason.
+ */
+int telemetry_open(telemetry_t* telemetry, const char* name, int no_cards);
+
+/* Bracket an update of the slot of card index. */
+telemetry_card_t* telemetry_begin(telemetry_t* telemetry, int index);
+void telemetry_end(telemetry_t* telemetry, int index);
+
+void telemetry_close(telemetry_t* telemetry);
+
+#endif